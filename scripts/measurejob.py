@@ -28,8 +28,9 @@ def measure(command, stdout=None):
 	ts = []
 	for line in call_stdout.decode().split('\n'):
 		if line.startswith('% event '):
-			splitline = line.split(None,7)
-			ts.append(float(splitline[5]))
+			# % event ID WALL CPU ...
+			splitline = line.split(None,5)
+			ts.append(float(splitline[3]))
 		elif line.startswith('% done'):
 			ts.append(float(line.split()[4]))
 		if stdout is not None:
@@ -0,0 +1,161 @@
+#ifndef BlockReader_h
+#define BlockReader_h
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <algorithm>
+#include <exception>
+
+// ---------------------------------------------------------------------
+//                      class BlockReader
+// ---------------------------------------------------------------------
+// Reads a sequence of blocks ahead of their consumers, on background
+// threads, into a ring of reusable buffers: block i is read into buffer
+// i % nbuffers once block i - nbuffers has been released. At most nbuffers
+// blocks are therefore in memory and the buffers keep their capacity from
+// block to block. The consumers take the blocks in order with next() and
+// hand them back with release(); several consumers can work on blocks at
+// the same time.
+//
+// Request describes a block, e.g. a file, a table and a range of rows. The
+// read function fills the data of a block from its request. It is called
+// on the reader threads, with the index of the thread (e.g. to keep a file
+// open per thread). An exception thrown by it is rethrown by next() for
+// the block, which is then released.
+template<class Request>
+class BlockReader
+{
+	public:
+		struct block_t
+		{
+			Request request;
+			std::vector<char> data;
+		};
+		typedef std::function<void(block_t &block, size_t reader)> read_t;
+
+		BlockReader(const std::vector<Request> &requests, size_t nbuffers, read_t read, size_t nreaders = 1);
+		~BlockReader();
+
+		// the next block, or nullptr once all have been taken
+		block_t * next();
+		void release(block_t * block);
+
+	private:
+		enum state_t {FREE, FULL, TAKEN};
+		struct slot_t
+		{
+			block_t block;
+			// the index of the block the slot is for
+			size_t sequence;
+			state_t state;
+			// the exception of a failed read
+			std::exception_ptr error;
+		};
+
+		const std::vector<Request> requests;
+		const read_t read;
+		std::vector<slot_t> slots;
+		size_t next_read, next_block;
+		bool stopping;
+		std::mutex m;
+		std::condition_variable cv;
+		std::vector<std::thread> readers;
+
+		BlockReader(const BlockReader&);
+		BlockReader& operator=(BlockReader);
+		void reader(size_t index);
+};
+
+template<class Request>
+BlockReader<Request>::BlockReader(const std::vector<Request> &requests_, size_t nbuffers, read_t read_, size_t nreaders)
+: requests(requests_), read(read_),
+  slots(std::max<size_t>(1, std::min(nbuffers, requests_.size()))),
+  next_read(0), next_block(0), stopping(false)
+{
+	for(size_t k=0; k<slots.size(); k++) {
+		slots[k].sequence = k;
+		slots[k].state = FREE;
+	}
+	for(size_t t=0; t<std::max<size_t>(1, std::min(nreaders, requests.size())); t++) {
+		readers.push_back(std::thread(&BlockReader::reader, this, t));
+	}
+}
+
+// Blocks that have not been taken are dropped.
+template<class Request>
+BlockReader<Request>::~BlockReader()
+{
+	{
+		std::lock_guard<std::mutex> lock(m);
+		stopping = true;
+		cv.notify_all();
+	}
+	for(std::thread &reader : readers) {
+		reader.join();
+	}
+}
+
+template<class Request>
+void BlockReader<Request>::reader(size_t index)
+{
+	std::unique_lock<std::mutex> lock(m);
+	while(next_read < requests.size()) {
+		const size_t i = next_read++;
+		slot_t &slot = slots[i % slots.size()];
+		cv.wait(lock, [&]{return stopping || (slot.sequence == i && slot.state == FREE);});
+		if(stopping) break;
+
+		// the slot is owned by this reader until it is marked as full
+		lock.unlock();
+		slot.block.request = requests[i];
+		try {
+			read(slot.block, index);
+		} catch(...) {
+			slot.error = std::current_exception();
+		}
+		lock.lock();
+
+		slot.state = FULL;
+		cv.notify_all();
+	}
+}
+
+template<class Request>
+typename BlockReader<Request>::block_t * BlockReader<Request>::next()
+{
+	std::unique_lock<std::mutex> lock(m);
+	if(next_block >= requests.size()) {
+		return nullptr;
+	}
+	const size_t i = next_block++;
+	slot_t &slot = slots[i % slots.size()];
+	cv.wait(lock, [&]{return slot.sequence == i && slot.state == FULL;});
+	if(slot.error) {
+		std::exception_ptr error = slot.error;
+		slot.error = nullptr;
+		slot.sequence += slots.size();
+		slot.state = FREE;
+		cv.notify_all();
+		std::rethrow_exception(error);
+	}
+	slot.state = TAKEN;
+	return &slot.block;
+}
+
+template<class Request>
+void BlockReader<Request>::release(block_t * block)
+{
+	std::lock_guard<std::mutex> lock(m);
+	for(slot_t &slot : slots) {
+		if(&slot.block == block) {
+			slot.sequence += slots.size();
+			slot.state = FREE;
+		}
+	}
+	cv.notify_all();
+}
+
+#endif
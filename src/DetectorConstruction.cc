@@ -148,7 +148,8 @@ G4VPhysicalVolume* DetectorConstruction::Construct() {
 		0                       // copy number
 	);
 
-	// Layers
+	// Layers, with copy numbers 1, 2, ... in the order of the model (which
+	// the event profile uses to tell them apart; the world volume has 0)
 	bool firstOrb = mFromCenter;
 	double nextStartRadius = mStartRadius;
 	for(std::vector<layer>::iterator it=layers.begin();it!=layers.end();++it) {
@@ -179,7 +180,7 @@ G4VPhysicalVolume* DetectorConstruction::Construct() {
 			ly.name+"_placement",   // name
 			fWorldVolume,           // mother volume
 			false,                  // no boolean operation
-			0                       // copy number
+			int(it-layers.begin())+1 // copy number
 		);
 	}
 
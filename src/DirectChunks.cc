@@ -0,0 +1,113 @@
+#include "DirectChunks.hh"
+
+#include <cstring>
+#include <zlib.h>
+
+// ---------------------------------------------------------------------
+//                      class DirectChunks
+// ---------------------------------------------------------------------
+// The rows can be copied as they are if the table has the type of the
+// struct (H5Tequal compares the members by name, offset and type).
+DirectChunks::DirectChunks(hid_t group, const std::string &name, hid_t row_type, size_t row_size_)
+: dsid(H5Dopen(group, name.c_str(), H5P_DEFAULT)), usable_(false), row_size(row_size_),
+  chunk_rows(0), deflate_level(-1)
+{
+	if(dsid < 0) {
+		throw std::out_of_range("DirectChunks: unable to open table "+name);
+	}
+
+	hid_t dstype = H5Dget_type(dsid);
+	const bool same_type = H5Tequal(dstype, row_type) > 0;
+	H5Tclose(dstype);
+
+	hid_t dcpl = H5Dget_create_plist(dsid);
+	hsize_t dims[1];
+	bool chunked = H5Pget_layout(dcpl) == H5D_CHUNKED && H5Pget_chunk(dcpl, 1, dims) == 1;
+	bool filters_known = true;
+	for(int i=0; i<H5Pget_nfilters(dcpl); i++) {
+		unsigned flags, values[8];
+		size_t nvalues = 8;
+		const H5Z_filter_t filter = H5Pget_filter2(dcpl, i, &flags, &nvalues, values, 0, nullptr, nullptr);
+		if(i == 0 && filter == H5Z_FILTER_DEFLATE && nvalues >= 1) {
+			deflate_level = values[0];
+		} else {
+			filters_known = false;
+		}
+	}
+	H5Pclose(dcpl);
+
+	if(chunked) {
+		chunk_rows = dims[0];
+	}
+	usable_ = same_type && chunked && filters_known;
+}
+
+DirectChunks::~DirectChunks()
+{
+	H5Dclose(dsid);
+}
+
+bool DirectChunks::read(hsize_t first, raw_t &raw) const
+{
+	const hsize_t offset[] = {first};
+	hsize_t size = 0;
+	if(H5Dget_chunk_storage_size(dsid, offset, &size) < 0 || size == 0) {
+		return false;
+	}
+	raw.data.resize(size);
+	return H5Dread_chunk(dsid, H5P_DEFAULT, offset, &raw.filter_mask, raw.data.data()) >= 0;
+}
+
+bool DirectChunks::write(hsize_t first, hsize_t nrows, const raw_t &raw) const
+{
+	const hsize_t offset[] = {first}, extent[] = {nrows};
+	return H5Dset_extent(dsid, extent) >= 0
+	    && H5Dwrite_chunk(dsid, H5P_DEFAULT, raw.filter_mask, offset, raw.data.size(), raw.data.data()) >= 0;
+}
+
+// A chunk is stored as it is if the optional deflate filter failed on it,
+// which the first bit of its filter mask tells.
+void DirectChunks::decode(const char * data, size_t size, uint32_t filter_mask, void * rows, hsize_t n) const
+{
+	const size_t nbytes = n*row_size;
+	if(deflate_level < 0 || (filter_mask & 1)) {
+		if(size < nbytes) {
+			throw std::runtime_error("DirectChunks: truncated chunk");
+		}
+		memcpy(rows, data, nbytes);
+		return;
+	}
+
+	// the last chunk of a table is stored in full
+	std::vector<char> full;
+	char * out = static_cast<char*>(rows);
+	uLongf out_size = chunk_rows*row_size;
+	if(n < chunk_rows) {
+		full.resize(out_size);
+		out = full.data();
+	}
+	if(uncompress(reinterpret_cast<Bytef*>(out), &out_size, reinterpret_cast<const Bytef*>(data), size) != Z_OK
+	   || out_size < nbytes) {
+		throw std::runtime_error("DirectChunks: corrupt chunk");
+	}
+	if(out != rows) {
+		memcpy(rows, out, nbytes);
+	}
+}
+
+// As the deflate filter of HDF5 does it.
+void DirectChunks::encode(const void * rows, raw_t &raw) const
+{
+	const size_t nbytes = chunk_rows*row_size;
+	raw.filter_mask = 0;
+	if(deflate_level < 0) {
+		raw.data.assign(static_cast<const char*>(rows), static_cast<const char*>(rows) + nbytes);
+		return;
+	}
+	uLongf size = compressBound(nbytes);
+	raw.data.resize(size);
+	if(compress2(reinterpret_cast<Bytef*>(raw.data.data()), &size, static_cast<const Bytef*>(rows), nbytes, deflate_level) != Z_OK) {
+		throw std::runtime_error("DirectChunks: compression failed");
+	}
+	raw.data.resize(size);
+}
@@ -0,0 +1,296 @@
+#ifndef DirectChunks_h
+#define DirectChunks_h
+
+#include "HDFTable.hh"
+
+#include <vector>
+#include <deque>
+#include <map>
+#include <string>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <stdexcept>
+#include <cstdint>
+
+// ---------------------------------------------------------------------
+//                      class DirectChunks
+// ---------------------------------------------------------------------
+// Reads and writes the chunks of a table as they are stored in the file,
+// bypassing the HDF5 filter pipeline. HDF5 is not necessarily built
+// thread-safe, so its calls have to be serialized, but this way they are
+// only the raw I/O: the chunks can be (de)compressed on any thread.
+//
+// Only tables that store Row structs as they are in memory, in chunks of
+// rows that are either not filtered or only compressed with deflate (as
+// HDFTable creates them), can be accessed this way; usable() tells whether
+// a table is one. All the other functions may only be called on usable
+// tables. The functions that take a hid_t or are marked as HDF5 calls need
+// the HDF5 lock of the caller, decode() and encode() do not.
+class DirectChunks
+{
+	public:
+		// the bytes of a chunk, as stored in the file
+		struct raw_t
+		{
+			std::vector<char> data;
+			uint32_t filter_mask;
+
+			raw_t() : filter_mask(0) {}
+		};
+
+		// opens the table `name` of group (an HDF5 call)
+		template<class Row> static DirectChunks * open(hid_t group, const std::string &name);
+		~DirectChunks();
+
+		bool usable() const {return usable_;}
+		hsize_t chunkRows() const {return chunk_rows;}
+
+		// reads the chunk starting at row `first`, a multiple of chunkRows()
+		// (an HDF5 call); returns false if it is not stored
+		bool read(hsize_t first, raw_t &raw) const;
+		// writes the chunk starting at row `first`, extending the table to
+		// nrows rows (an HDF5 call)
+		bool write(hsize_t first, hsize_t nrows, const raw_t &raw) const;
+
+		// decodes the first n rows of a chunk into rows; throws
+		// std::runtime_error if it is corrupt
+		void decode(const raw_t &raw, void * rows, hsize_t n) const
+		{
+			decode(raw.data.data(), raw.data.size(), raw.filter_mask, rows, n);
+		}
+		void decode(const char * data, size_t size, uint32_t filter_mask, void * rows, hsize_t n) const;
+		// encodes a full chunk of rows
+		void encode(const void * rows, raw_t &raw) const;
+
+	private:
+		hid_t dsid;
+		bool usable_;
+		size_t row_size;
+		hsize_t chunk_rows;
+		// -1 if the chunks are not compressed
+		int deflate_level;
+
+		DirectChunks(hid_t group, const std::string &name, hid_t row_type, size_t row_size);
+		DirectChunks(const DirectChunks&);
+		DirectChunks& operator=(DirectChunks);
+};
+
+template<class Row>
+DirectChunks * DirectChunks::open(hid_t group, const std::string &name)
+{
+	hid_t type = hdf_row_type<Row>();
+	DirectChunks * chunks = new DirectChunks(group, name, type, sizeof(Row));
+	H5Tclose(type);
+	return chunks;
+}
+
+// ---------------------------------------------------------------------
+//                      class ChunkWriter
+// ---------------------------------------------------------------------
+// Appends Row structs to a table: the full chunks are compressed by
+// nthreads threads and written in order as DirectChunks, the HDF5 calls
+// being made under hdf5_mutex. The rows that do not fill a chunk (the end
+// of the last chunk of an existing table and the last rows) are appended
+// through the filter pipeline, as are all the rows of a table that is not
+// DirectChunks::usable(). At most 2*nthreads chunks wait to be written.
+template<class Row>
+class ChunkWriter
+{
+	public:
+		// opens the existing table `name` of group, taking hdf5_mutex
+		ChunkWriter(hid_t group, const std::string &name, std::mutex &hdf5_mutex, size_t nthreads);
+		~ChunkWriter();
+
+		void append(const Row * rows, size_t n);
+		// appends the remaining rows and waits for everything to be
+		// written; throws std::runtime_error if anything could not be
+		void finish();
+		// the rows of the table, including the ones not written yet
+		hsize_t nrows() const {return end;}
+
+	private:
+		struct job_t
+		{
+			hsize_t first;
+			std::vector<Row> rows;
+			bool direct;
+			DirectChunks::raw_t raw;
+		};
+
+		const hid_t group;
+		const std::string name;
+		std::mutex &hdf5_mutex;
+		DirectChunks * chunks;
+		hsize_t end;
+		std::vector<Row> pending;
+
+		// the jobs by their sequence numbers
+		std::mutex m;
+		std::condition_variable cv;
+		std::deque< std::pair<size_t, job_t*> > todo;
+		std::map<size_t, job_t*> done;
+		size_t submitted, next_write, max_jobs;
+		bool writing, stopping, failed;
+		std::vector<std::thread> threads;
+
+		ChunkWriter(const ChunkWriter&);
+		ChunkWriter& operator=(ChunkWriter);
+		void submit();
+		void worker();
+		void writeDone(std::unique_lock<std::mutex> &lock);
+		bool write(const job_t &job);
+};
+
+template<class Row>
+ChunkWriter<Row>::ChunkWriter(hid_t group_, const std::string &name_, std::mutex &hdf5_mutex_, size_t nthreads)
+: group(group_), name(name_), hdf5_mutex(hdf5_mutex_), chunks(nullptr), end(0),
+  submitted(0), next_write(0), max_jobs(2*std::max<size_t>(1, nthreads)),
+  writing(false), stopping(false), failed(false)
+{
+	{
+		std::lock_guard<std::mutex> lock(hdf5_mutex);
+		hsize_t nfields;
+		if(H5TBget_table_info(group, name.c_str(), &nfields, &end) < 0) {
+			throw std::out_of_range("ChunkWriter: unable to open table "+name);
+		}
+		chunks = DirectChunks::open<Row>(group, name);
+	}
+	for(size_t t=0; t<std::max<size_t>(1, nthreads); t++) {
+		threads.push_back(std::thread(&ChunkWriter::worker, this));
+	}
+}
+
+template<class Row>
+ChunkWriter<Row>::~ChunkWriter()
+{
+	{
+		std::lock_guard<std::mutex> lock(m);
+		stopping = true;
+		cv.notify_all();
+	}
+	for(std::thread &thread : threads) {
+		thread.join();
+	}
+	for(const std::pair<size_t, job_t*> &job : todo) {
+		delete job.second;
+	}
+	for(const std::pair<const size_t, job_t*> &job : done) {
+		delete job.second;
+	}
+	std::lock_guard<std::mutex> lock(hdf5_mutex);
+	delete chunks;
+}
+
+// The chunks are filled up to their boundaries, so that every full one can
+// be written directly.
+template<class Row>
+void ChunkWriter<Row>::append(const Row * rows, size_t n)
+{
+	const hsize_t chunk_rows = chunks->usable() ? chunks->chunkRows() : HDF_CHUNK_SIZE;
+	while(n > 0) {
+		const size_t fill = std::min<size_t>(n, chunk_rows - end % chunk_rows);
+		pending.insert(pending.end(), rows, rows + fill);
+		end += fill;
+		rows += fill;
+		n -= fill;
+		if(end % chunk_rows == 0) {
+			submit();
+		}
+	}
+}
+
+template<class Row>
+void ChunkWriter<Row>::finish()
+{
+	if(!pending.empty()) {
+		submit();
+	}
+	std::unique_lock<std::mutex> lock(m);
+	cv.wait(lock, [this]{return next_write == submitted || failed;});
+	if(failed) {
+		throw std::runtime_error("ChunkWriter: unable to write table "+name);
+	}
+}
+
+template<class Row>
+void ChunkWriter<Row>::submit()
+{
+	job_t * job = new job_t;
+	job->first = end - pending.size();
+	job->direct = chunks->usable() && pending.size() == chunks->chunkRows() && job->first % chunks->chunkRows() == 0;
+	job->rows.swap(pending);
+	pending.reserve(job->rows.size());
+
+	std::unique_lock<std::mutex> lock(m);
+	cv.wait(lock, [this]{return submitted - next_write < max_jobs || failed;});
+	if(failed) {
+		delete job;
+		throw std::runtime_error("ChunkWriter: unable to write table "+name);
+	}
+	todo.push_back(std::make_pair(submitted++, job));
+	cv.notify_all();
+}
+
+template<class Row>
+void ChunkWriter<Row>::worker()
+{
+	std::unique_lock<std::mutex> lock(m);
+	while(true) {
+		cv.wait(lock, [this]{return stopping || !todo.empty();});
+		if(todo.empty()) return;
+		std::pair<size_t, job_t*> job = todo.front();
+		todo.pop_front();
+
+		// a chunk that can not be compressed is left to HDF5
+		lock.unlock();
+		if(job.second->direct) {
+			try {
+				chunks->encode(job.second->rows.data(), job.second->raw);
+			} catch(const std::runtime_error&) {
+				job.second->direct = false;
+			}
+		}
+		lock.lock();
+
+		done[job.first] = job.second;
+		writeDone(lock);
+	}
+}
+
+// Writes the encoded chunks that are next in order, on one thread at a
+// time, without holding the lock of the queues while writing.
+template<class Row>
+void ChunkWriter<Row>::writeDone(std::unique_lock<std::mutex> &lock)
+{
+	if(writing) return;
+	writing = true;
+	typename std::map<size_t, job_t*>::iterator it;
+	while((it = done.find(next_write)) != done.end()) {
+		job_t * job = it->second;
+		done.erase(it);
+		lock.unlock();
+		const bool ok = write(*job);
+		delete job;
+		lock.lock();
+		failed = failed || !ok;
+		next_write++;
+		cv.notify_all();
+	}
+	writing = false;
+}
+
+template<class Row>
+bool ChunkWriter<Row>::write(const job_t &job)
+{
+	std::lock_guard<std::mutex> lock(hdf5_mutex);
+	if(job.direct) {
+		return chunks->write(job.first, job.first + job.rows.size(), job.raw);
+	}
+	const HDFTableLayout<Row> &layout = HDFTableLayout<Row>::get();
+	return H5TBappend_records(group, name.c_str(), job.rows.size(),
+		sizeof(Row), layout.offsets, layout.sizes, job.rows.data()
+	) >= 0;
+}
+
+#endif
@@ -0,0 +1,85 @@
+#include "EventProfile.hh"
+
+#include <vector>
+#include <algorithm>
+
+const char * const EventProfile::tablename = "profile";
+const char * const EventProfile::detailname = "profile_detail";
+
+EventProfile::EventProfile()
+: events(nullptr), detail(nullptr), event_cpu(0), event_wall(0), action_ns(0), last_key(0), last(nullptr)
+{}
+
+EventProfile::~EventProfile()
+{
+	close();
+}
+
+void EventProfile::open(hid_t file)
+{
+	close();
+	events = new HDFTable<event_profile_t>(file, tablename, 100);
+	detail = new HDFTable<profile_entry_t>(file, detailname, 1000);
+}
+
+void EventProfile::close()
+{
+	flush();
+	delete events;
+	delete detail;
+	events = nullptr;
+	detail = nullptr;
+}
+
+void EventProfile::flush()
+{
+	if(events != nullptr) {
+		events->flush();
+		detail->flush();
+	}
+}
+
+void EventProfile::beginEvent()
+{
+	entries.clear();
+	last = nullptr;
+	action_ns = 0;
+	event_cpu = Time::thread_ns();
+	event_wall = Time::wall_ns();
+}
+
+// The entries are written ordered by species and layer.
+void EventProfile::endEvent(hsize_t eventid)
+{
+	event_profile_t &row = events->row();
+	row.eventid = eventid;
+	row.cpu = (Time::thread_ns() - event_cpu)*1e-9;
+	row.wall = (Time::wall_ns() - event_wall)*1e-9;
+	row.actions = action_ns*1e-9;
+	row.tracks = row.steps = row.secondaries = 0;
+
+	std::vector<profile_entry_t> rows;
+	for(const std::pair<const uint64_t, counters_t> &entry : entries) {
+		profile_entry_t e;
+		e.eventid = eventid;
+		e.pid = int32_t(entry.first >> 32);
+		e.layer = int32_t(entry.first & 0xffffffff);
+		e.tracks = entry.second.tracks;
+		e.steps = entry.second.steps;
+		e.secondaries = entry.second.secondaries;
+		rows.push_back(e);
+
+		row.tracks += e.tracks;
+		row.steps += e.steps;
+		row.secondaries += e.secondaries;
+	}
+	events->write();
+
+	std::sort(rows.begin(), rows.end(), [](const profile_entry_t &a, const profile_entry_t &b) {
+		return a.pid < b.pid || (a.pid == b.pid && a.layer < b.layer);
+	});
+	for(const profile_entry_t &e : rows) {
+		detail->row() = e;
+		detail->write();
+	}
+}
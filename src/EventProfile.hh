@@ -0,0 +1,104 @@
+#ifndef EventProfile_h
+#define EventProfile_h
+
+#include "OutputTables.hh"
+#include "Timer.hh"
+
+#include <unordered_map>
+#include <cstdint>
+
+// ---------------------------------------------------------------------
+//                      class EventProfile
+// ---------------------------------------------------------------------
+// Profile of every event, written to the table `profile` (an
+// event_profile_t row per event) and, by species and layer, to the table
+// `profile_detail` (profile_entry_t rows), to see where the time of a run
+// goes. The layers are numbered from 1 in the order of the model, 0 being
+// the world volume around them.
+//
+// The user actions time themselves with an action_t at their start.
+class EventProfile
+{
+	public:
+		static const char * const tablename;
+		static const char * const detailname;
+
+		// measures the time spent in a user action, until it goes out of scope
+		class action_t
+		{
+			EventProfile * profile;
+			uint64_t start;
+
+			public:
+				// does nothing if profile is null
+				explicit action_t(EventProfile * profile);
+				~action_t();
+		};
+
+		EventProfile();
+		~EventProfile();
+
+		// creates the tables in a file (before it is switched to SWMR mode)
+		// and writes the following events to it until close()
+		void open(hid_t file);
+		void close();
+		void flush();
+
+		void beginEvent();
+		void endEvent(hsize_t eventid);
+		void track(int pid, int layer) {counters(pid, layer).tracks++;}
+		void step(int pid, int layer, size_t secondaries);
+
+	private:
+		struct counters_t
+		{
+			hsize_t tracks, steps, secondaries;
+		};
+
+		HDFTable<event_profile_t> * events;
+		HDFTable<profile_entry_t> * detail;
+
+		// in nanoseconds
+		uint64_t event_cpu, event_wall;
+		uint64_t action_ns;
+
+		// by pid and layer; the last entry is cached, since consecutive
+		// steps mostly are of the same track
+		std::unordered_map<uint64_t, counters_t> entries;
+		uint64_t last_key;
+		counters_t * last;
+
+		EventProfile(const EventProfile&);
+		EventProfile& operator=(EventProfile);
+		counters_t & counters(int pid, int layer);
+};
+
+inline EventProfile::action_t::action_t(EventProfile * profile_)
+: profile(profile_), start(profile_ != nullptr ? Time::wall_ns() : 0)
+{}
+
+inline EventProfile::action_t::~action_t()
+{
+	if(profile != nullptr) {
+		profile->action_ns += Time::wall_ns() - start;
+	}
+}
+
+inline EventProfile::counters_t & EventProfile::counters(int pid, int layer)
+{
+	const uint64_t key = (uint64_t(uint32_t(pid)) << 32) | uint32_t(layer);
+	if(last == nullptr || key != last_key) {
+		last = &entries[key];
+		last_key = key;
+	}
+	return *last;
+}
+
+inline void EventProfile::step(int pid, int layer, size_t secondaries)
+{
+	counters_t &c = counters(pid, layer);
+	c.steps++;
+	c.secondaries += secondaries;
+}
+
+#endif
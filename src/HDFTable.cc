@@ -2,7 +2,6 @@
 
 #include <cstring>
 #include <iostream>
-#include <hdf5_hl.h>
 
 using namespace std;
 
@@ -12,11 +11,14 @@ template<> const hid_t H5T<int>::hid = H5T_NATIVE_INT;
 template<> const hid_t H5T<unsigned int>::hid = H5T_NATIVE_UINT;
 template<> const hid_t H5T<long>::hid = H5T_NATIVE_LONG;
 template<> const hid_t H5T<unsigned long>::hid = H5T_NATIVE_ULONG;
+template<> const hid_t H5T<long long>::hid = H5T_NATIVE_LLONG;
+template<> const hid_t H5T<unsigned long long>::hid = H5T_NATIVE_ULLONG;
 
+// Longer strings are truncated, the result is always null-terminated.
 void string_to_cstr(const std::string &src, char dst[], size_t target_size)
 {
-	src.copy(dst, target_size-1);
-	for(size_t i=src.size(); i<target_size; i++) {
+	const size_t n = src.copy(dst, target_size-1);
+	for(size_t i=n; i<target_size; i++) {
 		dst[i] = '\0';
 	}
 }
@@ -28,83 +30,98 @@ hid_t create_hdf5_string(size_t length)
 	return ret;
 }
 
-// ---------------------------------------------------------------------
-//                    struct HDFTableField
-// ---------------------------------------------------------------------
+string hdf_read_attribute_string(hid_t loc, const string & name)
+{
+	hid_t attr = H5Aopen(loc, name.c_str(), H5P_DEFAULT);
+	if(attr < 0) {
+		throw out_of_range("unable to open attribute ("+name+")");
+	}
 
-HDFTableField::HDFTableField(const hid_t field_type, const std::string &field_name)
-: type(field_type), name(field_name), size(H5Tget_size(type))
+	hid_t type = H5Aget_type(attr);
+	vector<char> buf(H5Tget_size(type)+1, '\0');
+	H5Aread(attr, type, buf.data());
+	H5Tclose(type);
+	H5Aclose(attr);
+	return string(buf.data());
+}
+
+hid_t hdf_open_read(const string &path)
 {
-	//cout << "Add field: " << name << " (size: " << size << ", hid: " << type << ")" << endl;
+	H5E_auto2_t efunc; void * edata;
+	H5Eget_auto(H5E_DEFAULT, &efunc, &edata);
+	H5Eset_auto(H5E_DEFAULT, NULL, NULL);
+	hid_t fh = H5Fopen(path.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+	H5Eset_auto(H5E_DEFAULT, efunc, edata);
+	if(fh < 0) {
+		fh = H5Fopen(path.c_str(), H5F_ACC_RDONLY | H5F_ACC_SWMR_READ, H5P_DEFAULT);
+	}
+	return fh;
 }
 
 // ---------------------------------------------------------------------
-//                      class HDFTable
+// HDFTableInfo
 // ---------------------------------------------------------------------
-
-HDFTable::HDFTable(const hid_t h5group, const std::string &tablename, const std::vector<HDFTableField> &fields, size_t buffered_fields)
-: group(h5group), tname(tablename), nfields(fields.size()),
-  buffer_size(buffered_fields), inbuffer(0), totalrows(0)
+static const char * datatype_class_string(H5T_class_t cls)
 {
-	field_names  = new const char*[nfields];
-	field_offset = new size_t[nfields];
-	field_sizes  = new size_t[nfields];
-	field_types  = new hid_t[nfields];
-
-	size_t offset = 0;
-	for(size_t i=0; i<fields.size(); i++) {
-		const HDFTableField &field = fields[i];
-
-		field_names[i] = field.name.c_str();
-		field_offset[i] = offset;
-		field_sizes[i] = field.size;
-		field_types[i] = field.type;
-
-		offset_map.insert(pair<string,size_t>(field.name, offset));
-		offset += field.size;
+	switch(cls) {
+		case H5T_INTEGER: return "H5T_INTEGER";
+		case H5T_FLOAT: return "H5T_FLOAT";
+		case H5T_STRING: return "H5T_STRING";
+		case H5T_BITFIELD: return "H5T_BITFIELD";
+		case H5T_OPAQUE: return "H5T_OPAQUE";
+		case H5T_COMPOUND: return "H5T_COMPOUND";
+		case H5T_REFERENCE: return "H5T_REFERENCE";
+		case H5T_ENUM: return "H5T_ENUM";
+		case H5T_VLEN: return "H5T_VLEN";
+		case H5T_ARRAY: return "H5T_ARRAY";
+		default: return "UNKNOWN";
 	}
-	type_size = offset;
-
-	data = new unsigned char[type_size];
-	buffer = new unsigned char[type_size*buffer_size];
-
-	H5TBmake_table(
-		"Particles in an event.", group, tname.c_str(),
-		nfields, 0, type_size,
-		field_names, field_offset, field_types,
-		1000, 0, H5P_DEFAULT, 0
-	);
 }
 
-void HDFTable::writeBuffer()
+HDFTableInfo::HDFTableInfo(hid_t group, const string &name_)
+: name(name_)
 {
-	H5TBappend_records(
-		group, tname.c_str(), inbuffer,
-		type_size, field_offset, field_sizes,
-		buffer
-	);
-
-	inbuffer = 0;
-}
+	if(H5TBget_table_info(group, name.c_str(), &nfields, &nrecords) < 0) {
+		throw out_of_range("unable to open table "+name);
+	}
 
-void HDFTable::write()
-{
-	memcpy(buffer+type_size*inbuffer, data, type_size);
-	inbuffer++;
-	totalrows++;
-	if(inbuffer == buffer_size) {
-		writeBuffer();
+	hid_t dsid = H5Dopen(group, name.c_str(), H5P_DEFAULT);
+	hid_t dstype = H5Dget_type(dsid);
+	type_size = H5Tget_size(dstype);
+	for(unsigned i=0; i<nfields; i++) {
+		// the name is allocated by HDF5 and has to be freed by it
+		char * field_name = H5Tget_member_name(dstype, i);
+		field_names.push_back(field_name);
+		H5free_memory(field_name);
+
+		hid_t type = H5Tget_member_type(dstype, i);
+		field_offsets.push_back(H5Tget_member_offset(dstype, i));
+		field_sizes.push_back(H5Tget_size(type));
+		field_classes.push_back(H5Tget_class(type));
+		H5Tclose(type);
 	}
+	H5Tclose(dstype);
+	H5Dclose(dsid);
 }
 
-void HDFTable::flush()
+size_t HDFTableInfo::findField(const string & fieldname) const
 {
-	if(inbuffer > 0) {
-		writeBuffer();
+	for(size_t i=0; i<nfields; i++) {
+		if(fieldname == field_names[i]) {
+			return i;
+		}
 	}
+	throw out_of_range("Field `"+fieldname+"` not found!");
 }
 
-size_t HDFTable::nrows() const
+void HDFTableInfo::printInfo(ostream &out) const
 {
-	return totalrows;
+	out << "Table: " << name << endl;
+	out << "  nfields: " << nfields << endl;
+	out << "  nrecords: " << nrecords << endl;
+	out << "  type_size: " << type_size << endl;
+	for(size_t i=0; i<nfields; i++) {
+		out << "   - " << field_names[i] << " (" << datatype_class_string(field_classes[i]) << ") <"
+		    << field_offsets[i] << ", " << field_sizes[i] << ">" << endl;
+	}
 }
@@ -2,10 +2,10 @@
 #define HDFTable_h
 
 #include <hdf5.h>
+#include <hdf5_hl.h>
 
 #include <vector>
 #include <string>
-#include <map>
 #include <iostream>
 #include <stdexcept>
 
@@ -21,6 +21,11 @@ template<> const hid_t H5T<int>::hid;
 template<> const hid_t H5T<unsigned int>::hid;
 template<> const hid_t H5T<long>::hid;
 template<> const hid_t H5T<unsigned long>::hid;
+template<> const hid_t H5T<long long>::hid;
+template<> const hid_t H5T<unsigned long long>::hid;
+
+// Number of rows in an HDF5 chunk of the tables created by HDFTable.
+const hsize_t HDF_CHUNK_SIZE = 1000;
 
 void string_to_cstr(const std::string &src, char dst[], size_t target_size);
 hid_t create_hdf5_string(size_t length);
@@ -36,44 +41,247 @@ void write_hdf5_attribute(const hid_t h5group, const std::string & name, const T
 	H5Sclose(sid);
 }
 
+// Like write_hdf5_attribute, but overwrites the attribute if it exists,
+// which (unlike creating it) is also allowed after the file has been
+// switched to SWMR mode.
+template<class T>
+void update_hdf5_attribute(const hid_t h5group, const std::string & name, const T value)
+{
+	if(H5Aexists(h5group, name.c_str()) <= 0) {
+		write_hdf5_attribute(h5group, name, value);
+		return;
+	}
+	hid_t aid = H5Aopen(h5group, name.c_str(), H5P_DEFAULT);
+	H5Awrite(aid, H5T<T>::hid, &value);
+	H5Aclose(aid);
+}
+
+template<typename T>
+T hdf_read_attribute(hid_t loc, const std::string & name, hid_t type)
+{
+	hid_t attr = H5Aopen(loc, name.c_str(), H5P_DEFAULT);
+	if(attr < 0) {
+		throw std::out_of_range("unable to open attribute ("+name+")");
+	}
+
+	T buf;
+	H5Aread(attr, type, &buf);
+	H5Aclose(attr);
+	return buf;
+}
+std::string hdf_read_attribute_string(hid_t loc, const std::string & name);
+
+// Reads values [start, start+n) of a one-dimensional dataset.
+template<typename T>
+herr_t hdf_read_column(hid_t loc, const std::string & name, hsize_t start, hsize_t n, T * values)
+{
+	hid_t dsid = H5Dopen(loc, name.c_str(), H5P_DEFAULT);
+	if(dsid < 0) return dsid;
+	hid_t fspace = H5Dget_space(dsid);
+	H5Sselect_hyperslab(fspace, H5S_SELECT_SET, &start, NULL, &n, NULL);
+	hid_t mspace = H5Screate_simple(1, &n, NULL);
+	herr_t ret = H5Dread(dsid, H5T<T>::hid, mspace, fspace, H5P_DEFAULT, values);
+	H5Sclose(mspace);
+	H5Sclose(fspace);
+	H5Dclose(dsid);
+	return ret;
+}
+
+// Opens a file for reading. Files that are being written in SWMR mode (or
+// whose writer crashed) can only be opened as an SWMR reader, which is
+// tried if the normal open fails. Returns a negative value on failure.
+hid_t hdf_open_read(const std::string &path);
+
+// ---------------------------------------------------------------------
+//                      struct HDFTableInfo
+// ---------------------------------------------------------------------
+// The structure of an existing table, as stored in the file.
+struct HDFTableInfo
+{
+	std::string name;
+	hsize_t nfields, nrecords;
+	size_t type_size;
+	std::vector<std::string> field_names;
+	std::vector<size_t> field_offsets, field_sizes;
+	std::vector<H5T_class_t> field_classes;
+
+	// throws std::out_of_range if there is no such table
+	HDFTableInfo(hid_t group, const std::string &name);
+	void printInfo(std::ostream &out = std::cout) const;
+	// throws std::out_of_range if there is no such field
+	size_t findField(const std::string & fieldname) const;
+};
+
+// Returns a new (caller-owned) HDF5 datatype corresponding to the C++ type
+// of a row member. Character arrays are mapped to fixed length strings.
+template<typename T>
+struct H5Type
+{
+	static hid_t create() {return H5Tcopy(H5T<T>::hid);}
+};
+template<size_t N>
+struct H5Type<char[N]>
+{
+	static hid_t create() {return create_hdf5_string(N);}
+};
+
 // ---------------------------------------------------------------------
 //                    struct HDFTableField
 // ---------------------------------------------------------------------
+// Describes one member of a row struct. A row type is made into a table
+// by specializing HDFTableSchema with a title and a constexpr array of
+// fields, e.g.:
+//
+//   template<> struct HDFTableSchema<row_t> {
+//       static constexpr const char * title = "Rows";
+//       static constexpr HDFTableField fields[] = {
+//           HDF_TABLE_FIELD(row_t, x, "x"),
+//           HDF_TABLE_FIELD(row_t, pos.y, "pos.y")
+//       };
+//       static constexpr size_t nfields = sizeof(fields)/sizeof(*fields);
+//   };
+//
+// The array then needs a definition in exactly one translation unit.
 struct HDFTableField
 {
-	hid_t type;
-	std::string name;
-	size_t size;
+	const char * name;
+	size_t offset, size;
+	hid_t (*type)();
+};
+
+#define HDF_TABLE_FIELD(row, member, name) \
+	{name, HOFFSET(row, member), sizeof(((row*)0)->member), &H5Type<decltype(((row*)0)->member)>::create}
+
+template<class Row> struct HDFTableSchema;
+
+// ---------------------------------------------------------------------
+//                    struct HDFTableLayout
+// ---------------------------------------------------------------------
+// The schema of a row type laid out as the parallel arrays the HDF5 table
+// API expects. Built once per row type.
+template<class Row>
+struct HDFTableLayout
+{
+	typedef HDFTableSchema<Row> schema;
+	static const size_t nfields = schema::nfields;
+
+	const char * names[nfields];
+	size_t offsets[nfields];
+	size_t sizes[nfields];
+
+	static const HDFTableLayout & get()
+	{
+		static const HDFTableLayout layout;
+		return layout;
+	}
+
+	private:
+		HDFTableLayout()
+		{
+			for(size_t i=0; i<nfields; i++) {
+				names[i] = schema::fields[i].name;
+				offsets[i] = schema::fields[i].offset;
+				sizes[i] = schema::fields[i].size;
+			}
+		}
+};
+
+// Reads nrecords rows starting at start from an existing table directly
+// into an array of rows. Fields are matched by their order in the file.
+template<class Row>
+herr_t hdf_read_rows(hid_t group, const std::string &tablename, hsize_t start, hsize_t nrecords, Row * rows)
+{
+	const HDFTableLayout<Row> &layout = HDFTableLayout<Row>::get();
+	return H5TBread_records(group, tablename.c_str(), start, nrecords,
+		sizeof(Row), layout.offsets, layout.sizes, rows
+	);
+}
+
+// The compound type of Row in memory, whose fields HDF5 matches to the
+// fields of a table by their names.
+template<class Row>
+hid_t hdf_row_type()
+{
+	typedef HDFTableSchema<Row> schema;
+	hid_t type = H5Tcreate(H5T_COMPOUND, sizeof(Row));
+	for(size_t i=0; i<schema::nfields; i++) {
+		hid_t field_type = schema::fields[i].type();
+		H5Tinsert(type, schema::fields[i].name, schema::fields[i].offset, field_type);
+		H5Tclose(field_type);
+	}
+	return type;
+}
+
+// Reads the rows with the given row numbers (in any order) from an existing
+// table into an array of rows, in that order.
+template<class Row>
+herr_t hdf_read_rows_at(hid_t group, const std::string &tablename, const hsize_t * rownums, hsize_t n, Row * rows)
+{
+	hid_t dsid = H5Dopen(group, tablename.c_str(), H5P_DEFAULT);
+	if(dsid < 0) return dsid;
+	hid_t type = hdf_row_type<Row>();
+	hid_t fspace = H5Dget_space(dsid);
+	hid_t mspace = H5Screate_simple(1, &n, NULL);
+	herr_t ret = H5Sselect_elements(fspace, H5S_SELECT_SET, n, rownums);
+	if(ret >= 0) {
+		ret = H5Dread(dsid, type, mspace, fspace, H5P_DEFAULT, rows);
+	}
+	H5Sclose(mspace);
+	H5Sclose(fspace);
+	H5Tclose(type);
+	H5Dclose(dsid);
+	return ret;
+}
 
-	HDFTableField(const hid_t field_type, const std::string &field_name);
+// ---------------------------------------------------------------------
+//                      class TableWriter
+// ---------------------------------------------------------------------
+// An append-only table of Row structs. Rows are filled in place: row()
+// returns the slot of the next row and write() commits it.
+template<class Row>
+class TableWriter
+{
+	public:
+		virtual ~TableWriter() {}
+		virtual Row & row() = 0;
+		virtual void write() = 0;
+		virtual void flush() = 0;
+		virtual size_t nrows() const = 0;
 };
 
+// Tag for the HDFTable constructor that opens an existing table.
+struct hdf_table_open_t {};
+const hdf_table_open_t hdf_table_open = {};
+
 // ---------------------------------------------------------------------
 //                      class HDFTable
 // ---------------------------------------------------------------------
-class HDFTable
+// A buffered, append-only HDF5 table of Row structs. The rows are filled
+// in place in the write buffer. The functions that write rows throw
+// std::runtime_error if they can not be appended.
+template<class Row>
+class HDFTable : public TableWriter<Row>
 {
+	typedef HDFTableLayout<Row> layout_t;
+
 	const hid_t group;
 	const std::string tname;
+	const layout_t &layout;
 
-	std::map<std::string, size_t> offset_map;
-	hsize_t nfields, type_size;
-	const char ** field_names;
-	hid_t * field_types;
-	size_t * field_offset;
-	size_t * field_sizes;
-
-	unsigned char * data;
-	unsigned char * buffer;
-	size_t buffer_size, inbuffer, totalrows;
+	std::vector<Row> buffer;
+	size_t inbuffer, totalrows;
 
 	public:
-		HDFTable(const hid_t h5group, const std::string &tablename, const std::vector<HDFTableField> &fields, size_t buffered_fields = 1);
-		template<class T> T& bind(const std::string & name) const;
+		// with compress, the chunks of the table are compressed with deflate
+		HDFTable(const hid_t h5group, const std::string &tablename, size_t buffered_rows = 1, bool compress = false);
+		// appends to an existing table, which must have the layout of Row
+		HDFTable(const hid_t h5group, const std::string &tablename, hdf_table_open_t, size_t buffered_rows = 1);
 		template<class T> void setAttribute(hid_t type, const std::string & name, T value);
-		void write();
-		void flush();
-		size_t nrows() const;
+		Row & row() override;
+		void write() override;
+		void append(const Row * rows, size_t n);
+		void flush() override;
+		size_t nrows() const override;
 
 	private:
 		HDFTable(const HDFTable&);
@@ -81,19 +289,121 @@ class HDFTable
 		void writeBuffer();
 };
 
-template<class T>
-T& HDFTable::bind(const std::string & name) const
+template<class Row>
+HDFTable<Row>::HDFTable(const hid_t h5group, const std::string &tablename, size_t buffered_rows, bool compress)
+: group(h5group), tname(tablename), layout(layout_t::get()),
+  buffer(buffered_rows), inbuffer(0), totalrows(0)
+{
+	hid_t types[layout_t::nfields];
+	for(size_t i=0; i<layout_t::nfields; i++) {
+		types[i] = HDFTableSchema<Row>::fields[i].type();
+	}
+
+	H5TBmake_table(
+		HDFTableSchema<Row>::title, group, tname.c_str(),
+		layout_t::nfields, 0, sizeof(Row),
+		const_cast<const char**>(layout.names), layout.offsets, types,
+		HDF_CHUNK_SIZE, 0, compress ? 1 : 0, 0
+	);
+
+	for(size_t i=0; i<layout_t::nfields; i++) {
+		H5Tclose(types[i]);
+	}
+}
+
+template<class Row>
+HDFTable<Row>::HDFTable(const hid_t h5group, const std::string &tablename, hdf_table_open_t, size_t buffered_rows)
+: group(h5group), tname(tablename), layout(layout_t::get()),
+  buffer(buffered_rows), inbuffer(0), totalrows(0)
+{
+	hsize_t nfields, nrecords;
+	if(H5TBget_table_info(group, tname.c_str(), &nfields, &nrecords) < 0) {
+		throw std::out_of_range("HDFTable: unable to open table "+tname);
+	}
+	if(nfields != layout_t::nfields) {
+		throw std::runtime_error("HDFTable: table "+tname+" has a different number of fields");
+	}
+
+	// the rows would be converted to the field types of the file, which
+	// could silently truncate them (e.g. 64-bit IDs into a 32-bit table)
+	hid_t dsid = H5Dopen(group, tname.c_str(), H5P_DEFAULT);
+	hid_t dstype = H5Dget_type(dsid);
+	bool same_sizes = true;
+	for(size_t i=0; i<layout_t::nfields; i++) {
+		hid_t mtype = H5Tget_member_type(dstype, i);
+		same_sizes = same_sizes && H5Tget_size(mtype) == layout.sizes[i];
+		H5Tclose(mtype);
+	}
+	H5Tclose(dstype);
+	H5Dclose(dsid);
+	if(!same_sizes) {
+		throw std::runtime_error("HDFTable: the fields of table "+tname+" have different sizes");
+	}
+
+	totalrows = nrecords;
+}
+
+template<class Row>
+Row & HDFTable<Row>::row()
 {
-	try {
-		size_t offset = offset_map.at(name);
-		return *((T*)(data+offset));
-	} catch(const std::out_of_range &e) {
-		throw std::out_of_range("HDFTable::bind(): cannot bind '"+name+"' (field does not exist)");
+	return buffer[inbuffer];
+}
+
+template<class Row>
+void HDFTable<Row>::writeBuffer()
+{
+	herr_t ret = H5TBappend_records(
+		group, tname.c_str(), inbuffer,
+		sizeof(Row), layout.offsets, layout.sizes,
+		buffer.data()
+	);
+
+	inbuffer = 0;
+	if(ret < 0) {
+		throw std::runtime_error("HDFTable: unable to append to table "+tname);
 	}
 }
 
+template<class Row>
+void HDFTable<Row>::write()
+{
+	inbuffer++;
+	totalrows++;
+	if(inbuffer == buffer.size()) {
+		writeBuffer();
+	}
+}
+
+template<class Row>
+void HDFTable<Row>::append(const Row * rows, size_t n)
+{
+	flush();
+	if(H5TBappend_records(group, tname.c_str(), n, sizeof(Row), layout.offsets, layout.sizes, rows) < 0) {
+		throw std::runtime_error("HDFTable: unable to append to table "+tname);
+	}
+	totalrows += n;
+}
+
+// The row being filled (row()) is kept, so flush() can be called at any time.
+template<class Row>
+void HDFTable<Row>::flush()
+{
+	if(inbuffer > 0) {
+		Row current = buffer[inbuffer];
+		writeBuffer();
+		buffer[0] = current;
+	}
+}
+
+template<class Row>
+size_t HDFTable<Row>::nrows() const
+{
+	return totalrows;
+}
+
+template<class Row>
 template<class T>
-void HDFTable::setAttribute(hid_t type, const std::string & name, T value)
+void HDFTable<Row>::setAttribute(hid_t type, const std::string & name, T value)
 {
 	const hsize_t dims[] = {1};
 	hid_t table = H5Dopen(group, tname.c_str(), H5P_DEFAULT);
@@ -0,0 +1,270 @@
+#include "Histograms.hh"
+
+#include <yaml-cpp/yaml.h>
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+
+// ---------------------------------------------------------------------
+//                      struct HistogramAxis
+// ---------------------------------------------------------------------
+
+HistogramAxis::HistogramAxis(const YAML::Node &node)
+: variable(parse_variable(node["variable"].as<std::string>())),
+  bins(0), min(0.0), max(0.0), log(false)
+{
+	if(variable == PID) {
+		values = node["values"].as< std::vector<int> >();
+		bins = values.size();
+		if(bins == 0) {
+			throw std::invalid_argument("HistogramAxis: pid axis without values");
+		}
+		return;
+	}
+
+	bins = node["bins"].as<size_t>();
+	min = node["min"].as<double>();
+	max = node["max"].as<double>();
+	if(node["log"]) {
+		log = node["log"].as<bool>();
+	}
+
+	if(bins == 0 || !(min < max)) {
+		throw std::invalid_argument(std::string("HistogramAxis: bad binning of ")+variable_name(variable));
+	}
+	if(log && min <= 0.0) {
+		throw std::invalid_argument(std::string("HistogramAxis: log axis of ")+variable_name(variable)+" with min <= 0");
+	}
+}
+
+HistogramAxis::variable_t HistogramAxis::parse_variable(const std::string &name)
+{
+	const variable_t variables[] = {KE, ZENITH, COS_ZENITH, R, VERTEX_R, PID};
+	for(variable_t v : variables) {
+		if(name == variable_name(v)) return v;
+	}
+	throw std::invalid_argument("HistogramAxis: unknown variable `"+name+"`");
+}
+
+const char * HistogramAxis::variable_name(variable_t variable)
+{
+	switch(variable) {
+		case KE: return "KE";
+		case ZENITH: return "zenith";
+		case COS_ZENITH: return "cos_zenith";
+		case R: return "R";
+		case VERTEX_R: return "vertex_R";
+		case PID: return "pid";
+	}
+	return "";
+}
+
+// KE in GeV, radii in km and the zenith angle (in degrees) between the
+// momentum and the outward radial direction at the boundary
+double HistogramAxis::value(const particle_t &p) const
+{
+	const particle_t::kinematics_t &b = p.boundary;
+	switch(variable) {
+		case KE:
+			return b.KE;
+		case ZENITH:
+		case COS_ZENITH: {
+			double r = sqrt(b.x*b.x + b.y*b.y + b.z*b.z);
+			double pabs = sqrt(b.px*b.px + b.py*b.py + b.pz*b.pz);
+			double cosz = std::max(-1.0, std::min(1.0, (b.x*b.px + b.y*b.py + b.z*b.pz)/(r*pabs)));
+			return variable == ZENITH ? acos(cosz)*180.0/M_PI : cosz;
+		}
+		case R:
+			return sqrt(b.x*b.x + b.y*b.y + b.z*b.z);
+		case VERTEX_R:
+			return sqrt(p.vtx.x*p.vtx.x + p.vtx.y*p.vtx.y + p.vtx.z*p.vtx.z);
+		case PID:
+			return p.pid;
+	}
+	return NAN;
+}
+
+long HistogramAxis::bin(const particle_t &p) const
+{
+	if(variable == PID) {
+		std::vector<int>::const_iterator it = std::find(values.begin(), values.end(), p.pid);
+		return it == values.end() ? -1 : it - values.begin();
+	}
+
+	double x = value(p);
+	double u = log ? (log10(x) - log10(min))/(log10(max) - log10(min)) : (x - min)/(max - min);
+	if(!(u >= 0.0 && u < 1.0)) {
+		return -1; // also for NaNs and the log of non-positive values
+	}
+	return std::min(static_cast<long>(u*bins), static_cast<long>(bins)-1);
+}
+
+std::vector<double> HistogramAxis::edges() const
+{
+	std::vector<double> e(bins+1);
+	for(size_t i=0; i<=bins; i++) {
+		double u = double(i)/bins;
+		e[i] = log ? pow(10.0, log10(min) + u*(log10(max) - log10(min))) : min + u*(max - min);
+	}
+	return e;
+}
+
+// ---------------------------------------------------------------------
+//                      class Histogram
+// ---------------------------------------------------------------------
+
+Histogram::Histogram(const YAML::Node &node)
+: name(node["name"].as<std::string>()), entries(0), outside(0)
+{
+	if(node["species"]) {
+		species = node["species"].as< std::vector<int> >();
+	}
+
+	size_t size = 1;
+	for(YAML::const_iterator it=node["axes"].begin(); it!=node["axes"].end(); ++it) {
+		axes.push_back(HistogramAxis(*it));
+		size *= axes.back().bins;
+	}
+	if(axes.empty()) {
+		throw std::invalid_argument("Histogram: `"+name+"` has no axes");
+	}
+	counts.resize(size, 0.0);
+}
+
+void Histogram::fill(const particle_t &p)
+{
+	if(!species.empty() && std::find(species.begin(), species.end(), p.pid) == species.end()) {
+		return;
+	}
+
+	entries++;
+	size_t index = 0;
+	for(const HistogramAxis &axis : axes) {
+		long b = axis.bin(p);
+		if(b < 0) {
+			outside++;
+			return;
+		}
+		index = index*axis.bins + b;
+	}
+	counts[index] += 1.0;
+}
+
+void Histogram::merge(const Histogram &h)
+{
+	for(size_t i=0; i<counts.size(); i++) {
+		counts[i] += h.counts[i];
+	}
+	entries += h.entries;
+	outside += h.outside;
+}
+
+void Histogram::reset()
+{
+	std::fill(counts.begin(), counts.end(), 0.0);
+	entries = outside = 0;
+}
+
+template<class T>
+static void write_array_attribute(hid_t object, const std::string &name, hid_t type, const std::vector<T> &values)
+{
+	const hsize_t dims[] = {values.size()};
+	hid_t sid = H5Screate_simple(1, dims, NULL);
+	hid_t aid = H5Acreate(object, name.c_str(), type, sid, H5P_DEFAULT, H5P_DEFAULT);
+	H5Awrite(aid, type, values.data());
+	H5Aclose(aid);
+	H5Sclose(sid);
+}
+
+static void write_string_attribute(hid_t object, const std::string &name, const std::string &value)
+{
+	const hsize_t dims[] = {1};
+	hid_t type = create_hdf5_string(value.size());
+	hid_t sid = H5Screate_simple(1, dims, NULL);
+	hid_t aid = H5Acreate(object, name.c_str(), type, sid, H5P_DEFAULT, H5P_DEFAULT);
+	H5Awrite(aid, type, value.c_str());
+	H5Aclose(aid);
+	H5Sclose(sid);
+	H5Tclose(type);
+}
+
+// The axes are described by the attributes axisN.variable and either
+// axisN.edges (bins+1 values) or axisN.values (the PDG IDs of a pid axis).
+void Histogram::write(hid_t group) const
+{
+	std::vector<hsize_t> dims;
+	for(const HistogramAxis &axis : axes) {
+		dims.push_back(axis.bins);
+	}
+
+	hid_t sid = H5Screate_simple(dims.size(), dims.data(), NULL);
+	hid_t did = H5Dcreate(group, name.c_str(), H5T_NATIVE_DOUBLE, sid, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+	H5Dwrite(did, H5T_NATIVE_DOUBLE, H5S_ALL, H5S_ALL, H5P_DEFAULT, counts.data());
+	H5Sclose(sid);
+
+	write_hdf5_attribute(did, "entries", entries);
+	write_hdf5_attribute(did, "outside", outside);
+	if(!species.empty()) {
+		write_array_attribute(did, "species", H5T_NATIVE_INT, species);
+	}
+	for(size_t i=0; i<axes.size(); i++) {
+		const std::string prefix = "axis"+std::to_string(i);
+		write_string_attribute(did, prefix+".variable", HistogramAxis::variable_name(axes[i].variable));
+		if(axes[i].variable == HistogramAxis::PID) {
+			write_array_attribute(did, prefix+".values", H5T_NATIVE_INT, axes[i].values);
+		} else {
+			write_array_attribute(did, prefix+".edges", H5T_NATIVE_DOUBLE, axes[i].edges());
+		}
+	}
+	H5Dclose(did);
+}
+
+// ---------------------------------------------------------------------
+//                      class HistogramSet
+// ---------------------------------------------------------------------
+
+HistogramSet::HistogramSet(const std::string &configfile)
+{
+	// a missing or malformed file, or a value of the wrong type
+	try {
+		YAML::Node config = YAML::LoadFile(configfile);
+		for(YAML::const_iterator it=config["histograms"].begin(); it!=config["histograms"].end(); ++it) {
+			histograms.push_back(Histogram(*it));
+		}
+	} catch(const YAML::Exception &e) {
+		throw std::invalid_argument("HistogramSet: "+configfile+": "+e.what());
+	}
+	if(histograms.empty()) {
+		throw std::invalid_argument("HistogramSet: no histograms defined in "+configfile);
+	}
+}
+
+void HistogramSet::fill(const particle_t &p)
+{
+	for(Histogram &h : histograms) {
+		h.fill(p);
+	}
+}
+
+void HistogramSet::merge(const HistogramSet &set)
+{
+	for(size_t i=0; i<histograms.size(); i++) {
+		histograms[i].merge(set.histograms[i]);
+	}
+}
+
+void HistogramSet::reset()
+{
+	for(Histogram &h : histograms) {
+		h.reset();
+	}
+}
+
+void HistogramSet::write(hid_t file) const
+{
+	hid_t group = H5Gcreate(file, "histograms", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+	for(const Histogram &h : histograms) {
+		h.write(group);
+	}
+	H5Gclose(group);
+}
@@ -0,0 +1,90 @@
+#ifndef Histograms_h
+#define Histograms_h
+
+#include "OutputTables.hh"
+
+#include <string>
+#include <vector>
+
+namespace YAML {class Node;}
+
+// ---------------------------------------------------------------------
+//                      struct HistogramAxis
+// ---------------------------------------------------------------------
+// One axis of a histogram: a quantity of the particle at the boundary,
+// binned in linear or logarithmic bins between min and max. The pid axis
+// has one bin for each of the listed PDG IDs instead.
+struct HistogramAxis
+{
+	enum variable_t {KE, ZENITH, COS_ZENITH, R, VERTEX_R, PID};
+
+	variable_t variable;
+	size_t bins;
+	double min, max;
+	bool log;
+	std::vector<int> values;
+
+	HistogramAxis(const YAML::Node &node);
+
+	double value(const particle_t &p) const;
+	// the bin of p on this axis, or -1 if it falls outside the axis
+	long bin(const particle_t &p) const;
+	std::vector<double> edges() const;
+
+	static variable_t parse_variable(const std::string &name);
+	static const char * variable_name(variable_t variable);
+};
+
+// ---------------------------------------------------------------------
+//                      class Histogram
+// ---------------------------------------------------------------------
+// An N-dimensional histogram of the particles on the boundary, optionally
+// restricted to some species. The counts are stored row-major, the last
+// axis varying the fastest, and written as an N-dimensional dataset.
+class Histogram
+{
+	public:
+		std::string name;
+		std::vector<HistogramAxis> axes;
+		std::vector<int> species;
+		std::vector<double> counts;
+		unsigned long entries, outside;
+
+		Histogram(const YAML::Node &node);
+		void fill(const particle_t &p);
+		void merge(const Histogram &h);
+		void reset();
+		void write(hid_t group) const;
+};
+
+// ---------------------------------------------------------------------
+//                      class HistogramSet
+// ---------------------------------------------------------------------
+// The histograms defined in a YAML file, e.g.:
+//
+//   histograms:
+//   - name: gamma_energy_zenith
+//     species: [22]
+//     axes:
+//     - {variable: KE, bins: 90, min: 1e-6, max: 1e3, log: true}
+//     - {variable: zenith, bins: 18, min: 0, max: 180}
+//
+// Each thread filling histograms should have its own set; the sets are
+// combined with merge() before writing.
+class HistogramSet
+{
+	std::vector<Histogram> histograms;
+
+	public:
+		// throws std::invalid_argument if the file can not be read or the
+		// histograms are invalid
+		HistogramSet(const std::string &configfile);
+		void fill(const particle_t &p);
+		void merge(const HistogramSet &set);
+		void reset();
+		// writes the histograms to the group `histograms` in the file
+		void write(hid_t file) const;
+		size_t size() const {return histograms.size();}
+};
+
+#endif
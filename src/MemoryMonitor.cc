@@ -0,0 +1,124 @@
+#include "MemoryMonitor.hh"
+
+#include <cstdio>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include <unistd.h>
+#include <sys/resource.h>
+
+const char * const MemoryMonitor::tablename = "memory";
+const char * const MemoryMonitor::maxima_tablename = "memory_max";
+
+MemoryMonitor::MemoryMonitor(size_t sample_tracks_, size_t soft_limit_)
+: sample_tracks(sample_tracks_), soft_limit(soft_limit_), table(nullptr), file(-1),
+  tracks(0), limit_exceeded(false),
+  file_rss_max(0), file_stack_max(0), file_secondaries_max(0), rss_max(0)
+{
+	memset(&row, 0, sizeof(row));
+}
+
+MemoryMonitor::~MemoryMonitor()
+{
+	close();
+}
+
+// The second field of /proc/self/statm is the resident set size in pages;
+// 0 if it can not be read.
+size_t MemoryMonitor::rss()
+{
+	static const size_t pagesize = sysconf(_SC_PAGESIZE);
+	FILE * statm = fopen("/proc/self/statm", "r");
+	if(statm == nullptr) return 0;
+	unsigned long size = 0, resident = 0;
+	if(fscanf(statm, "%lu %lu", &size, &resident) != 2) {
+		resident = 0;
+	}
+	fclose(statm);
+	return resident*pagesize;
+}
+
+size_t MemoryMonitor::peakRss()
+{
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	return size_t(usage.ru_maxrss)*1024;
+}
+
+// The table of the maxima is created here, empty, since after the switch to
+// SWMR mode no datasets can be created, but rows can be appended.
+void MemoryMonitor::open(hid_t file_)
+{
+	close();
+	file = file_;
+	table = new HDFTable<event_memory_t>(file, tablename, 100);
+	HDFTable<memory_max_t> maxima(file, maxima_tablename);
+	file_rss_max = file_stack_max = file_secondaries_max = 0;
+}
+
+// Called when the file is closed, so the errors are only reported.
+void MemoryMonitor::close()
+{
+	if(table == nullptr) return;
+	try {
+		flush();
+		HDFTable<memory_max_t> maxima(file, maxima_tablename, hdf_table_open);
+		memory_max_t &row_max = maxima.row();
+		row_max.rss_max = file_rss_max;
+		row_max.peak_rss = peakRss();
+		row_max.stack_max = file_stack_max;
+		row_max.secondaries_max = file_secondaries_max;
+		maxima.write();
+		maxima.flush();
+	} catch(const std::exception &e) {
+		std::cerr << "WARNING: MemoryMonitor: unable to write the memory use: " << e.what() << std::endl;
+	}
+	delete table;
+	table = nullptr;
+	file = -1;
+}
+
+void MemoryMonitor::flush()
+{
+	if(table != nullptr) {
+		table->flush();
+	}
+}
+
+void MemoryMonitor::beginEvent()
+{
+	memset(&row, 0, sizeof(row));
+	tracks = 0;
+}
+
+bool MemoryMonitor::endEvent(hsize_t eventid)
+{
+	const bool exceeded = sample();
+	row.eventid = eventid;
+	row.peak_rss = peakRss();
+
+	if(row.rss_max > file_rss_max) file_rss_max = row.rss_max;
+	if(row.stack_max > file_stack_max) file_stack_max = row.stack_max;
+	if(row.secondaries_max > file_secondaries_max) file_secondaries_max = row.secondaries_max;
+
+	if(table != nullptr) {
+		table->row() = row;
+		table->write();
+	}
+	return exceeded;
+}
+
+bool MemoryMonitor::sample()
+{
+	tracks = 0;
+	const size_t current = rss();
+	row.rss = current;
+	if(current > row.rss_max) row.rss_max = current;
+	if(current > rss_max) rss_max = current;
+
+	if(soft_limit > 0 && current > soft_limit && !limit_exceeded) {
+		limit_exceeded = true;
+		return true;
+	}
+	return false;
+}
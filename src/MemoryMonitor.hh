@@ -0,0 +1,89 @@
+#ifndef MemoryMonitor_h
+#define MemoryMonitor_h
+
+#include "OutputTables.hh"
+
+#include <cstddef>
+
+// ---------------------------------------------------------------------
+//                      class MemoryMonitor
+// ---------------------------------------------------------------------
+// Samples the memory use of fgamma at the boundaries of the events and,
+// optionally, every sample_tracks tracks, so that a spike can be traced
+// back to its event. Every event gets an event_memory_t row in the table
+// `memory` of the HDF5 output, if open() is called, and the maxima of the
+// events of a file are written as the row of the table `memory_max` when
+// it is closed (attributes could not be written in SWMR mode).
+//
+// A soft limit on the resident set size can be set, which is reported
+// once by sample(), for the caller to warn or to stop the run.
+class MemoryMonitor
+{
+	public:
+		static const char * const tablename;
+		static const char * const maxima_tablename;
+
+		// a limit of 0 disables it
+		MemoryMonitor(size_t sample_tracks, size_t soft_limit);
+		~MemoryMonitor();
+
+		// the resident set size of the process and its peak, in bytes
+		static size_t rss();
+		static size_t peakRss();
+
+		// creates the tables in a file (before it is switched to SWMR mode)
+		// and writes the following events to it until close(), which writes
+		// the maxima and reports if it can not
+		void open(hid_t file);
+		void close();
+		void flush();
+
+		void beginEvent();
+		// samples the end of the event; returns true if the soft limit is
+		// exceeded for the first time
+		bool endEvent(hsize_t eventid);
+		// a track starting with `stack` tracks waiting in the stack; returns
+		// true if the soft limit is exceeded for the first time
+		bool track(size_t stack);
+		// a track that has made `n` secondaries
+		void secondaries(size_t n) {if(n > row.secondaries_max) row.secondaries_max = n;}
+
+		// takes a sample of the resident set size; returns true if the soft
+		// limit is exceeded for the first time
+		bool sample();
+
+		size_t softLimit() const {return soft_limit;}
+		// the largest resident set size sampled so far
+		size_t rssMax() const {return rss_max;}
+
+	private:
+		const size_t sample_tracks, soft_limit;
+		HDFTable<event_memory_t> * table;
+		hid_t file;
+
+		// the current event (rss being the last sample), the tracks since
+		// the last sample
+		event_memory_t row;
+		size_t tracks;
+		bool limit_exceeded;
+
+		// the maxima of the events written to the current file, and of all
+		size_t file_rss_max, file_stack_max, file_secondaries_max;
+		size_t rss_max;
+
+		MemoryMonitor(const MemoryMonitor&);
+		MemoryMonitor& operator=(MemoryMonitor);
+};
+
+inline bool MemoryMonitor::track(size_t stack)
+{
+	if(stack > row.stack_max) {
+		row.stack_max = stack;
+	}
+	if(sample_tracks > 0 && ++tracks >= sample_tracks) {
+		return sample();
+	}
+	return false;
+}
+
+#endif
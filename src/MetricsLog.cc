@@ -0,0 +1,210 @@
+#include "MetricsLog.hh"
+#include "MemoryMonitor.hh"
+#include "Timer.hh"
+
+#include <cmath>
+#include <cerrno>
+#include <cstdlib>
+#include <cstdio>
+#include <stdexcept>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+
+// ---------------------------------------------------------------------
+//                   class MetricsLog::record_t
+// ---------------------------------------------------------------------
+MetricsLog::record_t::record_t(const char * type)
+{
+	json.precision(10);
+	json << "{\"type\":\"" << type << "\"";
+}
+
+MetricsLog::record_t & MetricsLog::record_t::field(const char * name, double value)
+{
+	json << ",\"" << name << "\":";
+	if(std::isfinite(value)) {
+		json << value;
+	} else {
+		json << "null";
+	}
+	return *this;
+}
+
+MetricsLog::record_t & MetricsLog::record_t::field(const char * name, const std::string &value)
+{
+	json << ",\"" << name << "\":" << quote(value);
+	return *this;
+}
+
+// ---------------------------------------------------------------------
+//                         class MetricsLog
+// ---------------------------------------------------------------------
+// Regular files ignore O_NONBLOCK, with FIFOs it makes write() return EAGAIN
+// instead of waiting for the reader.
+MetricsLog::MetricsLog(const std::string &path, size_t total_events_)
+: fd(open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_NONBLOCK, 0644)),
+  header("header"), header_written(false), closed(false), partial(false), broken(false), total_events(total_events_),
+  start_ns(Time::wall_ns()), event_start_ns(start_ns), last_flush_ns(start_ns),
+  event_start(), events(0), dropped(0), rows(0), average(0.0)
+{
+	if(fd < 0) {
+		throw std::invalid_argument("MetricsLog: unable to open "+path);
+	}
+	header.field("version", 1).field("events", total_events);
+}
+
+MetricsLog::~MetricsLog()
+{
+	close();
+	::close(fd);
+}
+
+void MetricsLog::attribute(const std::string &name, const std::string &value)
+{
+	if(header_written) return;
+	char * end = nullptr;
+	const double number = strtod(value.c_str(), &end);
+	if(!value.empty() && *end == '\0') {
+		header.field(name.c_str(), number);
+	} else {
+		header.field(name.c_str(), value);
+	}
+}
+
+void MetricsLog::beginEvent(const run_totals_t &totals)
+{
+	event_start_ns = Time::wall_ns();
+	event_start = totals;
+}
+
+void MetricsLog::endEvent(hsize_t eventid, const run_totals_t &totals, hsize_t particles, hsize_t discarded)
+{
+	const uint64_t now = Time::wall_ns();
+	const double wall = (now - event_start_ns)*1e-9;
+	average = (events == 0) ? wall : 0.9*average + 0.1*wall;
+	events++;
+	rows += particles;
+
+	record_t record("event");
+	record.field("event", eventid)
+	      .field("wall", wall)
+	      .field("time", (now - start_ns)*1e-9)
+	      .field("tracks", totals.tracks - event_start.tracks)
+	      .field("steps", totals.steps - event_start.steps)
+	      .field("cut", totals.cut - event_start.cut)
+	      .field("particles", particles)
+	      .field("discarded", discarded)
+	      .field("rows", rows)
+	      .field("rate", average > 0 ? 1.0/average : nan(""))
+	      .field("eta", total_events > events ? (total_events - events)*average : 0.0)
+	      .field("rss", MemoryMonitor::rss());
+	write(record);
+}
+
+void MetricsLog::write(const record_t &record)
+{
+	if(broken) {
+		dropped++;
+		return;
+	}
+	if(!header_written) {
+		buffer += header.str();
+		header_written = true;
+	}
+	buffer += record.str();
+
+	const uint64_t now = Time::wall_ns();
+	if(now - last_flush_ns >= 1000000000u) {
+		flush(false);
+		last_flush_ns = now;
+	}
+}
+
+void MetricsLog::close()
+{
+	if(closed) return;
+	record_t record("end");
+	record.field("events", events)
+	      .field("time", (Time::wall_ns() - start_ns)*1e-9)
+	      .field("peak_rss", MemoryMonitor::peakRss())
+	      .field("dropped", dropped);
+	write(record);
+	flush(true);
+	closed = true;
+}
+
+// Writes what the file takes without blocking (or all, if block is set).
+// If too much is left over, the oldest complete records are dropped.
+//
+// A FIFO whose reader went away makes write() fail with EPIPE and raise
+// SIGPIPE, which would kill the run: the signal is blocked around the
+// write and, if it was raised, taken before it is unblocked. The log is
+// broken from then on and its records are dropped.
+void MetricsLog::flush(bool block)
+{
+	if(block) {
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) & ~O_NONBLOCK);
+	}
+	sigset_t sigpipe, mask;
+	sigemptyset(&sigpipe);
+	sigaddset(&sigpipe, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &sigpipe, &mask);
+	size_t written = 0;
+	while(written < buffer.size()) {
+		const ssize_t n = ::write(fd, buffer.data() + written, buffer.size() - written);
+		if(n < 0 && errno == EINTR) continue;
+		if(n < 0 && errno == EPIPE) broken = true;
+		if(n <= 0) break;
+		written += n;
+	}
+	if(broken && !sigismember(&mask, SIGPIPE)) {
+		const timespec zero = {0, 0};
+		while(sigtimedwait(&sigpipe, nullptr, &zero) < 0 && errno == EINTR);
+	}
+	pthread_sigmask(SIG_SETMASK, &mask, nullptr);
+
+	if(written > 0) {
+		partial = (buffer[written-1] != '\n');
+		buffer.erase(0, written);
+	}
+	if(broken) {
+		dropped += std::count(buffer.begin(), buffer.end(), '\n');
+		buffer.clear();
+		return;
+	}
+
+	if(buffer.size() <= max_buffer) return;
+	// the rest of a partly written record has to follow it
+	const size_t first = partial ? buffer.find('\n') + 1 : 0;
+	size_t last = first;
+	while(last < buffer.size() && buffer.size() - (last - first) > max_buffer) {
+		last = buffer.find('\n', last) + 1;
+		dropped++;
+	}
+	buffer.erase(first, last - first);
+}
+
+std::string MetricsLog::quote(const std::string &str)
+{
+	std::string quoted = "\"";
+	for(const char c : str) {
+		switch(c) {
+			case '"': quoted += "\\\""; break;
+			case '\\': quoted += "\\\\"; break;
+			case '\n': quoted += "\\n"; break;
+			case '\t': quoted += "\\t"; break;
+			default:
+				if((unsigned char)c < 0x20) {
+					char esc[8];
+					snprintf(esc, sizeof(esc), "\\u%04x", c);
+					quoted += esc;
+				} else {
+					quoted += c;
+				}
+		}
+	}
+	return quoted + "\"";
+}
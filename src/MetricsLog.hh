@@ -0,0 +1,98 @@
+#ifndef MetricsLog_h
+#define MetricsLog_h
+
+#include "OutputTables.hh"
+
+#include <string>
+#include <sstream>
+#include <cstdint>
+
+// ---------------------------------------------------------------------
+//                      class MetricsLog
+// ---------------------------------------------------------------------
+// Writes the progress of a run as JSON lines, one record per line, for
+// monitoring tools that should not have to parse the log:
+//
+//   {"type":"header","version":1,"events":N,<attributes>}
+//   {"type":"event","event":ID,"wall":S,"time":S,"tracks":N,"steps":N,
+//    "cut":N,"particles":N,"discarded":N,"rows":N,"rate":EV/S,"eta":S,
+//    "rss":BYTES}
+//   {"type":"end","events":N,"time":S,"peak_rss":BYTES,"dropped":N}
+//
+// The header carries the attributes of the output (seed, model_crc,
+// cutoff, ...) and is written before the first event. `wall` is the wall
+// time of the event and `time` the time since the start, in seconds;
+// `rate` is a moving average of the events per second and `eta` the time
+// the remaining events will take at that rate.
+//
+// The records are buffered and written about once per second, without
+// blocking: if the file is a FIFO whose reader does not keep up, they are
+// kept until it does, and dropped (counted in the end record) if more than
+// max_buffer bytes pile up. Once the reader of a FIFO has gone away, all
+// the records are dropped.
+class MetricsLog
+{
+	public:
+		static const size_t max_buffer = 1024*1024;
+
+		// a record, to which fields are added with field()
+		class record_t
+		{
+			std::ostringstream json;
+
+			public:
+				explicit record_t(const char * type);
+				template<class T> record_t & field(const char * name, T value);
+				// non-finite numbers are written as null
+				record_t & field(const char * name, double value);
+				record_t & field(const char * name, const std::string &value);
+				record_t & field(const char * name, const char * value) {return field(name, std::string(value));}
+				std::string str() const {return json.str() + "}\n";}
+		};
+
+		// throws std::invalid_argument if path can not be opened (a FIFO
+		// needs to have a reader)
+		MetricsLog(const std::string &path, size_t total_events);
+		~MetricsLog();
+
+		// adds an attribute to the header, as a number if it is one
+		void attribute(const std::string &name, const std::string &value);
+
+		void beginEvent(const run_totals_t &totals);
+		void endEvent(hsize_t eventid, const run_totals_t &totals, hsize_t particles, hsize_t discarded);
+		void write(const record_t &record);
+		// writes the end record and everything buffered
+		void close();
+
+	private:
+		int fd;
+		std::string buffer;
+		record_t header;
+		bool header_written, closed;
+		// whether the buffer starts with the rest of a partly written record
+		bool partial;
+		// whether the reader of the file has gone away
+		bool broken;
+		const size_t total_events;
+
+		uint64_t start_ns, event_start_ns, last_flush_ns;
+		run_totals_t event_start;
+		size_t events, dropped;
+		hsize_t rows;
+		// exponential moving average of the event times, in seconds
+		double average;
+
+		MetricsLog(const MetricsLog&);
+		MetricsLog& operator=(MetricsLog);
+		void flush(bool block);
+		static std::string quote(const std::string &str);
+};
+
+template<class T>
+MetricsLog::record_t & MetricsLog::record_t::field(const char * name, T value)
+{
+	json << ",\"" << name << "\":" << value;
+	return *this;
+}
+
+#endif
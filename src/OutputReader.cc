@@ -0,0 +1,127 @@
+#include "OutputReader.hh"
+
+#include <cmath>
+
+using namespace std;
+
+void read_run_attributes(hid_t fh, run_t &run)
+{
+	string_to_cstr(hdf_read_attribute_string(fh, "model_file"), run.model_file, sizeof(run_t::model_file));
+	run.model_crc = hdf_read_attribute<unsigned int>(fh, "model_crc", H5T_NATIVE_UINT);
+	run.seed = hdf_read_attribute<int>(fh, "seed", H5T_NATIVE_INT);
+	run.cutoff = hdf_read_attribute<double>(fh, "cutoff", H5T_NATIVE_DOUBLE);
+	run.gunradius = hdf_read_attribute<double>(fh, "gunradius", H5T_NATIVE_DOUBLE);
+}
+
+// ---------------------------------------------------------------------
+// OutputReader
+// ---------------------------------------------------------------------
+hid_t OutputReader::open(const string &path)
+{
+	hid_t fh = hdf_open_read(path);
+	if(fh < 0) {
+		throw runtime_error("unable to open the file");
+	}
+	return fh;
+}
+
+OutputReader::OutputReader(const string &path_, hsize_t block_rows_)
+: path(path_), fh(open(path_)),
+  events_info(fh.id, "events"), particles_info(fh.id, "particles"),
+  block_rows(block_rows_)
+{
+	merged_ids = H5Lexists(fh.id, "particles_eventid", H5P_DEFAULT) > 0;
+	sorted_ = H5Lexists(fh.id, "particles_row", H5P_DEFAULT) > 0;
+}
+
+TableRange<event_t> OutputReader::events(hsize_t start) const
+{
+	return events(start, nevents() - min(start, nevents()));
+}
+
+TableRange<event_t> OutputReader::events(hsize_t start, hsize_t n) const
+{
+	TableRange<event_t>::fixup_t fixup;
+	if(merged_ids) {
+		const hid_t file = fh.id;
+		fixup = [file](event_t * rows, hsize_t first, hsize_t count) {
+			vector<hsize_t> ids(count), firsts(count);
+			hdf_read_column(file, "events_eventid", first, count, ids.data());
+			hdf_read_column(file, "events_first", first, count, firsts.data());
+			for(hsize_t i=0; i<count; i++) {
+				rows[i].id = ids[i];
+				rows[i].first = firsts[i];
+			}
+		};
+	}
+	return TableRange<event_t>(fh.id, "events", start, n, block_rows, fixup);
+}
+
+TableRange<particle_t> OutputReader::particles(hsize_t start) const
+{
+	return particles(start, nparticles() - min(start, nparticles()));
+}
+
+TableRange<particle_t> OutputReader::particles(hsize_t start, hsize_t n) const
+{
+	TableRange<particle_t>::fixup_t fixup;
+	if(merged_ids) {
+		const hid_t file = fh.id;
+		fixup = [file](particle_t * rows, hsize_t first, hsize_t count) {
+			vector<hsize_t> ids(count);
+			hdf_read_column(file, "particles_eventid", first, count, ids.data());
+			for(hsize_t i=0; i<count; i++) {
+				rows[i].eventid = ids[i];
+			}
+		};
+	}
+	return TableRange<particle_t>(fh.id, "particles", start, n, block_rows, fixup);
+}
+
+// In sorted files, the rows of the particles of an event are the range of
+// the event in particles_by_event.
+TableRange<particle_t> OutputReader::particles(const event_t &event) const
+{
+	if(!sorted_) {
+		return particles(event.first, event.size);
+	}
+	if(H5Lexists(fh.id, "particles_by_event", H5P_DEFAULT) <= 0) {
+		throw runtime_error(path+": the particles are sorted, and the file has no particles_by_event");
+	}
+	vector<hsize_t> rows(event.size);
+	if(event.size > 0 && hdf_read_column(fh.id, "particles_by_event", event.first, event.size, rows.data()) < 0) {
+		throw runtime_error(path+": unable to read particles_by_event");
+	}
+	return TableRange<particle_t>(fh.id, "particles", rows, block_rows);
+}
+
+vector<run_t> OutputReader::runs() const
+{
+	vector<run_t> runs;
+	if(H5Lexists(fh.id, "runs", H5P_DEFAULT) > 0) {
+		hsize_t nfields, nruns;
+		H5TBget_table_info(fh.id, "runs", &nfields, &nruns);
+		runs.resize(nruns);
+		hdf_read_rows(fh.id, "runs", 0, nruns, runs.data());
+		return runs;
+	}
+
+	run_t run;
+	run.event_first = 0;
+	run.event_size = nevents();
+	run.particle_first = 0;
+	run.particle_size = nparticles();
+	string_to_cstr(path, run.file_path, sizeof(run_t::file_path));
+	try {
+		read_run_attributes(fh.id, run);
+	} catch(out_of_range &e) {
+		cerr << "Warning: " << path << ": " << e.what() << endl;
+		string_to_cstr("", run.model_file, sizeof(run_t::model_file));
+		run.model_crc = 0;
+		run.seed = 0;
+		run.cutoff = nan("");
+		run.gunradius = nan("");
+	}
+	runs.push_back(run);
+	return runs;
+}
@@ -0,0 +1,211 @@
+#ifndef OutputReader_h
+#define OutputReader_h
+
+#include "OutputTables.hh"
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <iterator>
+#include <functional>
+#include <algorithm>
+
+// Fills the attribute columns of a row of the runs table (the model, seed,
+// cutoff and gun radius) from the attributes of an fgamma output file.
+// Throws std::out_of_range if an attribute is missing.
+void read_run_attributes(hid_t fh, run_t &run);
+
+// ---------------------------------------------------------------------
+//                      class TableRange
+// ---------------------------------------------------------------------
+// A range of rows of a table, read block by block directly into Row structs
+// while it is iterated. The iterators refer to the rows in the block that
+// is being read, which stay valid until the iterator moves to the next
+// block. Copies of an iterator share the block, i.e. a range is read once.
+// The iterators can outlive the range, but not the file.
+//
+// The fixup function, if set, is called on every block after it has been
+// read, with the rows and the row number of the first one in the table.
+//
+// A range can also be a list of rows of the table, e.g. the particles of
+// an event in a sorted merge, whose blocks are read as point selections
+// (and without a fixup).
+template<class Row>
+class TableRange
+{
+	public:
+		typedef std::function<void(Row * rows, hsize_t start, hsize_t n)> fixup_t;
+
+	private:
+		struct source_t
+		{
+			hid_t group;
+			std::string table;
+			hsize_t start, n, block_rows;
+			fixup_t fixup;
+			// the rows of a list, empty for start..start+n
+			std::vector<hsize_t> rows;
+		};
+		std::shared_ptr<const source_t> source;
+
+	public:
+		class iterator : public std::iterator<std::input_iterator_tag, Row>
+		{
+			std::shared_ptr<const source_t> source;
+			std::shared_ptr< std::vector<Row> > block;
+			// the row (relative to the range) and the first row of the block
+			hsize_t row, block_first;
+
+			friend class TableRange;
+			iterator(const std::shared_ptr<const source_t> &source, hsize_t row);
+			void read();
+
+			public:
+				const Row & operator*() const {return (*block)[row-block_first];}
+				const Row * operator->() const {return &**this;}
+				iterator & operator++();
+				bool operator==(const iterator &other) const {return row == other.row;}
+				bool operator!=(const iterator &other) const {return row != other.row;}
+		};
+
+		TableRange(hid_t group, const std::string &table, hsize_t start, hsize_t n, hsize_t block_rows, fixup_t fixup = fixup_t());
+		TableRange(hid_t group, const std::string &table, const std::vector<hsize_t> &rows, hsize_t block_rows);
+
+		iterator begin() const {return iterator(source, 0);}
+		iterator end() const {return iterator(source, source->n);}
+		hsize_t size() const {return source->n;}
+};
+
+template<class Row>
+TableRange<Row>::TableRange(hid_t group, const std::string &table, hsize_t start, hsize_t n, hsize_t block_rows, fixup_t fixup)
+{
+	source_t * s = new source_t;
+	source.reset(s);
+	s->group = group;
+	s->table = table;
+	s->start = start;
+	s->n = n;
+	s->block_rows = std::max<hsize_t>(1, std::min(block_rows, n));
+	s->fixup = fixup;
+}
+
+template<class Row>
+TableRange<Row>::TableRange(hid_t group, const std::string &table, const std::vector<hsize_t> &rows, hsize_t block_rows)
+{
+	source_t * s = new source_t;
+	source.reset(s);
+	s->group = group;
+	s->table = table;
+	s->start = 0;
+	s->n = rows.size();
+	s->block_rows = std::max<hsize_t>(1, std::min<hsize_t>(block_rows, rows.size()));
+	s->rows = rows;
+}
+
+template<class Row>
+TableRange<Row>::iterator::iterator(const std::shared_ptr<const source_t> &source_, hsize_t row_)
+: source(source_), row(row_), block_first(row_)
+{
+	if(row < source->n) {
+		block = std::make_shared< std::vector<Row> >(source->block_rows);
+		read();
+	}
+}
+
+template<class Row>
+void TableRange<Row>::iterator::read()
+{
+	const hsize_t nrows = std::min(source->block_rows, source->n - row);
+	block->resize(nrows);
+	block_first = row;
+	if(!source->rows.empty()) {
+		if(hdf_read_rows_at(source->group, source->table, source->rows.data()+row, nrows, block->data()) < 0) {
+			throw std::runtime_error("TableRange: unable to read table "+source->table);
+		}
+		return;
+	}
+	if(hdf_read_rows(source->group, source->table, source->start+row, nrows, block->data()) < 0) {
+		throw std::runtime_error("TableRange: unable to read table "+source->table);
+	}
+	if(source->fixup) {
+		source->fixup(block->data(), source->start+row, nrows);
+	}
+}
+
+template<class Row>
+typename TableRange<Row>::iterator & TableRange<Row>::iterator::operator++()
+{
+	row++;
+	if(row == block_first + block->size() && row < source->n) {
+		read();
+	}
+	return *this;
+}
+
+// ---------------------------------------------------------------------
+//                      class OutputReader
+// ---------------------------------------------------------------------
+// Reads the events and particles of an fgamma output file or of a file
+// merged by mergeruns, e.g.
+//
+//   OutputReader reader("outfile.h5");
+//   for(const event_t &event : reader.events()) {
+//       for(const particle_t &p : reader.particles(event)) {...}
+//   }
+//
+// The rows are read in blocks of block_rows rows. The IDs of the rows are
+// those of the file; in virtual merges, in which the tables hold the IDs of
+// each run, they are replaced by the merged ones.
+class OutputReader
+{
+	public:
+		static const hsize_t default_block_rows = 64*1024;
+
+		// throws std::runtime_error if the file can not be opened and
+		// std::out_of_range if it has no events or particles
+		OutputReader(const std::string &path, hsize_t block_rows = default_block_rows);
+
+		hid_t file() const {return fh.id;}
+		const HDFTableInfo & eventsInfo() const {return events_info;}
+		const HDFTableInfo & particlesInfo() const {return particles_info;}
+		hsize_t nevents() const {return events_info.nrecords;}
+		hsize_t nparticles() const {return particles_info.nrecords;}
+		// the particles of a merge with --sort are not stored by event, but
+		// found through particles_by_event
+		bool sorted() const {return sorted_;}
+
+		TableRange<event_t> events(hsize_t start = 0) const;
+		TableRange<event_t> events(hsize_t start, hsize_t n) const;
+		TableRange<particle_t> particles(hsize_t start = 0) const;
+		TableRange<particle_t> particles(hsize_t start, hsize_t n) const;
+		// the particles of an event, in the order of the run also in sorted
+		// files; throws std::runtime_error for sorted files without
+		// particles_by_event (written by older versions of mergeruns)
+		TableRange<particle_t> particles(const event_t &event) const;
+
+		// the runs table of a merged file, or a run made from the attributes
+		// of an fgamma file (with a warning and model_file empty if they
+		// are missing)
+		std::vector<run_t> runs() const;
+
+	private:
+		// closes the file also if the constructor throws
+		struct file_t
+		{
+			const hid_t id;
+			explicit file_t(hid_t id_) : id(id_) {}
+			~file_t() {H5Fclose(id);}
+		};
+
+		const std::string path;
+		const file_t fh;
+		const HDFTableInfo events_info, particles_info;
+		const hsize_t block_rows;
+		bool merged_ids, sorted_;
+
+		OutputReader(const OutputReader&);
+		OutputReader& operator=(OutputReader);
+		static hid_t open(const std::string &path);
+};
+
+#endif
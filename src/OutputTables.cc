@@ -0,0 +1,16 @@
+#include "OutputTables.hh"
+
+constexpr HDFTableField HDFTableSchema<event_t>::fields[];
+constexpr HDFTableField HDFTableSchema<particle_t>::fields[];
+constexpr HDFTableField HDFTableSchema<run_t>::fields[];
+constexpr HDFTableField HDFTableSchema<run_totals_t>::fields[];
+constexpr HDFTableField HDFTableSchema<species_summary_t>::fields[];
+constexpr HDFTableField HDFTableSchema<secondary_summary_t>::fields[];
+constexpr HDFTableField HDFTableSchema<event_profile_t>::fields[];
+constexpr HDFTableField HDFTableSchema<profile_entry_t>::fields[];
+constexpr HDFTableField HDFTableSchema<event_memory_t>::fields[];
+constexpr HDFTableField HDFTableSchema<memory_max_t>::fields[];
+constexpr HDFTableField HDFTableSchema<tracklog_track_t>::fields[];
+constexpr HDFTableField HDFTableSchema<tracklog_step_t>::fields[];
+constexpr HDFTableField HDFTableSchema<tracklog_secondary_t>::fields[];
+constexpr HDFTableField HDFTableSchema<particle_chunk_t>::fields[];
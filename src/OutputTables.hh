@@ -0,0 +1,380 @@
+#ifndef OutputTables_h
+#define OutputTables_h
+
+#include "HDFTable.hh"
+
+// ---------------------------------------------------------------------
+//                 Rows of the fgamma output tables
+// ---------------------------------------------------------------------
+// Shared between fgamma, which writes the tables, and the tools that
+// read and merge them.
+
+// The IDs and row numbers are 64-bit, so that merged files can have more
+// than 2^32 rows. Older files have 32-bit ones, which are widened by the
+// HDF5 type conversion when read into these structs.
+struct event_t
+{
+	hsize_t id;
+	hsize_t first;
+	hsize_t size;
+	int pid;
+	double E, KE;
+	double incidence;
+	unsigned int discarded;
+};
+
+struct particle_t
+{
+	hsize_t eventid;
+	int pid;
+	char name[16];
+	double m;
+	struct kinematics_t {
+		double KE;
+		double x, y, z;
+		double px, py, pz;
+	} vtx, boundary;
+};
+
+struct run_t
+{
+	hsize_t event_first, event_size;
+	hsize_t particle_first, particle_size;
+	char file_path[64];
+	double cutoff, gunradius;
+	int seed;
+	char model_file[32];
+	unsigned int model_crc;
+};
+
+// Summary of a run (see RunSummary): the totals of the run and, per
+// species, the tracks and the particles that reached the world boundary,
+// of which those within the acceptance are the ones stored.
+struct run_totals_t
+{
+	hsize_t runs, events, tracks, steps;
+	// secondaries removed by the cutoff, boundary particles outside the acceptance
+	hsize_t cut, discarded;
+};
+
+struct species_summary_t
+{
+	int pid;
+	hsize_t tracks;
+	hsize_t boundary, accepted;
+	double boundary_KE, accepted_KE;
+};
+
+// Secondaries of a run by the process that created them, their species
+// and the decade of their kinetic energy, [10^decade, 10^(decade+1)) GeV:
+// all those produced and those of them removed by the cutoff, with the
+// sums of their kinetic energies (in GeV).
+struct secondary_summary_t
+{
+	char process[32];
+	int pid;
+	int decade;
+	hsize_t produced, cut;
+	double produced_KE, cut_KE;
+};
+
+// Profile of an event (see EventProfile): the CPU time of the thread
+// simulating it, its wall time, the time spent in the user actions of
+// fgamma (in seconds) and its totals.
+struct event_profile_t
+{
+	hsize_t eventid;
+	double cpu, wall;
+	double actions;
+	hsize_t tracks, steps, secondaries;
+};
+
+// The tracks, steps and secondaries of an event by species and layer (the
+// tracks by the layer they start in, the steps and the secondaries they
+// create by the layer of the pre-step point).
+struct profile_entry_t
+{
+	hsize_t eventid;
+	int pid, layer;
+	hsize_t tracks, steps, secondaries;
+};
+
+// Memory use of an event (see MemoryMonitor), in bytes: the resident set
+// size at its end, the largest one sampled during it and the peak of the
+// process so far; and the most tracks waiting in the stack and held as
+// secondaries by a single track.
+struct event_memory_t
+{
+	hsize_t eventid;
+	hsize_t rss, rss_max, peak_rss;
+	hsize_t stack_max, secondaries_max;
+};
+
+// The maxima of the memory use over the events of a file (see
+// MemoryMonitor), and the peak of the process when it was closed.
+struct memory_max_t
+{
+	hsize_t rss_max, peak_rss;
+	hsize_t stack_max, secondaries_max;
+};
+
+// Records of the track log (see TrackingLog), with the ID of their event,
+// the energies in MeV and the distances from the origin in km. A track, at
+// its start and (with end=1) at its end:
+struct tracklog_track_t
+{
+	hsize_t eventid;
+	int trackid, parentid, pid;
+	int end, boundary;
+};
+
+// a step of the current track, with the number of secondaries the track
+// has made so far:
+struct tracklog_step_t
+{
+	hsize_t eventid;
+	int trackid, step;
+	unsigned int secondaries;
+};
+
+// a new track, either made by a step of the current track (classified=0,
+// with removed=1 if it was removed by the cutoff) or put on the stack
+// (classified=1):
+struct tracklog_secondary_t
+{
+	hsize_t eventid;
+	int trackid, parentid, pid;
+	char name[16];
+	double KE, r;
+	char process[32];
+	int classified, removed;
+};
+
+// Zone map of a block of consecutive rows in the particles table: the
+// boundary.KE range and a bitmask of the species (see ParticleIndex).
+struct particle_chunk_t
+{
+	hsize_t first, size;
+	double KE_min, KE_max;
+	unsigned int species;
+};
+
+// ---------------------------------------------------------------------
+//                         Table schemas
+// ---------------------------------------------------------------------
+template<> struct HDFTableSchema<event_t>
+{
+	static constexpr const char * title = "Events";
+	static constexpr HDFTableField fields[] = {
+		HDF_TABLE_FIELD(event_t, id, "eventid"),
+		HDF_TABLE_FIELD(event_t, first, "first"),
+		HDF_TABLE_FIELD(event_t, size, "size"),
+		HDF_TABLE_FIELD(event_t, pid, "pid"),
+		HDF_TABLE_FIELD(event_t, E, "E"),
+		HDF_TABLE_FIELD(event_t, KE, "KE"),
+		HDF_TABLE_FIELD(event_t, incidence, "incidence"),
+		HDF_TABLE_FIELD(event_t, discarded, "discarded")
+	};
+	static constexpr size_t nfields = sizeof(fields)/sizeof(*fields);
+};
+
+template<> struct HDFTableSchema<particle_t>
+{
+	static constexpr const char * title = "Particles in an event.";
+	static constexpr HDFTableField fields[] = {
+		HDF_TABLE_FIELD(particle_t, eventid, "eventid"),
+		HDF_TABLE_FIELD(particle_t, pid, "pid"),
+		HDF_TABLE_FIELD(particle_t, name, "name"),
+		HDF_TABLE_FIELD(particle_t, m, "mass"),
+		HDF_TABLE_FIELD(particle_t, vtx.KE, "vtx.KE"),
+		HDF_TABLE_FIELD(particle_t, vtx.x, "vtx.x"),
+		HDF_TABLE_FIELD(particle_t, vtx.y, "vtx.y"),
+		HDF_TABLE_FIELD(particle_t, vtx.z, "vtx.z"),
+		HDF_TABLE_FIELD(particle_t, vtx.px, "vtx.px"),
+		HDF_TABLE_FIELD(particle_t, vtx.py, "vtx.py"),
+		HDF_TABLE_FIELD(particle_t, vtx.pz, "vtx.pz"),
+		HDF_TABLE_FIELD(particle_t, boundary.KE, "boundary.KE"),
+		HDF_TABLE_FIELD(particle_t, boundary.x, "boundary.x"),
+		HDF_TABLE_FIELD(particle_t, boundary.y, "boundary.y"),
+		HDF_TABLE_FIELD(particle_t, boundary.z, "boundary.z"),
+		HDF_TABLE_FIELD(particle_t, boundary.px, "boundary.px"),
+		HDF_TABLE_FIELD(particle_t, boundary.py, "boundary.py"),
+		HDF_TABLE_FIELD(particle_t, boundary.pz, "boundary.pz")
+	};
+	static constexpr size_t nfields = sizeof(fields)/sizeof(*fields);
+};
+
+template<> struct HDFTableSchema<run_t>
+{
+	static constexpr const char * title = "Runs";
+	static constexpr HDFTableField fields[] = {
+		HDF_TABLE_FIELD(run_t, event_first, "event_first"),
+		HDF_TABLE_FIELD(run_t, event_size, "event_size"),
+		HDF_TABLE_FIELD(run_t, particle_first, "particle_first"),
+		HDF_TABLE_FIELD(run_t, particle_size, "particle_size"),
+		HDF_TABLE_FIELD(run_t, file_path, "file_path"),
+		HDF_TABLE_FIELD(run_t, cutoff, "cutoff"),
+		HDF_TABLE_FIELD(run_t, gunradius, "gunradius"),
+		HDF_TABLE_FIELD(run_t, seed, "seed"),
+		HDF_TABLE_FIELD(run_t, model_file, "model_file"),
+		HDF_TABLE_FIELD(run_t, model_crc, "model_crc")
+	};
+	static constexpr size_t nfields = sizeof(fields)/sizeof(*fields);
+};
+
+template<> struct HDFTableSchema<run_totals_t>
+{
+	static constexpr const char * title = "Run totals";
+	static constexpr HDFTableField fields[] = {
+		HDF_TABLE_FIELD(run_totals_t, runs, "runs"),
+		HDF_TABLE_FIELD(run_totals_t, events, "events"),
+		HDF_TABLE_FIELD(run_totals_t, tracks, "tracks"),
+		HDF_TABLE_FIELD(run_totals_t, steps, "steps"),
+		HDF_TABLE_FIELD(run_totals_t, cut, "cut"),
+		HDF_TABLE_FIELD(run_totals_t, discarded, "discarded")
+	};
+	static constexpr size_t nfields = sizeof(fields)/sizeof(*fields);
+};
+
+template<> struct HDFTableSchema<species_summary_t>
+{
+	static constexpr const char * title = "Run summary per species";
+	static constexpr HDFTableField fields[] = {
+		HDF_TABLE_FIELD(species_summary_t, pid, "pid"),
+		HDF_TABLE_FIELD(species_summary_t, tracks, "tracks"),
+		HDF_TABLE_FIELD(species_summary_t, boundary, "boundary"),
+		HDF_TABLE_FIELD(species_summary_t, accepted, "accepted"),
+		HDF_TABLE_FIELD(species_summary_t, boundary_KE, "boundary.KE"),
+		HDF_TABLE_FIELD(species_summary_t, accepted_KE, "accepted.KE")
+	};
+	static constexpr size_t nfields = sizeof(fields)/sizeof(*fields);
+};
+
+template<> struct HDFTableSchema<secondary_summary_t>
+{
+	static constexpr const char * title = "Run summary of the secondaries";
+	static constexpr HDFTableField fields[] = {
+		HDF_TABLE_FIELD(secondary_summary_t, process, "process"),
+		HDF_TABLE_FIELD(secondary_summary_t, pid, "pid"),
+		HDF_TABLE_FIELD(secondary_summary_t, decade, "decade"),
+		HDF_TABLE_FIELD(secondary_summary_t, produced, "produced"),
+		HDF_TABLE_FIELD(secondary_summary_t, cut, "cut"),
+		HDF_TABLE_FIELD(secondary_summary_t, produced_KE, "produced.KE"),
+		HDF_TABLE_FIELD(secondary_summary_t, cut_KE, "cut.KE")
+	};
+	static constexpr size_t nfields = sizeof(fields)/sizeof(*fields);
+};
+
+template<> struct HDFTableSchema<event_profile_t>
+{
+	static constexpr const char * title = "Profile of the events";
+	static constexpr HDFTableField fields[] = {
+		HDF_TABLE_FIELD(event_profile_t, eventid, "eventid"),
+		HDF_TABLE_FIELD(event_profile_t, cpu, "cpu"),
+		HDF_TABLE_FIELD(event_profile_t, wall, "wall"),
+		HDF_TABLE_FIELD(event_profile_t, actions, "actions"),
+		HDF_TABLE_FIELD(event_profile_t, tracks, "tracks"),
+		HDF_TABLE_FIELD(event_profile_t, steps, "steps"),
+		HDF_TABLE_FIELD(event_profile_t, secondaries, "secondaries")
+	};
+	static constexpr size_t nfields = sizeof(fields)/sizeof(*fields);
+};
+
+template<> struct HDFTableSchema<profile_entry_t>
+{
+	static constexpr const char * title = "Profile of the events by species and layer";
+	static constexpr HDFTableField fields[] = {
+		HDF_TABLE_FIELD(profile_entry_t, eventid, "eventid"),
+		HDF_TABLE_FIELD(profile_entry_t, pid, "pid"),
+		HDF_TABLE_FIELD(profile_entry_t, layer, "layer"),
+		HDF_TABLE_FIELD(profile_entry_t, tracks, "tracks"),
+		HDF_TABLE_FIELD(profile_entry_t, steps, "steps"),
+		HDF_TABLE_FIELD(profile_entry_t, secondaries, "secondaries")
+	};
+	static constexpr size_t nfields = sizeof(fields)/sizeof(*fields);
+};
+
+template<> struct HDFTableSchema<event_memory_t>
+{
+	static constexpr const char * title = "Memory use of the events";
+	static constexpr HDFTableField fields[] = {
+		HDF_TABLE_FIELD(event_memory_t, eventid, "eventid"),
+		HDF_TABLE_FIELD(event_memory_t, rss, "rss"),
+		HDF_TABLE_FIELD(event_memory_t, rss_max, "rss_max"),
+		HDF_TABLE_FIELD(event_memory_t, peak_rss, "peak_rss"),
+		HDF_TABLE_FIELD(event_memory_t, stack_max, "stack_max"),
+		HDF_TABLE_FIELD(event_memory_t, secondaries_max, "secondaries_max")
+	};
+	static constexpr size_t nfields = sizeof(fields)/sizeof(*fields);
+};
+
+template<> struct HDFTableSchema<memory_max_t>
+{
+	static constexpr const char * title = "Maxima of the memory use";
+	static constexpr HDFTableField fields[] = {
+		HDF_TABLE_FIELD(memory_max_t, rss_max, "rss_max"),
+		HDF_TABLE_FIELD(memory_max_t, peak_rss, "peak_rss"),
+		HDF_TABLE_FIELD(memory_max_t, stack_max, "stack_max"),
+		HDF_TABLE_FIELD(memory_max_t, secondaries_max, "secondaries_max")
+	};
+	static constexpr size_t nfields = sizeof(fields)/sizeof(*fields);
+};
+
+template<> struct HDFTableSchema<tracklog_track_t>
+{
+	static constexpr const char * title = "Tracks";
+	static constexpr HDFTableField fields[] = {
+		HDF_TABLE_FIELD(tracklog_track_t, eventid, "eventid"),
+		HDF_TABLE_FIELD(tracklog_track_t, trackid, "trackid"),
+		HDF_TABLE_FIELD(tracklog_track_t, parentid, "parentid"),
+		HDF_TABLE_FIELD(tracklog_track_t, pid, "pid"),
+		HDF_TABLE_FIELD(tracklog_track_t, end, "end"),
+		HDF_TABLE_FIELD(tracklog_track_t, boundary, "boundary")
+	};
+	static constexpr size_t nfields = sizeof(fields)/sizeof(*fields);
+};
+
+template<> struct HDFTableSchema<tracklog_step_t>
+{
+	static constexpr const char * title = "Steps";
+	static constexpr HDFTableField fields[] = {
+		HDF_TABLE_FIELD(tracklog_step_t, eventid, "eventid"),
+		HDF_TABLE_FIELD(tracklog_step_t, trackid, "trackid"),
+		HDF_TABLE_FIELD(tracklog_step_t, step, "step"),
+		HDF_TABLE_FIELD(tracklog_step_t, secondaries, "secondaries")
+	};
+	static constexpr size_t nfields = sizeof(fields)/sizeof(*fields);
+};
+
+template<> struct HDFTableSchema<tracklog_secondary_t>
+{
+	static constexpr const char * title = "Secondaries";
+	static constexpr HDFTableField fields[] = {
+		HDF_TABLE_FIELD(tracklog_secondary_t, eventid, "eventid"),
+		HDF_TABLE_FIELD(tracklog_secondary_t, trackid, "trackid"),
+		HDF_TABLE_FIELD(tracklog_secondary_t, parentid, "parentid"),
+		HDF_TABLE_FIELD(tracklog_secondary_t, pid, "pid"),
+		HDF_TABLE_FIELD(tracklog_secondary_t, name, "name"),
+		HDF_TABLE_FIELD(tracklog_secondary_t, KE, "KE"),
+		HDF_TABLE_FIELD(tracklog_secondary_t, r, "r"),
+		HDF_TABLE_FIELD(tracklog_secondary_t, process, "process"),
+		HDF_TABLE_FIELD(tracklog_secondary_t, classified, "classified"),
+		HDF_TABLE_FIELD(tracklog_secondary_t, removed, "removed")
+	};
+	static constexpr size_t nfields = sizeof(fields)/sizeof(*fields);
+};
+
+template<> struct HDFTableSchema<particle_chunk_t>
+{
+	static constexpr const char * title = "Index of the particles table.";
+	static constexpr HDFTableField fields[] = {
+		HDF_TABLE_FIELD(particle_chunk_t, first, "first"),
+		HDF_TABLE_FIELD(particle_chunk_t, size, "size"),
+		HDF_TABLE_FIELD(particle_chunk_t, KE_min, "KE_min"),
+		HDF_TABLE_FIELD(particle_chunk_t, KE_max, "KE_max"),
+		HDF_TABLE_FIELD(particle_chunk_t, species, "species")
+	};
+	static constexpr size_t nfields = sizeof(fields)/sizeof(*fields);
+};
+
+#endif
@@ -0,0 +1,76 @@
+#include "ParticleIndex.hh"
+
+#include <algorithm>
+
+const char * const ParticleIndex::tablename = "particles_index";
+
+ParticleIndex::ParticleIndex(const hid_t h5group)
+: table(h5group, tablename, 100), nparticles(0)
+{
+	table.row().size = 0;
+}
+
+ParticleIndex::ParticleIndex(const hid_t h5group, hdf_table_open_t, hsize_t first_particle)
+: table(h5group, tablename, hdf_table_open, 100), nparticles(first_particle)
+{
+	table.row().size = 0;
+}
+
+void ParticleIndex::add(const particle_t &p)
+{
+	particle_chunk_t &chunk = table.row();
+	if(chunk.size == 0) {
+		chunk.first = nparticles;
+		chunk.KE_min = chunk.KE_max = p.boundary.KE;
+		chunk.species = 0;
+	}
+
+	chunk.size++;
+	chunk.KE_min = std::min(chunk.KE_min, p.boundary.KE);
+	chunk.KE_max = std::max(chunk.KE_max, p.boundary.KE);
+	chunk.species |= species_bit(p.pid);
+	nparticles++;
+
+	if(chunk.size == HDF_CHUNK_SIZE) {
+		table.write();
+		table.row().size = 0;
+	}
+}
+
+void ParticleIndex::flush(bool close_chunk)
+{
+	if(close_chunk && table.row().size > 0) {
+		table.write();
+		table.row().size = 0;
+	}
+	table.flush();
+}
+
+unsigned int ParticleIndex::species_bit(int pid)
+{
+	switch(pid) {
+		case 0:     return ~0u;
+		case 22:    return 1u<<0;  // gamma
+		case 11:    return 1u<<1;  // e-
+		case -11:   return 1u<<2;  // e+
+		case 13:    return 1u<<3;  // mu-
+		case -13:   return 1u<<4;  // mu+
+		case 2112:  return 1u<<5;  // neutron
+		case 2212:  return 1u<<6;  // proton
+		case 211:   return 1u<<7;  // pi+
+		case -211:  return 1u<<8;  // pi-
+		case 111:   return 1u<<9;  // pi0
+		case 12:
+		case -12:   return 1u<<10; // electron (anti)neutrinos
+		case 14:
+		case -14:   return 1u<<11; // muon (anti)neutrinos
+		default:    return 1u<<31; // everything else
+	}
+}
+
+bool ParticleIndex::matches(const particle_chunk_t &chunk, int pid, double KE_min, double KE_max)
+{
+	return (chunk.species & species_bit(pid))
+	    && chunk.KE_max >= KE_min
+	    && chunk.KE_min <= KE_max;
+}
@@ -0,0 +1,38 @@
+#ifndef ParticleIndex_h
+#define ParticleIndex_h
+
+#include "OutputTables.hh"
+
+// ---------------------------------------------------------------------
+//                      class ParticleIndex
+// ---------------------------------------------------------------------
+// Builds the `particles_index` table while particles are being written:
+// one particle_chunk_t row per HDF_CHUNK_SIZE particles, so that readers
+// can skip whole chunks that cannot contain the species or energies they
+// are looking for.
+class ParticleIndex
+{
+	HDFTable<particle_chunk_t> table;
+	hsize_t nparticles;
+
+	public:
+		static const char * const tablename;
+
+		ParticleIndex(const hid_t h5group);
+		// continues an existing index, the next particle being first_particle
+		ParticleIndex(const hid_t h5group, hdf_table_open_t, hsize_t first_particle);
+		void add(const particle_t &p);
+		// writes the buffered index rows; with close_chunk, the partially
+		// filled chunk is written as well and a new chunk is started
+		void flush(bool close_chunk = true);
+
+		// bit of a PDG ID in particle_chunk_t::species (pid=0 matches any species)
+		static unsigned int species_bit(int pid);
+		static bool matches(const particle_chunk_t &chunk, int pid, double KE_min, double KE_max);
+
+	private:
+		ParticleIndex(const ParticleIndex&);
+		ParticleIndex& operator=(ParticleIndex);
+};
+
+#endif
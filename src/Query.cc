@@ -0,0 +1,487 @@
+#include "Query.hh"
+
+#include <cmath>
+#include <cctype>
+#include <cstdlib>
+#include <limits>
+#include <algorithm>
+
+// ---------------------------------------------------------------------
+//                      class QueryParser
+// ---------------------------------------------------------------------
+// Recursive descent parser of a query, emitting the operations of its
+// expressions into the plan.
+class QueryParser
+{
+	QueryPlan &plan;
+	const std::string &text;
+	size_t pos;
+
+	public:
+		QueryParser(QueryPlan &plan_, const std::string &text_)
+		: plan(plan_), text(text_), pos(0) {}
+
+		void parse(QueryPlan::query_t &query, const std::string &filter);
+
+	private:
+		typedef QueryPlan::op_t op_t;
+
+		void skip() {while(pos < text.size() && isspace(text[pos])) pos++;}
+		bool accept(const std::string &token);
+		bool acceptWord(const std::string &word);
+		void expect(const std::string &token);
+		std::string identifier();
+		double number();
+		bool end() {skip(); return pos == text.size();}
+		[[noreturn]] void error(const std::string &what);
+
+		size_t expression() {return disjunction();}
+		size_t disjunction();
+		size_t conjunction();
+		size_t negation();
+		size_t comparison();
+		size_t sum();
+		size_t product();
+		size_t unary();
+		size_t primary();
+};
+
+void QueryParser::error(const std::string &what)
+{
+	throw QueryPlan::parse_error(what+" at `"+text.substr(pos)+"` in `"+text+"`");
+}
+
+bool QueryParser::accept(const std::string &token)
+{
+	skip();
+	if(text.compare(pos, token.size(), token) == 0) {
+		pos += token.size();
+		return true;
+	}
+	return false;
+}
+
+bool QueryParser::acceptWord(const std::string &word)
+{
+	skip();
+	size_t end = pos + word.size();
+	if(text.compare(pos, word.size(), word) == 0 && (end == text.size() || !(isalnum(text[end]) || text[end] == '_'))) {
+		pos = end;
+		return true;
+	}
+	return false;
+}
+
+void QueryParser::expect(const std::string &token)
+{
+	if(!accept(token)) {
+		error("expected `"+token+"`");
+	}
+}
+
+std::string QueryParser::identifier()
+{
+	skip();
+	size_t start = pos;
+	while(pos < text.size() && (isalnum(text[pos]) || text[pos] == '_' || text[pos] == '.')) {
+		pos++;
+	}
+	if(pos == start || isdigit(text[start])) {
+		pos = start;
+		error("expected a field name");
+	}
+	return text.substr(start, pos-start);
+}
+
+double QueryParser::number()
+{
+	skip();
+	const char * begin = text.c_str() + pos;
+	char * end;
+	double value = strtod(begin, &end);
+	if(end == begin) {
+		error("expected a number");
+	}
+	pos += end - begin;
+	return value;
+}
+
+void QueryParser::parse(QueryPlan::query_t &query, const std::string &filter)
+{
+	typedef QueryPlan::query_t query_t;
+
+	query.has_filter = false;
+	query.value = 0;
+	query.bins = 0;
+	query.min = query.max = 0.0;
+	query.log = false;
+
+	if(acceptWord("count")) {
+		query.aggregate = query_t::COUNT;
+	} else if(acceptWord("sum")) {
+		query.aggregate = query_t::SUM;
+	} else if(acceptWord("mean")) {
+		query.aggregate = query_t::MEAN;
+	} else if(acceptWord("min")) {
+		query.aggregate = query_t::MIN;
+	} else if(acceptWord("max")) {
+		query.aggregate = query_t::MAX;
+	} else if(acceptWord("hist")) {
+		query.aggregate = query_t::HIST;
+	} else {
+		error("expected count, sum, mean, min, max or hist");
+	}
+
+	if(query.aggregate != query_t::COUNT) {
+		expect("(");
+		query.value = expression();
+		if(query.aggregate == query_t::HIST) {
+			expect(",");
+			double bins = number();
+			expect(",");
+			query.min = number();
+			expect(",");
+			query.max = number();
+			if(accept(",")) {
+				if(!acceptWord("log")) error("expected `log`");
+				query.log = true;
+			}
+			if(!(bins >= 1) || !(query.min < query.max) || (query.log && query.min <= 0)) {
+				error("bad histogram binning");
+			}
+			query.bins = static_cast<size_t>(bins);
+		}
+		expect(")");
+	}
+
+	if(acceptWord("where")) {
+		query.has_filter = true;
+		query.filter = expression();
+	}
+	if(!end()) {
+		error("unexpected input");
+	}
+
+	if(!filter.empty()) {
+		QueryParser fp(plan, filter);
+		size_t f = fp.expression();
+		if(!fp.end()) {
+			fp.error("unexpected input");
+		}
+		query.filter = query.has_filter ? plan.emit(op_t::AND, query.filter, f) : f;
+		query.has_filter = true;
+	}
+}
+
+size_t QueryParser::disjunction()
+{
+	size_t a = conjunction();
+	while(accept("||")) {
+		a = plan.emit(op_t::OR, a, conjunction());
+	}
+	return a;
+}
+
+size_t QueryParser::conjunction()
+{
+	size_t a = negation();
+	while(accept("&&")) {
+		a = plan.emit(op_t::AND, a, negation());
+	}
+	return a;
+}
+
+size_t QueryParser::negation()
+{
+	skip();
+	if(text.compare(pos, 2, "!=") != 0 && accept("!")) {
+		return plan.emit(op_t::NOT, negation());
+	}
+	return comparison();
+}
+
+size_t QueryParser::comparison()
+{
+	size_t a = sum();
+	// the two-character operators have to be tried first
+	if(accept("<=")) return plan.emit(op_t::LE, a, sum());
+	if(accept(">=")) return plan.emit(op_t::GE, a, sum());
+	if(accept("==")) return plan.emit(op_t::EQ, a, sum());
+	if(accept("!=")) return plan.emit(op_t::NE, a, sum());
+	if(accept("<")) return plan.emit(op_t::LT, a, sum());
+	if(accept(">")) return plan.emit(op_t::GT, a, sum());
+	return a;
+}
+
+size_t QueryParser::sum()
+{
+	size_t a = product();
+	for(;;) {
+		if(accept("+")) a = plan.emit(op_t::ADD, a, product());
+		else if(accept("-")) a = plan.emit(op_t::SUB, a, product());
+		else return a;
+	}
+}
+
+size_t QueryParser::product()
+{
+	size_t a = unary();
+	for(;;) {
+		if(accept("*")) a = plan.emit(op_t::MUL, a, unary());
+		else if(accept("/")) a = plan.emit(op_t::DIV, a, unary());
+		else return a;
+	}
+}
+
+size_t QueryParser::unary()
+{
+	if(accept("-")) {
+		return plan.emit(op_t::NEG, unary());
+	}
+	return primary();
+}
+
+size_t QueryParser::primary()
+{
+	skip();
+	if(accept("(")) {
+		size_t a = expression();
+		expect(")");
+		return a;
+	}
+	if(pos < text.size() && (isdigit(text[pos]) || text[pos] == '.')) {
+		return plan.emit(op_t::CONST, 0, 0, number());
+	}
+
+	const std::string name = identifier();
+	if(name == "abs" || name == "sqrt" || name == "log10") {
+		expect("(");
+		size_t a = expression();
+		expect(")");
+		return plan.emit(name == "abs" ? op_t::ABS : (name == "sqrt" ? op_t::SQRT : op_t::LOG10), a);
+	}
+	if(name == "R") {
+		size_t x = plan.column("boundary.x", false);
+		size_t y = plan.column("boundary.y", false);
+		size_t z = plan.column("boundary.z", false);
+		size_t r2 = plan.emit(op_t::ADD,
+			plan.emit(op_t::ADD, plan.emit(op_t::MUL, x, x), plan.emit(op_t::MUL, y, y)),
+			plan.emit(op_t::MUL, z, z)
+		);
+		return plan.emit(op_t::SQRT, r2);
+	}
+	if(name.compare(0, 6, "event.") == 0) {
+		return plan.column(name.substr(6), true);
+	}
+	return plan.column(name, false);
+}
+
+// ---------------------------------------------------------------------
+//                      class QueryPlan
+// ---------------------------------------------------------------------
+
+size_t QueryPlan::emit(op_t::code_t code, size_t a, size_t b, double value)
+{
+	op_t op;
+	op.code = code;
+	op.a = a;
+	op.b = b;
+	op.value = value;
+	program.push_back(op);
+	return program.size()-1;
+}
+
+// Columns are loaded once, however many times they are referred to.
+size_t QueryPlan::column(const std::string &field, bool event)
+{
+	for(size_t i=0; i<program.size(); i++) {
+		const op_t &op = program[i];
+		if(op.code == op_t::COLUMN && columns_[op.a].field == field && columns_[op.a].event == event) {
+			return i;
+		}
+	}
+	column_t c;
+	c.field = field;
+	c.event = event;
+	columns_.push_back(c);
+	return emit(op_t::COLUMN, columns_.size()-1);
+}
+
+void QueryPlan::add(const std::string &text, const std::string &filter)
+{
+	query_t query;
+	std::string body = text;
+
+	// an optional `NAME:` prefix
+	size_t colon = text.find(':');
+	if(colon != std::string::npos) {
+		query.name = text.substr(0, colon);
+		query.name.erase(0, query.name.find_first_not_of(" \t"));
+		query.name.erase(query.name.find_last_not_of(" \t")+1);
+		body = text.substr(colon+1);
+	} else {
+		query.name = text;
+	}
+
+	QueryParser(*this, body).parse(query, filter);
+	queries.push_back(query);
+}
+
+QueryPlan::state_t QueryPlan::state() const
+{
+	state_t s;
+	s.registers.resize(program.size());
+	s.results.resize(queries.size());
+	for(size_t i=0; i<queries.size(); i++) {
+		result_t &r = s.results[i];
+		r.count = 0;
+		r.sum = 0.0;
+		r.min = std::numeric_limits<double>::infinity();
+		r.max = -std::numeric_limits<double>::infinity();
+		r.bins.assign(queries[i].bins, 0);
+	}
+	return s;
+}
+
+void QueryPlan::evaluate(const std::vector<const double*> &inputs, size_t n, state_t &state) const
+{
+	for(size_t i=0; i<program.size(); i++) {
+		const op_t &op = program[i];
+		std::vector<double> &reg = state.registers[i];
+		reg.resize(std::max(reg.size(), n));
+		double * r = reg.data();
+		const double * a = op.code == op_t::COLUMN ? inputs[op.a] : state.registers[op.a].data();
+		const double * b = state.registers[op.b].data();
+
+		switch(op.code) {
+			case op_t::COLUMN: std::copy(a, a+n, r); break;
+			case op_t::CONST: std::fill(r, r+n, op.value); break;
+			case op_t::NEG: for(size_t j=0; j<n; j++) r[j] = -a[j]; break;
+			case op_t::NOT: for(size_t j=0; j<n; j++) r[j] = (a[j] == 0.0); break;
+			case op_t::ABS: for(size_t j=0; j<n; j++) r[j] = fabs(a[j]); break;
+			case op_t::SQRT: for(size_t j=0; j<n; j++) r[j] = sqrt(a[j]); break;
+			case op_t::LOG10: for(size_t j=0; j<n; j++) r[j] = log10(a[j]); break;
+			case op_t::ADD: for(size_t j=0; j<n; j++) r[j] = a[j] + b[j]; break;
+			case op_t::SUB: for(size_t j=0; j<n; j++) r[j] = a[j] - b[j]; break;
+			case op_t::MUL: for(size_t j=0; j<n; j++) r[j] = a[j] * b[j]; break;
+			case op_t::DIV: for(size_t j=0; j<n; j++) r[j] = a[j] / b[j]; break;
+			case op_t::LT: for(size_t j=0; j<n; j++) r[j] = (a[j] < b[j]); break;
+			case op_t::LE: for(size_t j=0; j<n; j++) r[j] = (a[j] <= b[j]); break;
+			case op_t::GT: for(size_t j=0; j<n; j++) r[j] = (a[j] > b[j]); break;
+			case op_t::GE: for(size_t j=0; j<n; j++) r[j] = (a[j] >= b[j]); break;
+			case op_t::EQ: for(size_t j=0; j<n; j++) r[j] = (a[j] == b[j]); break;
+			case op_t::NE: for(size_t j=0; j<n; j++) r[j] = (a[j] != b[j]); break;
+			case op_t::AND: for(size_t j=0; j<n; j++) r[j] = (a[j] != 0.0) & (b[j] != 0.0); break;
+			case op_t::OR: for(size_t j=0; j<n; j++) r[j] = (a[j] != 0.0) | (b[j] != 0.0); break;
+		}
+	}
+
+	for(size_t i=0; i<queries.size(); i++) {
+		const query_t &q = queries[i];
+		result_t &res = state.results[i];
+		const double * f = q.has_filter ? state.registers[q.filter].data() : nullptr;
+		if(q.aggregate == query_t::COUNT) {
+			if(f == nullptr) {
+				res.count += n;
+			} else {
+				hsize_t count = 0;
+				for(size_t j=0; j<n; j++) count += (f[j] != 0.0);
+				res.count += count;
+			}
+			continue;
+		}
+
+		const double * v = state.registers[q.value].data();
+		const double lmin = q.log ? log10(q.min) : q.min;
+		const double scale = q.bins/((q.log ? log10(q.max) : q.max) - lmin);
+		for(size_t j=0; j<n; j++) {
+			if(f != nullptr && f[j] == 0.0) continue;
+			res.count++;
+			res.sum += v[j];
+			res.min = std::min(res.min, v[j]);
+			res.max = std::max(res.max, v[j]);
+			if(q.aggregate == query_t::HIST) {
+				double u = ((q.log ? log10(v[j]) : v[j]) - lmin)*scale;
+				if(u >= 0.0 && u < q.bins) {
+					res.bins[static_cast<size_t>(u)]++;
+				}
+			}
+		}
+	}
+}
+
+void QueryPlan::merge(state_t &into, const state_t &from) const
+{
+	for(size_t i=0; i<queries.size(); i++) {
+		result_t &a = into.results[i];
+		const result_t &b = from.results[i];
+		a.count += b.count;
+		a.sum += b.sum;
+		a.min = std::min(a.min, b.min);
+		a.max = std::max(a.max, b.max);
+		for(size_t k=0; k<a.bins.size(); k++) {
+			a.bins[k] += b.bins[k];
+		}
+	}
+}
+
+void QueryPlan::print(std::ostream &out, const state_t &state) const
+{
+	for(size_t i=0; i<queries.size(); i++) {
+		const query_t &q = queries[i];
+		const result_t &r = state.results[i];
+		out << q.name << ": ";
+		switch(q.aggregate) {
+			case query_t::COUNT: out << r.count << std::endl; break;
+			case query_t::SUM: out << r.sum << std::endl; break;
+			// the mean of no rows would be printed as -nan
+			case query_t::MEAN: out << (r.count > 0 ? r.sum/r.count : NAN) << std::endl; break;
+			case query_t::MIN: out << r.min << std::endl; break;
+			case query_t::MAX: out << r.max << std::endl; break;
+			case query_t::HIST:
+				out << r.count << " entries" << std::endl;
+				for(size_t k=0; k<q.bins; k++) {
+					double lo = double(k)/q.bins, hi = double(k+1)/q.bins;
+					if(q.log) {
+						lo = pow(10.0, log10(q.min) + lo*(log10(q.max)-log10(q.min)));
+						hi = pow(10.0, log10(q.min) + hi*(log10(q.max)-log10(q.min)));
+					} else {
+						lo = q.min + lo*(q.max-q.min);
+						hi = q.min + hi*(q.max-q.min);
+					}
+					out << "  [" << lo << ", " << hi << "): " << r.bins[k] << std::endl;
+				}
+				break;
+		}
+	}
+}
+
+bool QueryPlan::save(FILE * out, const state_t &state) const
+{
+	for(const result_t &r : state.results) {
+		const double values[] = {r.sum, r.min, r.max};
+		if(fwrite(&r.count, sizeof(r.count), 1, out) != 1
+			|| fwrite(values, sizeof(values), 1, out) != 1
+			|| fwrite(r.bins.data(), sizeof(hsize_t), r.bins.size(), out) != r.bins.size()) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// The state has to come from state(), which sizes the histograms.
+bool QueryPlan::load(FILE * in, state_t &state) const
+{
+	for(result_t &r : state.results) {
+		double values[3];
+		if(fread(&r.count, sizeof(r.count), 1, in) != 1
+			|| fread(values, sizeof(values), 1, in) != 1
+			|| fread(r.bins.data(), sizeof(hsize_t), r.bins.size(), in) != r.bins.size()) {
+			return false;
+		}
+		r.sum = values[0];
+		r.min = values[1];
+		r.max = values[2];
+	}
+	return true;
+}
@@ -0,0 +1,260 @@
+#ifndef Query_h
+#define Query_h
+
+#include "OutputTables.hh"
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <algorithm>
+#include <ostream>
+#include <cstdio>
+#include <stdexcept>
+
+// ---------------------------------------------------------------------
+//                      class QueryPlan
+// ---------------------------------------------------------------------
+// Queries over the particles of fgamma output files, e.g.
+//
+//   count where pid == 22 && boundary.KE > 1
+//   hist(event.incidence, 10, 0, 1.6) where pid == 22
+//   mean(boundary.KE) where R > 6400
+//
+// Each query is an aggregate -- count, sum(X), mean(X), min(X), max(X) or
+// hist(X, BINS, MIN, MAX[, log]) -- over the particles that pass the
+// optional `where` filter. Expressions can use the numeric fields of the
+// particles (pid, boundary.KE, vtx.x, ...), the fields of their events
+// prefixed with `event.` (event.incidence, ...), R (the radius of the
+// boundary point), numbers, + - * /, comparisons, && || ! and the functions
+// abs, sqrt and log10.
+//
+// All the queries are compiled into one program of operations over blocks
+// of rows, each operation being a simple loop over the whole block, so that
+// a single scan evaluates all of them.
+class QueryPlan
+{
+	public:
+		struct parse_error : std::invalid_argument
+		{
+			parse_error(const std::string &what) : std::invalid_argument(what) {}
+		};
+
+		// a column the queries refer to: a particle field or, if event is
+		// set, a field of the event of the particle
+		struct column_t
+		{
+			std::string field;
+			bool event;
+		};
+
+		struct result_t
+		{
+			hsize_t count;
+			double sum, min, max;
+			std::vector<hsize_t> bins;
+		};
+
+		// the registers and the partial results of one thread
+		struct state_t
+		{
+			std::vector< std::vector<double> > registers;
+			std::vector<result_t> results;
+		};
+
+		// Adds a query, optionally named with a `NAME: ` prefix. The filter,
+		// if not empty, is an expression ANDed to its `where` clause.
+		void add(const std::string &query, const std::string &filter = "");
+
+		const std::vector<column_t> & columns() const {return columns_;}
+		size_t size() const {return queries.size();}
+		// the number of registers, each holding a block of rows
+		size_t registers() const {return program.size();}
+
+		state_t state() const;
+		// evaluates the queries over n rows, the columns being given in the
+		// order of columns()
+		void evaluate(const std::vector<const double*> &columns, size_t n, state_t &state) const;
+		void merge(state_t &into, const state_t &from) const;
+		void print(std::ostream &out, const state_t &state) const;
+		// binary (de)serialization of the results of a state, e.g. to merge
+		// the results of several processes; false on I/O errors
+		bool save(FILE * out, const state_t &state) const;
+		bool load(FILE * in, state_t &state) const;
+
+	private:
+		friend class QueryParser;
+
+		struct op_t
+		{
+			enum code_t {
+				COLUMN, CONST, NEG, NOT, ABS, SQRT, LOG10,
+				ADD, SUB, MUL, DIV, LT, LE, GT, GE, EQ, NE, AND, OR
+			} code;
+			size_t a, b;
+			double value;
+		};
+
+		struct query_t
+		{
+			enum aggregate_t {COUNT, SUM, MEAN, MIN, MAX, HIST};
+
+			std::string name;
+			aggregate_t aggregate;
+			// registers of the filter (if has_filter) and of the value
+			bool has_filter;
+			size_t filter, value;
+			// histogram binning
+			size_t bins;
+			double min, max;
+			bool log;
+		};
+
+		// operation i writes register i
+		std::vector<op_t> program;
+		std::vector<column_t> columns_;
+		std::vector<query_t> queries;
+
+		size_t column(const std::string &field, bool event);
+		size_t emit(op_t::code_t code, size_t a = 0, size_t b = 0, double value = 0.0);
+};
+
+// ---------------------------------------------------------------------
+//                      class ColumnReader
+// ---------------------------------------------------------------------
+// Reads some numeric fields of a table of Row into columns of doubles,
+// reading only those fields of the records.
+template<class Row>
+class ColumnReader
+{
+	typedef HDFTableSchema<Row> schema;
+
+	enum kind_t {INT, UINT, FLOAT};
+	struct field_t
+	{
+		// the offsets in the fetched fields and in Row
+		size_t offset, row_offset, size;
+		kind_t kind;
+		size_t column;
+	};
+
+	std::string names;
+	std::vector<field_t> fields;
+	std::vector<size_t> offsets, sizes;
+	size_t row_size;
+	std::vector<char> buffer;
+
+	public:
+		// throws QueryPlan::parse_error for unknown or non-numeric fields
+		ColumnReader(const std::vector<std::string> &columns);
+		// reads n rows from start into columns[i][0..n) for each field i
+		herr_t read(hid_t group, const std::string &table, hsize_t start, hsize_t n, std::vector< std::vector<double> > &columns);
+
+		// the two steps of read(): reading the fields of n rows into a
+		// buffer of n*rowSize() bytes and converting them into the columns
+		size_t rowSize() const {return row_size;}
+		herr_t fetch(hid_t group, const std::string &table, hsize_t start, hsize_t n, void * data) const;
+		void convert(const void * data, hsize_t n, std::vector< std::vector<double> > &columns) const;
+		// converts n whole rows into columns[i][first..first+n)
+		void convertRows(const Row * rows, hsize_t n, std::vector< std::vector<double> > &columns, hsize_t first = 0) const;
+
+	private:
+		void convert(const char * data, size_t stride, bool whole_rows, hsize_t n,
+			std::vector< std::vector<double> > &columns, hsize_t first) const;
+};
+
+template<class Row>
+ColumnReader<Row>::ColumnReader(const std::vector<std::string> &columns)
+: row_size(0)
+{
+	std::vector<bool> found(columns.size(), false);
+	// H5TBread_fields_name fills the fields in the order of the table
+	for(size_t i=0; i<schema::nfields; i++) {
+		for(size_t c=0; c<columns.size(); c++) {
+			if(columns[c] != schema::fields[i].name) continue;
+
+			hid_t type = schema::fields[i].type();
+			H5T_class_t cls = H5Tget_class(type);
+			H5T_sign_t sign = H5Tget_sign(type);
+			H5Tclose(type);
+			if(cls != H5T_INTEGER && cls != H5T_FLOAT) {
+				throw QueryPlan::parse_error("field `"+columns[c]+"` is not numeric");
+			}
+
+			field_t field;
+			field.offset = row_size;
+			field.row_offset = schema::fields[i].offset;
+			field.size = schema::fields[i].size;
+			field.kind = cls == H5T_FLOAT ? FLOAT : (sign == H5T_SGN_NONE ? UINT : INT);
+			field.column = c;
+			fields.push_back(field);
+			offsets.push_back(field.offset);
+			sizes.push_back(field.size);
+			row_size += field.size;
+
+			names += (names.empty() ? "" : ",") + columns[c];
+			found[c] = true;
+			break;
+		}
+	}
+	for(size_t c=0; c<columns.size(); c++) {
+		if(!found[c]) {
+			throw QueryPlan::parse_error("unknown field `"+columns[c]+"`");
+		}
+	}
+}
+
+template<class Row>
+herr_t ColumnReader<Row>::read(hid_t group, const std::string &table, hsize_t start, hsize_t n, std::vector< std::vector<double> > &columns)
+{
+	buffer.resize(n*row_size);
+	herr_t ret = fetch(group, table, start, n, buffer.data());
+	convert(buffer.data(), n, columns);
+	return ret;
+}
+
+template<class Row>
+herr_t ColumnReader<Row>::fetch(hid_t group, const std::string &table, hsize_t start, hsize_t n, void * data) const
+{
+	if(fields.empty()) return 0;
+	return H5TBread_fields_name(group, table.c_str(), names.c_str(), start, n,
+		row_size, offsets.data(), sizes.data(), data
+	);
+}
+
+template<class Row>
+void ColumnReader<Row>::convert(const void * data, hsize_t n, std::vector< std::vector<double> > &columns) const
+{
+	convert(static_cast<const char*>(data), row_size, false, n, columns, 0);
+}
+
+template<class Row>
+void ColumnReader<Row>::convertRows(const Row * rows, hsize_t n, std::vector< std::vector<double> > &columns, hsize_t first) const
+{
+	convert(reinterpret_cast<const char*>(rows), sizeof(Row), true, n, columns, first);
+}
+
+template<class Row>
+void ColumnReader<Row>::convert(const char * data, size_t stride, bool whole_rows, hsize_t n,
+	std::vector< std::vector<double> > &columns, hsize_t first) const
+{
+	for(const field_t &field : fields) {
+		std::vector<double> &column = columns[field.column];
+		column.resize(std::max<size_t>(column.size(), first+n));
+		const char * p = data + (whole_rows ? field.row_offset : field.offset);
+		for(hsize_t j=first; j<first+n; j++, p+=stride) {
+			switch(field.kind) {
+				case INT:
+					column[j] = field.size == 8 ? double(*reinterpret_cast<const int64_t*>(p)) : double(*reinterpret_cast<const int32_t*>(p));
+					break;
+				case UINT:
+					column[j] = field.size == 8 ? double(*reinterpret_cast<const uint64_t*>(p)) : double(*reinterpret_cast<const uint32_t*>(p));
+					break;
+				case FLOAT:
+					column[j] = field.size == 8 ? *reinterpret_cast<const double*>(p) : double(*reinterpret_cast<const float*>(p));
+					break;
+			}
+		}
+	}
+}
+
+#endif
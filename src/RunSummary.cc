@@ -0,0 +1,219 @@
+#include "RunSummary.hh"
+
+#include <vector>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+const char * const RunSummary::groupname = "summary";
+
+// The energy decades of the secondaries, in GeV; the lowest and the highest
+// include the energies below and above them.
+static const int decade_min = -12, decade_max = 9;
+
+RunSummary::RunSummary(hsize_t runs)
+{
+	reset(runs);
+}
+
+void RunSummary::reset(hsize_t runs)
+{
+	totals_ = run_totals_t();
+	totals_.runs = runs;
+	species_.clear();
+	secondaries_.clear();
+}
+
+species_summary_t & RunSummary::species(int pid)
+{
+	std::map<int, species_summary_t>::iterator it = species_.find(pid);
+	if(it == species_.end()) {
+		species_summary_t s = species_summary_t();
+		s.pid = pid;
+		it = species_.insert(std::make_pair(pid, s)).first;
+	}
+	return it->second;
+}
+
+uint64_t RunSummary::key(size_t process, int pid, int decade)
+{
+	return (uint64_t(process) << 48) | (uint64_t(uint32_t(pid)) << 16) | uint16_t(decade);
+}
+
+secondary_summary_t & RunSummary::secondaries(size_t process, int pid, int decade)
+{
+	const uint64_t k = key(process, pid, decade);
+	std::unordered_map<uint64_t, secondary_summary_t>::iterator it = secondaries_.find(k);
+	if(it == secondaries_.end()) {
+		secondary_summary_t s = secondary_summary_t();
+		string_to_cstr(processes_[process], s.process, sizeof(s.process));
+		s.pid = pid;
+		s.decade = decade;
+		it = secondaries_.insert(std::make_pair(k, s)).first;
+	}
+	return it->second;
+}
+
+size_t RunSummary::process(const std::string &name)
+{
+	std::vector<std::string>::iterator it = std::find(processes_.begin(), processes_.end(), name);
+	if(it != processes_.end()) {
+		return it - processes_.begin();
+	}
+	processes_.push_back(name);
+	return processes_.size() - 1;
+}
+
+void RunSummary::secondary(size_t process, int pid, double KE, bool cut)
+{
+	int decade = KE > 0 ? int(std::floor(std::log10(KE))) : decade_min;
+	decade = std::min(std::max(decade, decade_min), decade_max);
+
+	secondary_summary_t &s = secondaries(process, pid, decade);
+	s.produced++;
+	s.produced_KE += KE;
+	if(cut) {
+		s.cut++;
+		s.cut_KE += KE;
+	}
+}
+
+void RunSummary::track(int pid)
+{
+	totals_.tracks++;
+	species(pid).tracks++;
+}
+
+void RunSummary::boundary(int pid, double KE, bool accepted)
+{
+	species_summary_t &s = species(pid);
+	s.boundary++;
+	s.boundary_KE += KE;
+	if(accepted) {
+		s.accepted++;
+		s.accepted_KE += KE;
+	} else {
+		totals_.discarded++;
+	}
+}
+
+void RunSummary::merge(const RunSummary &other)
+{
+	totals_.runs += other.totals_.runs;
+	totals_.events += other.totals_.events;
+	totals_.tracks += other.totals_.tracks;
+	totals_.steps += other.totals_.steps;
+	totals_.cut += other.totals_.cut;
+	totals_.discarded += other.totals_.discarded;
+
+	for(const std::pair<const int, species_summary_t> &entry : other.species_) {
+		species_summary_t &s = species(entry.first);
+		s.tracks += entry.second.tracks;
+		s.boundary += entry.second.boundary;
+		s.accepted += entry.second.accepted;
+		s.boundary_KE += entry.second.boundary_KE;
+		s.accepted_KE += entry.second.accepted_KE;
+	}
+
+	for(const std::pair<const uint64_t, secondary_summary_t> &entry : other.secondaries_) {
+		const secondary_summary_t &o = entry.second;
+		secondary_summary_t &s = secondaries(process(o.process), o.pid, o.decade);
+		s.produced += o.produced;
+		s.cut += o.cut;
+		s.produced_KE += o.produced_KE;
+		s.cut_KE += o.cut_KE;
+	}
+}
+
+void RunSummary::create(hid_t file)
+{
+	hid_t group = H5Gcreate(file, groupname, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+	HDFTable<run_totals_t> totals(group, "totals");
+	HDFTable<species_summary_t> species(group, "species");
+	HDFTable<secondary_summary_t> secondaries(group, "secondaries");
+	H5Gclose(group);
+}
+
+// Only appends to existing datasets, which is allowed in SWMR mode.
+void RunSummary::write(hid_t file) const
+{
+	if(H5Lexists(file, groupname, H5P_DEFAULT) <= 0) {
+		create(file);
+	}
+	hid_t group = H5Gopen(file, groupname, H5P_DEFAULT);
+
+	HDFTable<run_totals_t> totals(group, "totals", hdf_table_open);
+	totals.row() = totals_;
+	totals.write();
+
+	HDFTable<species_summary_t> species(group, "species", hdf_table_open, species_.size() + 1);
+	for(const std::pair<const int, species_summary_t> &entry : species_) {
+		species.row() = entry.second;
+		species.write();
+	}
+	species.flush();
+
+	// ordered by process, species and decade; the table is missing in
+	// summaries created before it was added
+	std::vector<secondary_summary_t> rows;
+	for(const std::pair<const uint64_t, secondary_summary_t> &entry : secondaries_) {
+		rows.push_back(entry.second);
+	}
+	std::sort(rows.begin(), rows.end(), [](const secondary_summary_t &a, const secondary_summary_t &b) {
+		const int c = strcmp(a.process, b.process);
+		if(c != 0) return c < 0;
+		return a.pid < b.pid || (a.pid == b.pid && a.decade < b.decade);
+	});
+	if(H5Lexists(group, "secondaries", H5P_DEFAULT) <= 0) {
+		HDFTable<secondary_summary_t> created(group, "secondaries");
+	}
+	HDFTable<secondary_summary_t> secondaries(group, "secondaries", hdf_table_open, rows.size() + 1);
+	for(const secondary_summary_t &row : rows) {
+		secondaries.row() = row;
+		secondaries.write();
+	}
+	secondaries.flush();
+
+	H5Gclose(group);
+}
+
+bool RunSummary::read(hid_t file)
+{
+	if(H5Lexists(file, groupname, H5P_DEFAULT) <= 0) {
+		return false;
+	}
+	hid_t group = H5Gopen(file, groupname, H5P_DEFAULT);
+
+	// e.g. the empty tables of a run that crashed, which leave the summary
+	// as it is
+	hsize_t nfields, nrows;
+	run_totals_t totals;
+	if(H5Lexists(group, "totals", H5P_DEFAULT) <= 0
+		|| H5TBget_table_info(group, "totals", &nfields, &nrows) < 0 || nrows < 1
+		|| hdf_read_rows(group, "totals", 0, 1, &totals) < 0) {
+		H5Gclose(group);
+		return false;
+	}
+	totals_ = totals;
+
+	H5TBget_table_info(group, "species", &nfields, &nrows);
+	std::vector<species_summary_t> rows(nrows);
+	hdf_read_rows(group, "species", 0, nrows, rows.data());
+	species_.clear();
+	for(const species_summary_t &row : rows) {
+		species_[row.pid] = row;
+	}
+
+	secondaries_.clear();
+	if(H5Lexists(group, "secondaries", H5P_DEFAULT) > 0) {
+		H5TBget_table_info(group, "secondaries", &nfields, &nrows);
+		std::vector<secondary_summary_t> secondary_rows(nrows);
+		hdf_read_rows(group, "secondaries", 0, nrows, secondary_rows.data());
+		for(const secondary_summary_t &row : secondary_rows) {
+			secondaries(process(row.process), row.pid, row.decade) = row;
+		}
+	}
+
+	H5Gclose(group);
+	return true;
+}
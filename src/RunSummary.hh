@@ -0,0 +1,71 @@
+#ifndef RunSummary_h
+#define RunSummary_h
+
+#include "OutputTables.hh"
+
+#include <map>
+#include <unordered_map>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+// ---------------------------------------------------------------------
+//                      class RunSummary
+// ---------------------------------------------------------------------
+// Aggregates of a run, accumulated while it is simulated so that e.g. the
+// number of escaping gammas per primary does not need a scan of the
+// particles. Written to the group `summary` of the output: the table
+// `totals` (one run_totals_t row), the table `species` (a
+// species_summary_t row per species) and the table `secondaries` (a
+// secondary_summary_t row per creator process, species and energy decade
+// with secondaries). Summaries of several runs add up.
+class RunSummary
+{
+	run_totals_t totals_;
+	std::map<int, species_summary_t> species_;
+	// the names of the creator processes, and the secondaries by process
+	// index, species and decade (see key())
+	std::vector<std::string> processes_;
+	std::unordered_map<uint64_t, secondary_summary_t> secondaries_;
+
+	public:
+		static const char * const groupname;
+
+		// the summary of a run or, with runs=0, an empty sum of runs
+		explicit RunSummary(hsize_t runs = 1);
+
+		void event() {totals_.events++;}
+		void step() {totals_.steps++;}
+		void cut() {totals_.cut++;}
+		void track(int pid);
+		// a particle that reached the world boundary, accepted if it is
+		// within the acceptance (i.e. stored)
+		void boundary(int pid, double KE, bool accepted);
+		// the index of a creator process for secondary(), which stays valid
+		// after reset()
+		size_t process(const std::string &name);
+		// a secondary of energy KE (in GeV), created by a process (see
+		// process()), cut if it was removed by the cutoff
+		void secondary(size_t process, int pid, double KE, bool cut);
+
+		const run_totals_t & totals() const {return totals_;}
+		void merge(const RunSummary &other);
+		void reset(hsize_t runs = 1);
+
+		// creates the empty summary tables in a file, e.g. before it is
+		// switched to SWMR mode, after which no datasets can be created
+		static void create(hid_t file);
+		// writes the summary to the file, into the tables made by create()
+		// if they exist
+		void write(hid_t file) const;
+		// the summary of a file, false if it has none or only the empty
+		// tables of create()
+		bool read(hid_t file);
+
+	private:
+		species_summary_t & species(int pid);
+		secondary_summary_t & secondaries(size_t process, int pid, int decade);
+		static uint64_t key(size_t process, int pid, int decade);
+};
+
+#endif
@@ -0,0 +1,244 @@
+#include "StatsServer.hh"
+#include "MemoryMonitor.hh"
+#include "Timer.hh"
+
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <cstdlib>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+// ---------------------------------------------------------------------
+//                  class StatsServer::counters_t
+// ---------------------------------------------------------------------
+StatsServer::counters_t::counters_t()
+: events(0), tracks(0), steps(0), event_rows(0), particle_rows(0), output_bytes(0),
+  current_event(0), event_start_ns(0)
+{}
+
+// ---------------------------------------------------------------------
+//                        class StatsServer
+// ---------------------------------------------------------------------
+// The port of PORT, localhost:PORT or 127.0.0.1:PORT, or 0 if address is
+// none of these (and so the path of a socket).
+static int parse_port(const std::string &address)
+{
+	std::string port = address;
+	for(const char * host : {"localhost:", "127.0.0.1:"}) {
+		if(address.compare(0, strlen(host), host) == 0) {
+			port = address.substr(strlen(host));
+		}
+	}
+	if(port.empty() || port.find_first_not_of("0123456789") != std::string::npos || port.size() > 5) {
+		return 0;
+	}
+	const int n = atoi(port.c_str());
+	return (n > 0 && n < 65536) ? n : 0;
+}
+
+// A socket no one is listening on is left behind by a run that did not
+// finish; one that is listened on belongs to another run.
+static bool stale_socket(const sockaddr_un &addr)
+{
+	struct stat st;
+	if(stat(addr.sun_path, &st) != 0 || !S_ISSOCK(st.st_mode)) {
+		return false;
+	}
+	const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	const bool stale = (connect(fd, (const sockaddr*)&addr, sizeof(addr)) != 0 && errno == ECONNREFUSED);
+	close(fd);
+	return stale;
+}
+
+StatsServer::StatsServer(const std::string &address, size_t total_events_)
+: total_events(total_events_), start_ns(Time::wall_ns()), listener(-1), nsamples(1)
+{
+	const int port = parse_port(address);
+	if(port > 0) {
+		sockaddr_in addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sin_family = AF_INET;
+		addr.sin_port = htons(port);
+		addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		listener = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		const int reuse = 1;
+		setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+		if(bind(listener, (const sockaddr*)&addr, sizeof(addr)) != 0) {
+			const int error = errno;
+			close(listener);
+			throw std::invalid_argument("StatsServer: unable to bind port "+std::to_string(port)+": "+strerror(error));
+		}
+	} else {
+		sockaddr_un addr;
+		memset(&addr, 0, sizeof(addr));
+		addr.sun_family = AF_UNIX;
+		if(address.empty() || address.size() >= sizeof(addr.sun_path)) {
+			throw std::invalid_argument("StatsServer: bad socket path "+address);
+		}
+		strncpy(addr.sun_path, address.c_str(), sizeof(addr.sun_path)-1);
+		if(stale_socket(addr)) {
+			unlink(address.c_str());
+		}
+		listener = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+		if(bind(listener, (const sockaddr*)&addr, sizeof(addr)) != 0) {
+			const int error = errno;
+			close(listener);
+			throw std::invalid_argument("StatsServer: unable to bind "+address+": "+strerror(error));
+		}
+		socket_path = address;
+	}
+	if(listen(listener, 8) != 0 || pipe2(wakeup, O_CLOEXEC) != 0) {
+		close(listener);
+		if(!socket_path.empty()) unlink(socket_path.c_str());
+		throw std::invalid_argument("StatsServer: unable to listen on "+address);
+	}
+
+	samples[0] = sample_t{start_ns, 0, 0, 0};
+	thread = std::thread(&StatsServer::run, this);
+}
+
+StatsServer::~StatsServer()
+{
+	const char stop = 0;
+	while(write(wakeup[1], &stop, 1) < 0 && errno == EINTR);
+	thread.join();
+	close(wakeup[0]);
+	close(wakeup[1]);
+	close(listener);
+	if(!socket_path.empty()) {
+		unlink(socket_path.c_str());
+	}
+}
+
+// Samples the counters every second, between the requests.
+void StatsServer::run()
+{
+	uint64_t next_sample = start_ns + 1000000000u;
+	while(true) {
+		const uint64_t now = Time::wall_ns();
+		if(now >= next_sample) {
+			samples[nsamples % (window+1)] = current();
+			nsamples++;
+			next_sample = now + 1000000000u;
+		}
+
+		pollfd fds[2] = {{wakeup[0], POLLIN, 0}, {listener, POLLIN, 0}};
+		const int timeout = (next_sample - now)/1000000 + 1;
+		if(poll(fds, 2, timeout) < 0 && errno != EINTR) {
+			return;
+		}
+		if(fds[0].revents != 0) {
+			return;
+		}
+		if(fds[1].revents & POLLIN) {
+			const int client = accept4(listener, nullptr, nullptr, SOCK_CLOEXEC);
+			if(client >= 0) {
+				serve(client);
+				close(client);
+			}
+		}
+	}
+}
+
+StatsServer::sample_t StatsServer::current() const
+{
+	return sample_t{
+		Time::wall_ns(),
+		counters.events.load(std::memory_order_relaxed),
+		counters.tracks.load(std::memory_order_relaxed),
+		counters.steps.load(std::memory_order_relaxed)
+	};
+}
+
+// Reads the request (up to the empty line, which also tells a client that
+// sent nothing from one whose request is still coming) and answers it. A
+// client gets at most a second for either, so that it can not hold up the
+// server.
+void StatsServer::serve(int client) const
+{
+	const timeval timeout = {1, 0};
+	setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+	std::string request;
+	char buf[1024];
+	while(request.size() < 8192 && request.find("\r\n\r\n") == std::string::npos && request.find("\n\n") == std::string::npos) {
+		const ssize_t n = recv(client, buf, sizeof(buf), 0);
+		if(n < 0 && errno == EINTR) continue;
+		if(n <= 0) break;
+		request.append(buf, n);
+	}
+
+	const std::string body = metrics();
+	std::ostringstream response;
+	response << "HTTP/1.0 200 OK\r\n"
+	         << "Content-Type: text/plain; version=0.0.4\r\n"
+	         << "Content-Length: " << body.size() << "\r\n"
+	         << "Connection: close\r\n"
+	         << "\r\n"
+	         << body;
+	const std::string str = response.str();
+	size_t sent = 0;
+	while(sent < str.size()) {
+		const ssize_t n = send(client, str.data() + sent, str.size() - sent, MSG_NOSIGNAL);
+		if(n < 0 && errno == EINTR) continue;
+		if(n <= 0) break;
+		sent += n;
+	}
+}
+
+// One metric with its help and type lines.
+static void metric(std::ostream &out, const char * name, const char * type, const char * help, double value)
+{
+	out << "# HELP " << name << " " << help << "\n"
+	    << "# TYPE " << name << " " << type << "\n"
+	    << name << " " << value << "\n";
+}
+
+std::string StatsServer::metrics() const
+{
+	const sample_t now = current();
+	// the oldest sample of the window
+	const sample_t &old = samples[nsamples > window ? nsamples % (window+1) : 0];
+	const double dt = (now.time_ns - old.time_ns)*1e-9;
+	const uint64_t event_start = counters.event_start_ns.load(std::memory_order_relaxed);
+	const uint64_t wall_ns = Time::wall_ns();
+
+	std::ostringstream out;
+	out.precision(15);
+	metric(out, "fgamma_events_total", "counter", "Events simulated.", now.events);
+	metric(out, "fgamma_events_expected", "gauge", "Events of the run.", total_events);
+	metric(out, "fgamma_tracks_total", "counter", "Tracks simulated.", now.tracks);
+	metric(out, "fgamma_steps_total", "counter", "Steps simulated.", now.steps);
+	out << "# HELP fgamma_rows_total Rows written to the output.\n"
+	    << "# TYPE fgamma_rows_total counter\n"
+	    << "fgamma_rows_total{table=\"events\"} " << counters.event_rows.load(std::memory_order_relaxed) << "\n"
+	    << "fgamma_rows_total{table=\"particles\"} " << counters.particle_rows.load(std::memory_order_relaxed) << "\n";
+	metric(out, "fgamma_output_bytes_total", "counter", "Bytes written to the output, as of the end of the last event.",
+		counters.output_bytes.load(std::memory_order_relaxed));
+	metric(out, "fgamma_events_per_second", "gauge", "Events per second over the last minute.",
+		dt > 0 ? (now.events - old.events)/dt : 0.0);
+	metric(out, "fgamma_tracks_per_second", "gauge", "Tracks per second over the last minute.",
+		dt > 0 ? (now.tracks - old.tracks)/dt : 0.0);
+	metric(out, "fgamma_steps_per_second", "gauge", "Steps per second over the last minute.",
+		dt > 0 ? (now.steps - old.steps)/dt : 0.0);
+	metric(out, "fgamma_current_event", "gauge", "ID of the event being simulated.",
+		counters.current_event.load(std::memory_order_relaxed));
+	metric(out, "fgamma_event_elapsed_seconds", "gauge", "Time spent on the current event (0 between the events).",
+		(event_start > 0 && wall_ns > event_start) ? (wall_ns - event_start)*1e-9 : 0.0);
+	// the peak is updated by the kernel lazily and can lag behind
+	const size_t rss = MemoryMonitor::rss();
+	metric(out, "fgamma_rss_bytes", "gauge", "Resident set size.", rss);
+	metric(out, "fgamma_peak_rss_bytes", "gauge", "Peak resident set size.", std::max(rss, MemoryMonitor::peakRss()));
+	metric(out, "fgamma_uptime_seconds", "gauge", "Time since the start of the server.", (wall_ns - start_ns)*1e-9);
+	return out.str();
+}
@@ -0,0 +1,88 @@
+#ifndef StatsServer_h
+#define StatsServer_h
+
+#include <string>
+#include <atomic>
+#include <thread>
+#include <cstdint>
+#include <cstddef>
+
+// ---------------------------------------------------------------------
+//                      class StatsServer
+// ---------------------------------------------------------------------
+// Serves live statistics of a running fgamma in the Prometheus text format,
+// over HTTP on a Unix-domain socket or a port of the loopback interface,
+// so that a node's monitoring can find stragglers and slowdowns:
+//
+//   curl --unix-socket run.sock http://localhost/metrics
+//   curl http://127.0.0.1:9100/metrics
+//
+// The counters are updated by the simulation thread with plain atomic
+// stores (there is only one writer, so no read-modify-write is needed) and
+// read by a thread of the server, which also samples them every second for
+// the rates over the last minute. Every request is answered with all of
+// the metrics, whatever its path.
+class StatsServer
+{
+	public:
+		typedef std::atomic<uint64_t> counter_t;
+
+		// updated by the simulation thread only
+		struct counters_t
+		{
+			counter_t events, tracks, steps;
+			counter_t event_rows, particle_rows;
+			counter_t output_bytes;
+			// the event being simulated and when it started (by
+			// Time::wall_ns(), 0 between the events)
+			counter_t current_event, event_start_ns;
+
+			counters_t();
+			static void add(counter_t &counter, uint64_t n = 1)
+			{
+				counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+			}
+			static void set(counter_t &counter, uint64_t value)
+			{
+				counter.store(value, std::memory_order_relaxed);
+			}
+		};
+
+		counters_t counters;
+
+		// address is the path of a Unix-domain socket (a stale socket is
+		// replaced) or a port, optionally as localhost:PORT; throws
+		// std::invalid_argument if it can not be bound
+		StatsServer(const std::string &address, size_t total_events);
+		// stops the server and removes its socket
+		~StatsServer();
+
+	private:
+		// the rates are taken over this many seconds
+		static const size_t window = 60;
+		struct sample_t
+		{
+			uint64_t time_ns, events, tracks, steps;
+		};
+
+		const size_t total_events;
+		const uint64_t start_ns;
+		std::string socket_path;
+		int listener;
+		// written to by the destructor to stop the thread
+		int wakeup[2];
+		// the samples of the last window seconds, as a ring (used by the
+		// thread of the server only)
+		sample_t samples[window+1];
+		size_t nsamples;
+		std::thread thread;
+
+		StatsServer(const StatsServer&);
+		StatsServer& operator=(StatsServer);
+		void run();
+		sample_t current() const;
+		void serve(int client) const;
+		std::string metrics() const;
+};
+
+#endif
@@ -0,0 +1,142 @@
+#include "StreamOutput.hh"
+
+#include <iostream>
+#include <stdexcept>
+#include <cstdio>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+
+using namespace std;
+
+StreamOutput::StreamOutput(const std::string &path_)
+: fd(-1), path(path_), header_written(false), broken_(false), ntables(0), nevents(0), nbytes(0)
+{
+	if(path == "-") {
+		fd = reserveStdout();
+	} else {
+		fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	}
+	if(fd < 0) {
+		throw invalid_argument("StreamOutput: unable to open "+path);
+	}
+	buffer.reserve(buffer_size);
+
+	header << "fgamma-stream 1\n";
+	header << "byteorder " << (H5Tget_order(H5T_NATIVE_INT) == H5T_ORDER_LE ? "little" : "big") << "\n";
+}
+
+StreamOutput::~StreamOutput()
+{
+	flush();
+	close(fd);
+}
+
+int StreamOutput::reserveStdout()
+{
+	static int fd = -1;
+	if(fd < 0) {
+		cout.flush();
+		fflush(stdout);
+		fd = dup(STDOUT_FILENO);
+		dup2(STDERR_FILENO, STDOUT_FILENO);
+	}
+	return fd;
+}
+
+void StreamOutput::attribute(const std::string &name, const std::string &value)
+{
+	if(header_written) {
+		cerr << "WARNING: StreamOutput: attribute " << name << " set after the header was written" << endl;
+		return;
+	}
+	header << "attribute " << name << " " << value << "\n";
+}
+
+void StreamOutput::writeHeader()
+{
+	header << "end\n";
+	const string str = header.str();
+	buffer.append(str);
+	nbytes += str.size();
+	header_written = true;
+}
+
+void StreamOutput::record(uint32_t tag, const void * data, size_t size)
+{
+	if(broken_) return;
+	if(!header_written) {
+		writeHeader();
+	}
+	buffer.append(reinterpret_cast<const char*>(&tag), sizeof(tag));
+	buffer.append(reinterpret_cast<const char*>(data), size);
+	nbytes += sizeof(tag) + size;
+	if(buffer.size() >= buffer_size) {
+		writeBuffer();
+	}
+}
+
+void StreamOutput::endOfEvent()
+{
+	nevents++;
+	const uint32_t marker = 0;
+	record(marker, &nevents, sizeof(nevents));
+}
+
+// A stream without records still gets its header.
+void StreamOutput::flush()
+{
+	if(broken_) return;
+	if(!header_written) {
+		writeHeader();
+	}
+	writeBuffer();
+}
+
+// A pipe or FIFO whose reader went away makes write() fail with EPIPE and
+// raise SIGPIPE, which would kill the run: as in MetricsLog, the signal is
+// blocked around the write and, if it was raised, taken before it is
+// unblocked.
+void StreamOutput::writeBuffer()
+{
+	sigset_t sigpipe, mask;
+	sigemptyset(&sigpipe);
+	sigaddset(&sigpipe, SIGPIPE);
+	pthread_sigmask(SIG_BLOCK, &sigpipe, &mask);
+	size_t written = 0;
+	int error = 0;
+	while(written < buffer.size()) {
+		const ssize_t n = ::write(fd, buffer.data() + written, buffer.size() - written);
+		if(n < 0 && errno == EINTR) continue;
+		if(n < 0) {
+			error = errno;
+			break;
+		}
+		written += n;
+	}
+	if(error == EPIPE && !sigismember(&mask, SIGPIPE)) {
+		const timespec zero = {0, 0};
+		while(sigtimedwait(&sigpipe, nullptr, &zero) < 0 && errno == EINTR);
+	}
+	pthread_sigmask(SIG_SETMASK, &mask, nullptr);
+	buffer.clear();
+
+	if(error != 0) {
+		broken_ = true;
+		cerr << "ERROR: StreamOutput: unable to write to " << path << " (" << strerror(error)
+		     << "), the rest of the stream is dropped" << endl;
+	}
+}
+
+const char * StreamOutput::fieldType(hid_t type)
+{
+	switch(H5Tget_class(type)) {
+		case H5T_INTEGER: return H5Tget_sign(type) == H5T_SGN_NONE ? "uint" : "int";
+		case H5T_FLOAT: return "float";
+		case H5T_STRING: return "string";
+		default: return "unknown";
+	}
+}
@@ -0,0 +1,117 @@
+#ifndef StreamOutput_h
+#define StreamOutput_h
+
+#include "HDFTable.hh"
+
+#include <cstdint>
+#include <string>
+#include <sstream>
+
+// ---------------------------------------------------------------------
+//                      class StreamOutput
+// ---------------------------------------------------------------------
+// Writes tables as a stream of fixed-layout binary records to a file,
+// a FIFO or stdout, for consumers that process the output on the fly.
+//
+// The stream starts with a text header, which lists the attributes and
+// the layout of every table, and ends with a line containing `end`:
+//
+//   fgamma-stream 1
+//   byteorder little
+//   attribute <name> <value>
+//   table <tag> <name> <record size> <number of fields>
+//   field <name> <offset> <size> <int|uint|float|string>
+//   end
+//
+// It is followed by records, each being a uint32 tag and the raw row
+// struct of the table with that tag. A record with tag 0 is a marker,
+// written at the end of every event; its payload is a uint64 with the
+// number of events written so far.
+//
+// The records are buffered and written when the buffer is full and on
+// flush(). If they can not be written, e.g. because the reader of a pipe
+// or FIFO has gone away, this is reported once and the stream is broken:
+// the rest of the records are dropped.
+class StreamOutput
+{
+	int fd;
+	const std::string path;
+	std::string buffer;
+	std::ostringstream header;
+	bool header_written, broken_;
+	uint32_t ntables;
+	uint64_t nevents, nbytes;
+
+	static const size_t buffer_size = 1024*1024;
+
+	public:
+		// path can be "-" for stdout (see reserveStdout())
+		StreamOutput(const std::string &path);
+		~StreamOutput();
+
+		// Moves stdout to a new file descriptor, to be used for the records,
+		// and redirects the normal stdout to stderr, so that the log would
+		// not mix with the records. Should be called before anything is
+		// printed; returns the new descriptor on every call.
+		static int reserveStdout();
+
+		void attribute(const std::string &name, const std::string &value);
+		template<class Row> uint32_t addTable(const std::string &name);
+
+		void record(uint32_t tag, const void * data, size_t size);
+		// writes the marker of the event
+		void endOfEvent();
+		void flush();
+		// the bytes written so far (some may still be buffered)
+		uint64_t bytes() const {return nbytes;}
+		// whether the records can no longer be written
+		bool broken() const {return broken_;}
+
+	private:
+		StreamOutput(const StreamOutput&);
+		StreamOutput& operator=(StreamOutput);
+		void writeHeader();
+		void writeBuffer();
+		static const char * fieldType(hid_t type);
+};
+
+template<class Row>
+uint32_t StreamOutput::addTable(const std::string &name)
+{
+	typedef HDFTableSchema<Row> schema;
+	uint32_t tag = ++ntables;
+	header << "table " << tag << " " << name << " " << sizeof(Row) << " " << schema::nfields << "\n";
+	for(size_t i=0; i<schema::nfields; i++) {
+		hid_t type = schema::fields[i].type();
+		header << "field " << schema::fields[i].name
+		       << " " << schema::fields[i].offset
+		       << " " << schema::fields[i].size
+		       << " " << fieldType(type) << "\n";
+		H5Tclose(type);
+	}
+	return tag;
+}
+
+// ---------------------------------------------------------------------
+//                      class StreamTable
+// ---------------------------------------------------------------------
+// A table whose rows are written as records into a StreamOutput.
+template<class Row>
+class StreamTable : public TableWriter<Row>
+{
+	StreamOutput &out;
+	const uint32_t tag;
+	Row current;
+	size_t totalrows;
+
+	public:
+		StreamTable(StreamOutput &output, const std::string &name)
+		: out(output), tag(output.addTable<Row>(name)), totalrows(0) {}
+
+		Row & row() override {return current;}
+		void write() override {out.record(tag, &current, sizeof(Row)); totalrows++;}
+		void flush() override {}
+		size_t nrows() const override {return totalrows;}
+};
+
+#endif
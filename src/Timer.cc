@@ -21,6 +21,11 @@ Time Time::now()
 	return p;
 }
 
+double Time::seconds(long ticks)
+{
+	return double(ticks)/sc_clk_tck;
+}
+
 Time operator- (const Time &t1, const Time &t2)
 {
 	Time t;
@@ -32,18 +37,49 @@ Time operator- (const Time &t1, const Time &t2)
 
 std::ostream& operator<< (std::ostream &out, const Time &p)
 {
-	out << double(p.utime)/Time::sc_clk_tck << ' '
-	    << double(p.stime)/Time::sc_clk_tck << ' '
-	    << double(p.clock)/Time::sc_clk_tck;
+	out << Time::seconds(p.utime) << ' '
+	    << Time::seconds(p.stime) << ' '
+	    << Time::seconds(p.clock);
 	return out;
 }
 
 // ---------------------------------------------------------------------
 //                            class Timer
 // ---------------------------------------------------------------------
-Timer::Timer() : start(Time::now()) {}
+Timer::Timer() : start(Time::now()), start_wall_ns(Time::wall_ns()), start_cpu_ns(Time::thread_ns()) {}
 
 Time Timer::elapsed()
 {
 	return Time::now() - start;
 }
+
+// ---------------------------------------------------------------------
+//                         class TimerSection
+// ---------------------------------------------------------------------
+TimerSection::mode_t TimerSection::mode_ = TimerSection::WALL;
+
+// Sections are registered from static constructors in any translation
+// unit, so the registry is created on first use.
+std::vector<TimerSection*> & TimerSection::registry()
+{
+	static std::vector<TimerSection*> sections;
+	return sections;
+}
+
+TimerSection::TimerSection(const char * name_)
+: name(name_), count_(0), wall_(0), cpu_(0)
+{
+	registry().push_back(this);
+}
+
+void TimerSection::print(std::ostream &out)
+{
+	for(const TimerSection * section : registry()) {
+		if(section->count() == 0) continue;
+		out << "% section " << section->count()
+		    << " " << section->wallNs()*1e-9
+		    << " " << section->cpuNs()*1e-9
+		    << " " << section->name
+		    << std::endl;
+	}
+}
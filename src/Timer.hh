@@ -2,12 +2,23 @@
 #define Timer_h
 
 #include <ostream>
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <ctime>
 
+// Process times from times(), in clock ticks (sc_clk_tck per second).
 struct Time {
 	static const long sc_clk_tck;
 	long utime, stime, clock;
 
 	static Time now();
+	static double seconds(long ticks);
+
+	// monotonic wall time and the CPU time of the calling thread, in
+	// nanoseconds (from arbitrary origins, so only differences matter)
+	static uint64_t wall_ns();
+	static uint64_t thread_ns();
 };
 Time operator- (const Time &t1, const Time &t2);
 std::ostream& operator<< (std::ostream &out, const Time &p);
@@ -17,6 +28,125 @@ class Timer {
 		const Time start;
 		Timer();
 		Time elapsed();
+
+		// the wall time and the CPU time of the calling thread since the
+		// start, in seconds, measured as by TimerSection
+		double wall() const {return (Time::wall_ns() - start_wall_ns)*1e-9;}
+		double cpu() const {return (Time::thread_ns() - start_cpu_ns)*1e-9;}
+
+	private:
+		const uint64_t start_wall_ns, start_cpu_ns;
+};
+
+inline uint64_t Time::wall_ns()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return uint64_t(ts.tv_sec)*1000000000u + ts.tv_nsec;
+}
+
+inline uint64_t Time::thread_ns()
+{
+	timespec ts;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+	return uint64_t(ts.tv_sec)*1000000000u + ts.tv_nsec;
+}
+
+// ---------------------------------------------------------------------
+//                      class TimerSection
+// ---------------------------------------------------------------------
+// A named counter of the time spent in a section of code, usually timed
+// with a ScopedTimer:
+//
+//   static TimerSection section("hdf write");
+//   ...
+//   {
+//       ScopedTimer timer(section);
+//       ...
+//   }
+//
+// Sections are meant to be static objects, which register themselves in
+// sections() and accumulate the times of all the threads. What is
+// measured depends on the global mode: nothing (OFF), the wall time (WALL,
+// the default, cheap enough to be left on) or also the CPU time of the
+// thread (CPU, which costs a system call per measurement). The mode should
+// be set before any section is timed.
+class TimerSection
+{
+	public:
+		enum mode_t {OFF, WALL, CPU};
+		struct start_t
+		{
+			uint64_t wall, cpu;
+		};
+
+		const char * const name;
+
+		explicit TimerSection(const char * name);
+
+		static void setMode(mode_t mode) {mode_ = mode;}
+		static mode_t mode() {return mode_;}
+
+		// the start of a measurement, and its end, which adds the time since
+		// the start to the section
+		static start_t start();
+		void stop(const start_t &start);
+
+		uint64_t count() const {return count_;}
+		uint64_t wallNs() const {return wall_;}
+		uint64_t cpuNs() const {return cpu_;}
+
+		static const std::vector<TimerSection*> & sections() {return registry();}
+		// prints a `% section COUNT WALL CPU NAME` line (times in seconds)
+		// for every section that has been timed
+		static void print(std::ostream &out);
+
+	private:
+		static mode_t mode_;
+		std::atomic<uint64_t> count_, wall_, cpu_;
+
+		TimerSection(const TimerSection&);
+		TimerSection& operator=(TimerSection);
+		static std::vector<TimerSection*> & registry();
+};
+
+inline TimerSection::start_t TimerSection::start()
+{
+	start_t s = {0, 0};
+	if(mode_ != OFF) {
+		s.wall = Time::wall_ns();
+		if(mode_ == CPU) {
+			s.cpu = Time::thread_ns();
+		}
+	}
+	return s;
+}
+
+inline void TimerSection::stop(const start_t &start)
+{
+	if(mode_ == OFF) return;
+	count_.fetch_add(1, std::memory_order_relaxed);
+	wall_.fetch_add(Time::wall_ns() - start.wall, std::memory_order_relaxed);
+	if(mode_ == CPU) {
+		cpu_.fetch_add(Time::thread_ns() - start.cpu, std::memory_order_relaxed);
+	}
+}
+
+// ---------------------------------------------------------------------
+//                      class ScopedTimer
+// ---------------------------------------------------------------------
+// Adds the time until it goes out of scope to a TimerSection.
+class ScopedTimer
+{
+	TimerSection &section;
+	const TimerSection::start_t begin;
+
+	ScopedTimer(const ScopedTimer&);
+	ScopedTimer& operator=(ScopedTimer);
+
+	public:
+		explicit ScopedTimer(TimerSection &section_) : section(section_), begin(TimerSection::start()) {}
+		~ScopedTimer() {section.stop(begin);}
 };
 
 #endif
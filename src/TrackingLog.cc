@@ -4,75 +4,185 @@
 #include <G4Track.hh>
 #include <G4Step.hh>
 
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+
 using namespace std;
 using namespace CLHEP;
 
+// ---------------------------------------------------------------------
+//                   struct TrackingLog::selection_t
+// ---------------------------------------------------------------------
+TrackingLog::selection_t TrackingLog::selection_t::parse(const std::string &rules)
+{
+	selection_t selection;
+	istringstream ss(rules);
+	string rule;
+	while(getline(ss, rule, ',')) {
+		const size_t eq = rule.find('=');
+		const string key = rule.substr(0, eq);
+		const string value = (eq == string::npos) ? "" : rule.substr(eq+1);
+		size_t end = 0;
+		try {
+			if(key == "every") {
+				selection.every = stoul(value, &end);
+			} else if(key == "event") {
+				selection.events.insert(stoull(value, &end));
+			} else if(key == "ke") {
+				selection.min_KE = stod(value, &end)*GeV;
+			} else if(key == "pid") {
+				selection.pids.push_back(stoi(value, &end));
+			} else if(key == "generations") {
+				selection.generations = stoi(value, &end);
+			}
+		} catch(const logic_error &) {
+			end = 0;
+		}
+		if(end == 0 || end != value.size()) {
+			throw invalid_argument("bad track selection rule `"+rule+"`");
+		}
+	}
+	return selection;
+}
+
+bool TrackingLog::selection_t::event(hsize_t eventid) const
+{
+	if(every == 0 && events.empty()) {
+		return true;
+	}
+	return (every > 0 && eventid % every == 0) || events.count(eventid) > 0;
+}
+
+bool TrackingLog::selection_t::track(double KE, int pid, int generation) const
+{
+	return KE >= min_KE
+	    && (pids.empty() || find(pids.begin(), pids.end(), pid) != pids.end())
+	    && (generations == 0 || generation <= generations);
+}
+
+// ---------------------------------------------------------------------
+//                         class TrackingLog
+// ---------------------------------------------------------------------
 TrackingLog::TrackingLog()
-: enabled(false)
+: out(nullptr), tracks(nullptr), steps(nullptr), secondaries(nullptr), eventid(0),
+  log_event(false), log_track(false)
 {}
 
 TrackingLog::~TrackingLog()
 {
-	trf.close();
+	delete tracks;
+	delete steps;
+	delete secondaries;
+	delete out;
+}
+
+void TrackingLog::enable(const std::string &path, const selection_t &selection_)
+{
+	selection = selection_;
+	out = new StreamOutput(path);
+	out->attribute("log", "tracks");
+	tracks = new StreamTable<tracklog_track_t>(*out, "tracks");
+	steps = new StreamTable<tracklog_step_t>(*out, "steps");
+	secondaries = new StreamTable<tracklog_secondary_t>(*out, "secondaries");
 }
 
-void TrackingLog::enable(const std::string &filename)
+void TrackingLog::beginEvent(hsize_t eventid_)
 {
-	enabled = true;
-	trf.open(filename.c_str());
+	if(out == nullptr) return;
+	eventid = eventid_;
+	log_event = selection.event(eventid);
+	log_track = false;
+	generations.clear();
+}
+
+void TrackingLog::endEvent()
+{
+	if(out == nullptr) return;
+	out->endOfEvent();
+	out->flush();
+	log_event = false;
+}
+
+// The generations are only kept track of with a generations rule.
+int TrackingLog::trackGeneration(const G4Track * track) const
+{
+	if(selection.generations == 0 || track->GetParentID() == 0) {
+		return 1;
+	}
+	std::unordered_map<int, int>::const_iterator it = generations.find(track->GetParentID());
+	return it != generations.end() ? it->second+1 : 1;
+}
+
+void TrackingLog::track(const G4Track * track, bool end, bool on_boundary)
+{
+	tracklog_track_t &row = tracks->row();
+	row.eventid = eventid;
+	row.trackid = track->GetTrackID();
+	row.parentid = track->GetParentID();
+	row.pid = track->GetParticleDefinition()->GetPDGEncoding();
+	row.end = end;
+	row.boundary = on_boundary;
+	tracks->write();
 }
 
 void TrackingLog::preTracking(const G4Track * track)
 {
-	if(!enabled) return;
-	trf << "PreTrack " << "[" << track << " " << track->GetTrackID() << "]" << endl;
+	if(!log_event) return;
+	const int generation = trackGeneration(track);
+	if(selection.generations > 0) {
+		generations[track->GetTrackID()] = generation;
+	}
+	log_track = selection.track(track->GetKineticEnergy(), track->GetParticleDefinition()->GetPDGEncoding(), generation);
+	if(!log_track) return;
+	this->track(track, false, false);
 }
 
 void TrackingLog::postTracking(const G4Track * track, bool on_boundary)
 {
-	if(!enabled) return;
-	trf << "PostTrack"
-	    << "[" << track << " " << track->GetTrackID() << "]"
-	    << " step=" << track->GetStep()
-	    << (on_boundary ? " [BOUNDARY]" : "")
-	    << endl;
-	trf.flush();
+	if(!log_event || !log_track) return;
+	this->track(track, true, on_boundary);
+}
+
+void TrackingLog::secondary(const G4Track * track, bool classified, bool removed)
+{
+	tracklog_secondary_t &row = secondaries->row();
+	row.eventid = eventid;
+	row.trackid = track->GetTrackID();
+	row.parentid = track->GetParentID();
+	row.pid = track->GetParticleDefinition()->GetPDGEncoding();
+	string_to_cstr(track->GetParticleDefinition()->GetParticleName(), row.name, sizeof(row.name));
+	row.KE = track->GetKineticEnergy()/MeV;
+	row.r = track->GetPosition().mag()/km;
+	string_to_cstr(
+		track->GetCreatorProcess()==nullptr ? "[NO CREATOR]" : track->GetCreatorProcess()->GetProcessName(),
+		row.process, sizeof(row.process)
+	);
+	row.classified = classified;
+	row.removed = removed;
+	secondaries->write();
 }
 
 void TrackingLog::classification(const G4Track * track)
 {
-	if(!enabled) return;
-	trf << "CLASSIFY: " << track->GetParentID()
-	    << "," << track->GetTrackID()
-	    << "," << track->GetParticleDefinition()->GetPDGEncoding()
-	    << "," << track->GetParticleDefinition()->GetParticleName()
-	    << "," << track->GetKineticEnergy()/MeV
-	    << "," << track->GetPosition().mag()/km
-	    << "," << (track->GetCreatorProcess()==nullptr ? "[NO CREATOR]" : track->GetCreatorProcess()->GetProcessName())
-	    << endl;
+	if(!log_event) return;
+	if(!selection.track(track->GetKineticEnergy(), track->GetParticleDefinition()->GetPDGEncoding(), trackGeneration(track))) return;
+	secondary(track, true, false);
 }
 
 void TrackingLog::stepping(const G4Step * step)
 {
-	if(!enabled) return;
-	G4TrackVector &trv = *const_cast<G4Step*>(step)->GetfSecondary();
-	trf << " |-- Step[" << step << "]"
-	    << "(" << step->GetTrack()->GetTrackID() << ") "
-	    << step->GetTrack()->GetCurrentStepNumber()
-	    << " secs=" << trv.size()
-	    << " (&trv=" << &trv << ")"
-	    << endl;
+	if(!log_event || !log_track) return;
+	tracklog_step_t &row = steps->row();
+	row.eventid = eventid;
+	row.trackid = step->GetTrack()->GetTrackID();
+	row.step = step->GetTrack()->GetCurrentStepNumber();
+	row.secondaries = const_cast<G4Step*>(step)->GetfSecondary()->size();
+	steps->write();
 }
 
 void TrackingLog::stepSecondary(const G4Track * track, bool removed)
 {
-	if(!enabled) return;
-	trf << " |    - " << track->GetTrackID()
-	    << "," << track->GetParticleDefinition()->GetPDGEncoding()
-	    << "," << track->GetParticleDefinition()->GetParticleName()
-	    << "," << track->GetKineticEnergy()/MeV
-	    << "," << track->GetPosition().mag()/km
-	    << "," << (track->GetCreatorProcess()==nullptr ? "[NO CREATOR]" : track->GetCreatorProcess()->GetProcessName())
-	    << (removed ? " [REMOVED]" : "")
-	    << endl;
+	if(!log_event || !log_track) return;
+	secondary(track, false, removed);
 }
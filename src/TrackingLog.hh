@@ -1,20 +1,69 @@
 #ifndef TrackingLog_h
 #define TrackingLog_h
 
+#include "StreamOutput.hh"
+#include "OutputTables.hh"
+
 #include <string>
-#include <fstream>
+#include <vector>
+#include <set>
+#include <unordered_map>
 
 class G4Track;
 class G4Step;
 
+// ---------------------------------------------------------------------
+//                      class TrackingLog
+// ---------------------------------------------------------------------
+// Logs the tracks, their steps and the secondaries they make as a binary
+// record stream (see StreamOutput) with the tables `tracks`
+// (tracklog_track_t), `steps` (tracklog_step_t) and `secondaries`
+// (tracklog_secondary_t), in the order in which they happen, each with the
+// ID of its event. The records are buffered and flushed at the end of
+// every event, so that a reader of the log is at most an event behind;
+// tools/tracklog prints them as text or CSV.
+//
+// The log can be limited to some events and tracks by a selection_t, which
+// is checked before anything is written.
 class TrackingLog
 {
 	public:
+		// Rules selecting what is logged, parsed from a comma-separated list
+		// of them (e.g. "every=100,event=7,pid=22,pid=11,ke=0.01"):
+		//   every=N        the events whose ID is a multiple of N
+		//   event=ID       the event with this ID
+		//   ke=GEV         the tracks starting with a kinetic energy of at
+		//                  least GEV GeV
+		//   pid=PID        the tracks of this species
+		//   generations=K  the tracks of the first K generations (the
+		//                  primaries being the first)
+		// An event is logged if it matches any of the event rules (or there
+		// are none), a track of it if it matches all of the track rules, with
+		// the pid rules being alternatives. The steps and the secondaries of a
+		// track are logged with it.
+		struct selection_t
+		{
+			size_t every;
+			std::set<hsize_t> events;
+			double min_KE;
+			std::vector<int> pids;
+			int generations;
+
+			selection_t() : every(0), min_KE(0.0), generations(0) {}
+			// throws std::invalid_argument on a bad rule
+			static selection_t parse(const std::string &rules);
+			bool event(hsize_t eventid) const;
+			bool track(double KE, int pid, int generation) const;
+		};
+
 		TrackingLog();
 		~TrackingLog();
-		void enable(const std::string &filename);
+		// path can be a FIFO, e.g. of a compressor, or "-" for stdout
+		void enable(const std::string &path, const selection_t &selection = selection_t());
 
 		// logging functions
+		void beginEvent(hsize_t eventid);
+		void endEvent();
 		void preTracking(const G4Track * track);
 		void postTracking(const G4Track * track, bool on_boundary);
 		void classification(const G4Track * track);
@@ -22,8 +71,24 @@ class TrackingLog
 		void stepSecondary(const G4Track * track, bool removed);
 
 	private:
-		bool enabled;
-		std::ofstream trf;
+		// null unless enabled
+		StreamOutput * out;
+		StreamTable<tracklog_track_t> * tracks;
+		StreamTable<tracklog_step_t> * steps;
+		StreamTable<tracklog_secondary_t> * secondaries;
+		hsize_t eventid;
+
+		selection_t selection;
+		// whether the current event and track are logged
+		bool log_event, log_track;
+		// the generation of every track of the event, with a generations rule
+		std::unordered_map<int, int> generations;
+
+		TrackingLog(const TrackingLog&);
+		TrackingLog& operator=(TrackingLog);
+		void track(const G4Track * track, bool end, bool on_boundary);
+		void secondary(const G4Track * track, bool classified, bool removed);
+		int trackGeneration(const G4Track * track) const;
 };
 
 #endif
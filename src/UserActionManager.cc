@@ -11,10 +11,16 @@
 #include <G4VProcess.hh>
 #include <G4Event.hh>
 #include <G4Track.hh>
+#include <G4VPhysicalVolume.hh>
+#include <G4EventManager.hh>
+#include <G4StackManager.hh>
+#include <G4RunManager.hh>
 
-using namespace CLHEP;
+#include <cstdio>
+#include <sstream>
+#include <iomanip>
 
-#define STRUCT_SIZEOF(type, member) sizeof(((type *)0)->member)
+using namespace CLHEP;
 
 // ---------------------------------------------------------------------
 //                  Geant4 user action classes
@@ -66,39 +72,139 @@ class UserTrackInformation : public G4VUserTrackInformation
 		}
 };
 
+// The sections of fgamma, timed as set by TimerSection::setMode(). They
+// overlap: e.g. writing a particle happens in the tracking action.
+static TimerSection event_section("event");
+static TimerSection event_action_section("event action");
+static TimerSection stepping_section("stepping action");
+static TimerSection tracking_section("tracking action");
+static TimerSection stacking_section("stacking action");
+static TimerSection write_section("output write");
+
+// The layer of a volume (see EventProfile).
+static int volume_layer(const G4VPhysicalVolume * volume)
+{
+	return volume != nullptr ? volume->GetCopyNo() : 0;
+}
+
 void UAIUserEventAction::BeginOfEventAction(const G4Event * ev)
 {
+	if(pUAI.profile != nullptr) {
+		pUAI.profile->beginEvent();
+	}
+	if(pUAI.memory != nullptr) {
+		pUAI.memory->beginEvent();
+	}
+	if(pUAI.metrics != nullptr) {
+		pUAI.metrics->beginEvent(pUAI.summary.totals());
+	}
+	if(pUAI.stats != nullptr) {
+		StatsServer::counters_t &counters = pUAI.stats->counters;
+		counters.set(counters.current_event, ev->GetEventID());
+		counters.set(counters.event_start_ns, Time::wall_ns());
+	}
+	pUAI.event_start = TimerSection::start();
+	ScopedTimer section(event_action_section);
+	EventProfile::action_t timing(pUAI.profile);
 	UserEventInformation & eventinfo = *static_cast<UserEventInformation*>(ev->GetUserInformation());
 
 	G4cout << "% event " << ev->GetEventID()
-	       << "    " << pUAI.timer.elapsed()
+	       << "    " << pUAI.timer.wall() << " " << pUAI.timer.cpu()
 	       << "    " << eventinfo
 	       << G4endl;
 
-	pUAI.event.id = ev->GetEventID();
-	pUAI.event.first = pUAI.hdf_particles.nrows();
-	pUAI.event.size = 0;
-	pUAI.event.pid = eventinfo.pid;
-	pUAI.event.E = eventinfo.E/GeV;
-	pUAI.event.KE = eventinfo.KE/GeV;
-	pUAI.event.incidence = eventinfo.incidence;
-	pUAI.event.discarded = 0;
+	if(pUAI.events == nullptr) {
+		pUAI.openPart(ev->GetEventID());
+	}
+	pUAI.tracklog.beginEvent(ev->GetEventID());
+
+	event_t &event = pUAI.events->row();
+	event.id = ev->GetEventID() - pUAI.part_first_event;
+	event.first = pUAI.particles->nrows();
+	event.size = 0;
+	event.pid = eventinfo.pid;
+	event.E = eventinfo.E/GeV;
+	event.KE = eventinfo.KE/GeV;
+	event.incidence = eventinfo.incidence;
+	event.discarded = 0;
 }
 
-void UAIUserEventAction::EndOfEventAction(const G4Event*)
+// The profile of the event includes the writing of the event, but not the
+// closing of a full part.
+void UAIUserEventAction::EndOfEventAction(const G4Event * ev)
 {
-	pUAI.hdf_events.write();
+	const event_t event = pUAI.events->row();
+	const hsize_t eventid = event.id;
+	{
+		ScopedTimer section(event_action_section);
+		EventProfile::action_t timing(pUAI.profile);
+		{
+			ScopedTimer write(write_section);
+			pUAI.events->write();
+		}
+		pUAI.summary.event();
+		pUAI.tracklog.endEvent();
+		if(pUAI.stream != nullptr) {
+			pUAI.stream->out.endOfEvent();
+		}
+
+		if(pUAI.swmr || pUAI.stream != nullptr) {
+			const UserActionManager::OutputOptions &options = pUAI.options;
+			pUAI.unflushed_events++;
+			bool flush_now = (options.flush_events > 0 && pUAI.unflushed_events >= options.flush_events);
+			if(!flush_now && options.flush_time > 0) {
+				flush_now = (pUAI.timer.wall() - pUAI.last_flush >= options.flush_time);
+			}
+			if(flush_now) {
+				pUAI.flush();
+			}
+		}
+		// e.g. the reader of the stream has exited, so the events would be lost
+		if(pUAI.stream != nullptr && pUAI.stream->out.broken()) {
+			G4cerr << "ERROR: the output stream can not be written, stopping after this event" << G4endl;
+			G4RunManager::GetRunManager()->AbortRun(true);
+		}
+	}
+	if(pUAI.profile != nullptr) {
+		pUAI.profile->endEvent(eventid);
+	}
+	if(pUAI.memory != nullptr && pUAI.memory->endEvent(eventid)) {
+		pUAI.memoryLimitExceeded();
+	}
+	if(pUAI.metrics != nullptr) {
+		pUAI.metrics->endEvent(ev->GetEventID(), pUAI.summary.totals(), event.size, event.discarded);
+	}
+	if(pUAI.stats != nullptr) {
+		StatsServer::counters_t &counters = pUAI.stats->counters;
+		counters.add(counters.events);
+		counters.add(counters.event_rows);
+		counters.set(counters.output_bytes, pUAI.outputBytes());
+		counters.set(counters.event_start_ns, 0);
+	}
+
+	if(pUAI.hdf != nullptr && pUAI.partFull()) {
+		pUAI.closePart();
+	}
+	event_section.stop(pUAI.event_start);
 }
 
 G4ClassificationOfNewTrack UAIUserStackingAction::ClassifyNewTrack(const G4Track* tr)
 {
+	ScopedTimer section(stacking_section);
+	EventProfile::action_t timing(pUAI.profile);
 	pUAI.tracklog.classification(tr);
 	return fUrgent;
 }
 
 void UAIUserSteppingAction::UserSteppingAction(const G4Step * step)
 {
+	ScopedTimer section(stepping_section);
+	EventProfile::action_t timing(pUAI.profile);
 	pUAI.tracklog.stepping(step);
+	pUAI.summary.step();
+	if(pUAI.stats != nullptr) {
+		pUAI.stats->counters.add(pUAI.stats->counters.steps);
+	}
 	G4TrackVector &trv = *const_cast<G4Step*>(step)->GetfSecondary();
 	trv.erase(
 		remove_if(
@@ -107,7 +213,14 @@ void UAIUserSteppingAction::UserSteppingAction(const G4Step * step)
 			[this](G4Track * track) {
 				bool remove = (track->GetKineticEnergy()<pUAI.cutoff);
 				pUAI.tracklog.stepSecondary(track, remove);
+				pUAI.summary.secondary(
+					pUAI.creatorProcess(track),
+					track->GetParticleDefinition()->GetPDGEncoding(),
+					track->GetKineticEnergy()/GeV,
+					remove
+				);
 				if(remove) {
+					pUAI.summary.cut();
 					delete track;
 					return true;
 				}
@@ -116,17 +229,44 @@ void UAIUserSteppingAction::UserSteppingAction(const G4Step * step)
 		),
 		trv.end()
 	);
+	if(pUAI.profile != nullptr) {
+		pUAI.profile->step(
+			step->GetTrack()->GetParticleDefinition()->GetPDGEncoding(),
+			volume_layer(step->GetPreStepPoint()->GetPhysicalVolume()),
+			trv.size() - pUAI.track_approved_secondaries
+		);
+	}
 	pUAI.track_approved_secondaries = trv.size();
 }
 
 void UAIUserTrackingAction::PreUserTrackingAction(const G4Track* tr)
 {
+	ScopedTimer section(tracking_section);
+	EventProfile::action_t timing(pUAI.profile);
 	pUAI.tracklog.preTracking(tr);
+	pUAI.summary.track(tr->GetParticleDefinition()->GetPDGEncoding());
+	if(pUAI.stats != nullptr) {
+		pUAI.stats->counters.add(pUAI.stats->counters.tracks);
+	}
+	if(pUAI.profile != nullptr) {
+		pUAI.profile->track(tr->GetParticleDefinition()->GetPDGEncoding(), volume_layer(tr->GetVolume()));
+	}
+	if(pUAI.memory != nullptr) {
+		const G4StackManager * stack = G4EventManager::GetEventManager()->GetStackManager();
+		if(pUAI.memory->track(stack->GetNTotalTrack())) {
+			pUAI.memoryLimitExceeded();
+		}
+	}
 	pUAI.track_approved_secondaries = 0;
 }
 
 void UAIUserTrackingAction::PostUserTrackingAction(const G4Track* tr)
 {
+	ScopedTimer section(tracking_section);
+	EventProfile::action_t timing(pUAI.profile);
+	if(pUAI.memory != nullptr) {
+		pUAI.memory->secondaries(pUAI.track_approved_secondaries);
+	}
 	bool on_boundary = (tr->GetStep()->GetPostStepPoint()->GetStepStatus() == fWorldBoundary);
 	pUAI.tracklog.postTracking(tr, on_boundary);
 
@@ -143,8 +283,9 @@ void UAIUserTrackingAction::PostUserTrackingAction(const G4Track* tr)
 	const G4ThreeVector& pos = tr->GetStep()->GetPostStepPoint()->GetPosition();
 	const G4ThreeVector& pdir = tr->GetMomentumDirection();
 
-	UserActionManager::CommonVariables::particle_t &p = pUAI.particle;
-	p.eventid = pUAI.event.id;
+	event_t &event = pUAI.events->row();
+	particle_t &p = pUAI.particles->row();
+	p.eventid = event.id;
 	p.pid = pid;
 	string_to_cstr(name, p.name, sizeof(p.name));
 	p.m = mass/GeV;
@@ -159,15 +300,18 @@ void UAIUserTrackingAction::PostUserTrackingAction(const G4Track* tr)
 
 	if(!isnan(pUAI.acceptradius)) {
 		double R = sqrt(pos.x()*pos.x() + pos.y()*pos.y() + pos.z()*pos.z());
-		if(fabs(R-pUAI.acceptradius) < 0.1*km) {
-			pUAI.hdf_particles.write();
-			pUAI.event.size++;
-		} else {
-			pUAI.event.discarded++;
+		if(fabs(R-pUAI.acceptradius) >= 0.1*km) {
+			pUAI.summary.boundary(pid, p.boundary.KE, false);
+			event.discarded++;
+			return;
 		}
-	} else {
-		pUAI.hdf_particles.write();
-		pUAI.event.size++;
+	}
+	pUAI.summary.boundary(pid, p.boundary.KE, true);
+
+	// with histogram output, the events keep pointing at the empty
+	// particles table
+	if(pUAI.storeParticle(p)) {
+		event.size++;
 	}
 }
 
@@ -175,15 +319,14 @@ void UAIUserTrackingAction::PostUserTrackingAction(const G4Track* tr)
 //                  UserActionManager implementation
 // ---------------------------------------------------------------------
 
-UserActionManager::UserActionManager(Timer& timer, bool store_tracks, double cutoff, G4String prefix, double acceptradius)
-: pUAI(prefix+".h5", timer)
+UserActionManager::UserActionManager(Timer& timer, bool store_tracks, double cutoff, G4String prefix, double acceptradius, const OutputOptions &options)
+: pUAI(prefix, timer, options)
 {
-	pUAI.event.id = -1;
 	pUAI.cutoff = cutoff;
 	pUAI.acceptradius = acceptradius;
 
 	if(store_tracks) {
-		pUAI.tracklog.enable(prefix+".tracks.csv");
+		pUAI.tracklog.enable(options.tracks.empty() ? prefix+".tracks.bin" : options.tracks, options.track_selection);
 	}
 
 	userSteppingAction = new UAIUserSteppingAction(pUAI);
@@ -194,118 +337,344 @@ UserActionManager::UserActionManager(Timer& timer, bool store_tracks, double cut
 	writeAttribute("cutoff", cutoff/GeV);
 }
 
-UserActionManager::CommonVariables::CommonVariables(const G4String fname, Timer& timer_)
-: timer(timer_),
-  hdf_file(H5Fcreate(fname.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT)),
-  hdf_events(hdf_file, "events", hdf_fields.events, 1), event(hdf_events),
-  hdf_particles(hdf_file, "particles", hdf_fields.particles, 500), particle(hdf_particles)
-{}
+UserActionManager::CommonVariables::CommonVariables(const G4String prefix_, Timer& timer_, const OutputOptions &options_)
+: timer(timer_), hdf(nullptr), stream(nullptr),
+  events(nullptr), particles(nullptr), histograms(nullptr), profile(nullptr), memory(nullptr), metrics(nullptr),
+  stats(nullptr), closed_bytes(0), swmr(false), unflushed_events(0), last_flush(0.0),
+  prefix(prefix_), options(options_), part(0), part_first_event(0)
+{
+	if(options.memory || options.memory_limit > 0) {
+		memory = new MemoryMonitor(options.memory_tracks, options.memory_limit);
+	}
+	if(!options.metrics.empty()) {
+		metrics = new MetricsLog(options.metrics, options.total_events);
+	}
+	if(!options.stats.empty()) {
+		stats = new StatsServer(options.stats, options.total_events);
+	}
+
+	if(!options.stream.empty()) {
+		stream = new stream_output_t(options.stream);
+		events = &stream->events;
+		particles = &stream->particles;
+		events->row().id = -1;
+		return;
+	}
+
+	if(!options.histograms.empty()) {
+		histograms = new HistogramSet(options.histograms);
+	}
+	if(options.profile) {
+		profile = new EventProfile;
+	}
+
+	if(options.roll_events > 0 || options.roll_bytes > 0) {
+		manifest.open(prefix+".parts");
+		manifest << "# file first_event events particles" << std::endl;
+	}
+	openPart(0);
+}
 
 UserActionManager::CommonVariables::~CommonVariables()
 {
-	hdf_events.flush();
-	hdf_particles.flush();
+	if(hdf != nullptr) {
+		closePart();
+	}
+	delete stream;
+	delete histograms;
+	delete profile;
+	delete memory;
+	delete metrics;
+	delete stats;
+}
 
-	H5Fclose(hdf_file);
+void UserActionManager::CommonVariables::flush()
+{
+	ScopedTimer section(write_section);
+	if(hdf != nullptr) {
+		if(profile != nullptr) {
+			profile->flush();
+		}
+		if(memory != nullptr) {
+			memory->flush();
+		}
+		hdf->flush();
+	}
+	if(stream != nullptr) {
+		stream->out.flush();
+	}
+	unflushed_events = 0;
+	last_flush = timer.wall();
 }
 
-UserActionManager::CommonVariables::event_t::event_t(const HDFTable &table)
-: id(table.bind<unsigned int>("eventid")),
-  first(table.bind<unsigned int>("first")),
-  size(table.bind<unsigned int>("size")),
-  pid(table.bind<int>("pid")),
-  E(table.bind<double>("E")), KE(table.bind<double>("KE")),
-  incidence(table.bind<double>("incidence")),
-  discarded(table.bind<unsigned int>("discarded"))
-{}
+bool UserActionManager::CommonVariables::storeParticle(const particle_t &p)
+{
+	if(histograms != nullptr) {
+		histograms->fill(p);
+		return false;
+	}
+	ScopedTimer section(write_section);
+	if(hdf != nullptr) {
+		hdf->particle_index.add(p);
+	}
+	particles->write();
+	if(stats != nullptr) {
+		stats->counters.add(stats->counters.particle_rows);
+	}
+	return true;
+}
+
+// <prefix>.h5, or <prefix>.NNNN.h5 if the output is split into parts
+static G4String output_filename(const G4String &prefix, bool rolling, size_t part)
+{
+	if(!rolling) {
+		return prefix+".h5";
+	}
+	char partname[32];
+	snprintf(partname, sizeof(partname), ".%04zu.h5", part);
+	return prefix+partname;
+}
+
+void UserActionManager::CommonVariables::openPart(size_t first_event)
+{
+	part_first_event = first_event;
+
+	hdf = new hdf_output_t(output_filename(prefix, manifest.is_open(), part), options.swmr);
+	events = &hdf->events;
+	particles = &hdf->particles;
+	events->row().id = -1;
+	RunSummary::create(hdf->file);
+	if(profile != nullptr) {
+		profile->open(hdf->file);
+	}
+	if(memory != nullptr && options.memory) {
+		memory->open(hdf->file);
+	}
+	for(const std::function<void(hid_t)> &writer : attributes) {
+		writer(hdf->file);
+	}
+	if(manifest.is_open()) {
+		write_hdf5_attribute(hdf->file, "part", part);
+		write_hdf5_attribute(hdf->file, "first_event", part_first_event);
+	}
+
+	if(swmr) {
+		flush();
+		if(H5Fstart_swmr_write(hdf->file) < 0) {
+			throw std::runtime_error("UserActionManager: H5Fstart_swmr_write failed");
+		}
+	}
+}
+
+// Every part gets the summary (and, with histogram output, the histograms)
+// of its own events.
+void UserActionManager::CommonVariables::closePart()
+{
+	ScopedTimer section(write_section);
+	hdf->flush();
+	if(histograms != nullptr) {
+		histograms->write(hdf->file);
+		histograms->reset();
+	}
+	summary.write(hdf->file);
+	summary.reset();
+	if(profile != nullptr) {
+		profile->close();
+	}
+	if(memory != nullptr) {
+		memory->close();
+	}
+	if(manifest.is_open()) {
+		manifest << output_filename(prefix, true, part)
+		         << " " << part_first_event
+		         << " " << hdf->events.nrows()
+		         << " " << hdf->particles.nrows()
+		         << std::endl;
+	}
+	hsize_t size = 0;
+	H5Fget_filesize(hdf->file, &size);
+	closed_bytes += size;
+	delete hdf;
+	hdf = nullptr;
+	events = nullptr;
+	particles = nullptr;
+	part++;
+}
+
+bool UserActionManager::CommonVariables::partFull() const
+{
+	if(options.roll_events > 0 && hdf->events.nrows() >= options.roll_events) {
+		return true;
+	}
+	if(options.roll_bytes > 0) {
+		hsize_t size = 0;
+		H5Fget_filesize(hdf->file, &size);
+		return size >= options.roll_bytes;
+	}
+	return false;
+}
+
+// Reported once, when the soft limit is first exceeded. A soft abort lets
+// Geant4 finish the current event, after which the output is closed as at
+// the end of a run.
+void UserActionManager::CommonVariables::memoryLimitExceeded()
+{
+	G4cout << "% memlimit " << memory->rssMax() << " " << memory->softLimit() << G4endl;
+	if(options.memory_stop) {
+		G4cerr << "WARNING: the resident set size exceeds the soft limit, stopping after the current event" << G4endl;
+		G4RunManager::GetRunManager()->AbortRun(true);
+	} else {
+		G4cerr << "WARNING: the resident set size exceeds the soft limit" << G4endl;
+	}
+}
+
+// The HDF5 output is counted to the end of its current part.
+uint64_t UserActionManager::CommonVariables::outputBytes() const
+{
+	if(stream != nullptr) {
+		return stream->out.bytes();
+	}
+	hsize_t size = 0;
+	if(hdf != nullptr) {
+		H5Fget_filesize(hdf->file, &size);
+	}
+	return closed_bytes + size;
+}
+
+// The processes are looked up by name in the summary only once.
+size_t UserActionManager::CommonVariables::creatorProcess(const G4Track * track)
+{
+	const G4VProcess * process = track->GetCreatorProcess();
+	std::unordered_map<const G4VProcess*, size_t>::const_iterator it = creator_processes.find(process);
+	if(it != creator_processes.end()) {
+		return it->second;
+	}
+	const size_t index = summary.process(process != nullptr ? process->GetProcessName() : "none");
+	creator_processes[process] = index;
+	return index;
+}
+
+// SWMR requires the latest file format, which older HDF5 versions can not
+// read, so it is only used if requested.
+static hid_t create_hdf_file(const G4String fname, bool latest_format)
+{
+	hid_t fapl = H5Pcreate(H5P_FILE_ACCESS);
+	if(latest_format) {
+		H5Pset_libver_bounds(fapl, H5F_LIBVER_LATEST, H5F_LIBVER_LATEST);
+	}
+	hid_t file = H5Fcreate(fname.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, fapl);
+	H5Pclose(fapl);
+	return file;
+}
 
-UserActionManager::CommonVariables::particle_t::particle_t(const HDFTable &table)
-: eventid(table.bind<unsigned int>("eventid")),
-  name(table.bind<char[16]>("name")),
-  pid(table.bind<int>("pid")),
-  m(table.bind<double>("mass")),
-  vtx(table, "vtx"), boundary(table, "boundary")
+UserActionManager::CommonVariables::hdf_output_t::hdf_output_t(const G4String fname, bool latest_format)
+: file(create_hdf_file(fname, latest_format)),
+  events(file, "events", 1),
+  particles(file, "particles", 500),
+  particle_index(file)
 {}
 
-UserActionManager::CommonVariables::particle_t::kinematics_t::kinematics_t(const HDFTable &table, const std::string &prefix)
-: KE(table.bind<double>(prefix+".KE")),
-  x(table.bind<double>(prefix+".x")), y(table.bind<double>(prefix+".y")), z(table.bind<double>(prefix+".z")),
-  px(table.bind<double>(prefix+".px")), py(table.bind<double>(prefix+".py")), pz(table.bind<double>(prefix+".pz"))
+UserActionManager::CommonVariables::hdf_output_t::~hdf_output_t()
+{
+	events.flush();
+	particles.flush();
+	particle_index.flush();
+
+	H5Fclose(file);
+}
+
+void UserActionManager::CommonVariables::hdf_output_t::flush()
+{
+	events.flush();
+	particles.flush();
+	particle_index.flush(false);
+	H5Fflush(file, H5F_SCOPE_GLOBAL);
+}
+
+UserActionManager::CommonVariables::stream_output_t::stream_output_t(const std::string &path)
+: out(path), events(out, "events"), particles(out, "particles")
 {}
 
-UserActionManager::CommonVariables::hdf_fields_t::hdf_fields_t()
-{
-	events.reserve(5);
-	events.push_back(HDFTableField(H5T_NATIVE_UINT, "eventid"));
-	events.push_back(HDFTableField(H5T_NATIVE_UINT, "first"));
-	events.push_back(HDFTableField(H5T_NATIVE_UINT, "size"));
-	events.push_back(HDFTableField(H5T_NATIVE_INT, "pid"));
-	events.push_back(HDFTableField(H5T_NATIVE_DOUBLE, "E"));
-	events.push_back(HDFTableField(H5T_NATIVE_DOUBLE, "KE"));
-	events.push_back(HDFTableField(H5T_NATIVE_DOUBLE, "incidence"));
-	events.push_back(HDFTableField(H5T_NATIVE_UINT, "discarded"));
-
-	particles.reserve(18);
-	particles.push_back(HDFTableField(H5T_NATIVE_UINT, "eventid"));
-	particles.push_back(HDFTableField(H5T_NATIVE_INT, "pid"));
-	particles.push_back(HDFTableField(create_hdf5_string(STRUCT_SIZEOF(particle_t,name)), "name"));
-	particles.push_back(HDFTableField(H5T_NATIVE_DOUBLE, "mass"));
-	particles.push_back(HDFTableField(H5T_NATIVE_DOUBLE, "vtx.KE"));
-	particles.push_back(HDFTableField(H5T_NATIVE_DOUBLE, "vtx.x"));
-	particles.push_back(HDFTableField(H5T_NATIVE_DOUBLE, "vtx.y"));
-	particles.push_back(HDFTableField(H5T_NATIVE_DOUBLE, "vtx.z"));
-	particles.push_back(HDFTableField(H5T_NATIVE_DOUBLE, "vtx.px"));
-	particles.push_back(HDFTableField(H5T_NATIVE_DOUBLE, "vtx.py"));
-	particles.push_back(HDFTableField(H5T_NATIVE_DOUBLE, "vtx.pz"));
-	particles.push_back(HDFTableField(H5T_NATIVE_DOUBLE, "boundary.KE"));
-	particles.push_back(HDFTableField(H5T_NATIVE_DOUBLE, "boundary.x"));
-	particles.push_back(HDFTableField(H5T_NATIVE_DOUBLE, "boundary.y"));
-	particles.push_back(HDFTableField(H5T_NATIVE_DOUBLE, "boundary.z"));
-	particles.push_back(HDFTableField(H5T_NATIVE_DOUBLE, "boundary.px"));
-	particles.push_back(HDFTableField(H5T_NATIVE_DOUBLE, "boundary.py"));
-	particles.push_back(HDFTableField(H5T_NATIVE_DOUBLE, "boundary.pz"));
+void UserActionManager::startSWMR()
+{
+	pUAI.swmr = true;
+	if(pUAI.hdf != nullptr) {
+		pUAI.flush();
+		if(H5Fstart_swmr_write(pUAI.hdf->file) < 0) {
+			throw std::runtime_error("UserActionManager::startSWMR(): H5Fstart_swmr_write failed");
+		}
+	}
 }
 
 UserActionManager::~UserActionManager()
 {
-	pUAI.hdf_events.flush();
-	pUAI.hdf_particles.flush();
+	if(pUAI.hdf != nullptr) {
+		pUAI.hdf->flush();
+	}
+}
+
+// The attributes of the stream output are written in its header as text,
+// and so are they to the header of the metrics.
+void UserActionManager::addAttribute(const G4String &name, const std::string &text, const std::function<void(hid_t)> &writer)
+{
+	if(pUAI.metrics != nullptr) {
+		pUAI.metrics->attribute(name, text);
+	}
+	if(pUAI.stream != nullptr) {
+		pUAI.stream->out.attribute(name, text);
+		return;
+	}
+	pUAI.attributes.push_back(writer);
+	if(pUAI.hdf != nullptr) {
+		writer(pUAI.hdf->file);
+	}
+}
+
+template<class T>
+static std::string attribute_text(const T value)
+{
+	std::ostringstream ss;
+	ss << std::setprecision(17) << value;
+	return ss.str();
 }
 
 void UserActionManager::writeAttribute(const G4String & name, const double value)
 {
-	write_hdf5_attribute(pUAI.hdf_file, name, value);
+	addAttribute(name, attribute_text(value), [name, value](hid_t file) {write_hdf5_attribute(file, name, value);});
 }
 
 void UserActionManager::writeAttribute(const G4String & name, const int value)
 {
-	write_hdf5_attribute(pUAI.hdf_file, name, value);
+	addAttribute(name, attribute_text(value), [name, value](hid_t file) {write_hdf5_attribute(file, name, value);});
 }
 
 void UserActionManager::writeAttribute(const G4String & name, const unsigned int value)
 {
-	write_hdf5_attribute(pUAI.hdf_file, name, value);
+	addAttribute(name, attribute_text(value), [name, value](hid_t file) {write_hdf5_attribute(file, name, value);});
 }
 
 void UserActionManager::writeAttribute(const G4String & name, const long value)
 {
-	write_hdf5_attribute(pUAI.hdf_file, name, value);
+	addAttribute(name, attribute_text(value), [name, value](hid_t file) {write_hdf5_attribute(file, name, value);});
 }
 
 void UserActionManager::writeAttribute(const G4String & name, const unsigned long value)
 {
-	write_hdf5_attribute(pUAI.hdf_file, name, value);
+	addAttribute(name, attribute_text(value), [name, value](hid_t file) {write_hdf5_attribute(file, name, value);});
 }
 
 void UserActionManager::writeAttribute(const G4String & name, const G4String & value)
 {
-	const hsize_t dims[] = {1};
-	hid_t type = create_hdf5_string(value.size());
-	hid_t sid = H5Screate_simple(1, dims, NULL);
-	hid_t aid = H5Acreate(pUAI.hdf_file, name.c_str(), type, sid, H5P_DEFAULT, H5P_DEFAULT);
-	H5Awrite(aid, type, value.c_str());
-	H5Aclose(aid);
-	H5Sclose(sid);
+	addAttribute(name, value, [name, value](hid_t file) {
+		const hsize_t dims[] = {1};
+		hid_t type = create_hdf5_string(value.size());
+		hid_t sid = H5Screate_simple(1, dims, NULL);
+		hid_t aid = H5Acreate(file, name.c_str(), type, sid, H5P_DEFAULT, H5P_DEFAULT);
+		H5Awrite(aid, type, value.c_str());
+		H5Aclose(aid);
+		H5Sclose(sid);
+		H5Tclose(type);
+	});
 }
 
 G4UserSteppingAction * UserActionManager::getUserSteppingAction()
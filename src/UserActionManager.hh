@@ -1,24 +1,92 @@
 #ifndef UserActionManager_h
 #define UserActionManager_h
 
-#include "HDFTable.hh"
+#include "OutputTables.hh"
+#include "ParticleIndex.hh"
+#include "StreamOutput.hh"
+#include "Histograms.hh"
 #include "TrackingLog.hh"
+#include "RunSummary.hh"
+#include "EventProfile.hh"
+#include "MemoryMonitor.hh"
+#include "MetricsLog.hh"
+#include "StatsServer.hh"
+#include "Timer.hh"
 #include <G4String.hh>
 #include <fstream>
 #include <vector>
+#include <functional>
+#include <unordered_map>
 
 class G4UserSteppingAction;
 class G4UserEventAction;
 class G4UserStackingAction;
 class G4UserTrackingAction;
-class Timer;
+class G4VProcess;
+class G4Track;
 
 class UserActionManager
 {
 	public:
-		UserActionManager(Timer& timer, bool store_tracks, double cutoff=0.0, G4String prefix = "", double acceptradius = nan(""));
+		struct OutputOptions
+		{
+			// if set, the events and particles are written as a record stream
+			// (see StreamOutput) to this path ("-" for stdout) instead of HDF5
+			std::string stream;
+			// if set, the particles are not written but binned into the
+			// histograms defined in this YAML file (see HistogramSet), which are
+			// written to the output file when it is closed; the particles table
+			// stays empty and the events have no particles (size 0)
+			std::string histograms;
+			// the path of the track log (see TrackingLog), if the tracks are
+			// stored, by default <prefix>.tracks.bin
+			std::string tracks;
+			// what of the tracks is logged
+			TrackingLog::selection_t track_selection;
+			// create the files with the latest file format, needed by startSWMR()
+			bool swmr;
+			// with SWMR or stream output, the output is flushed after every
+			// flush_events events or flush_time seconds (0 disables either)
+			size_t flush_events;
+			double flush_time;
+			// if either is non-zero, the output is split into parts
+			// (<prefix>.NNNN.h5) of at most roll_events events or (roughly)
+			// roll_bytes bytes, listed in <prefix>.parts
+			size_t roll_events, roll_bytes;
+			// write the profile of every event (see EventProfile) to the
+			// HDF5 output
+			bool profile;
+			// write the memory use of every event (see MemoryMonitor) to the
+			// HDF5 output, sampled at the ends of the events and every
+			// memory_tracks tracks (0 - only at the ends)
+			bool memory;
+			size_t memory_tracks;
+			// if non-zero, a soft limit on the resident set size in bytes: once
+			// it is exceeded, a warning is printed or, with memory_stop, the run
+			// is stopped after the current event
+			size_t memory_limit;
+			bool memory_stop;
+			// if set, the progress is written as JSON lines (see MetricsLog) to
+			// this path, with an ETA based on total_events
+			std::string metrics;
+			size_t total_events;
+			// if set, live statistics are served on this Unix-domain socket or
+			// localhost port (see StatsServer)
+			std::string stats;
+
+			OutputOptions() : swmr(false), flush_events(0), flush_time(0.0), roll_events(0), roll_bytes(0), profile(false),
+			                  memory(false), memory_tracks(0), memory_limit(0), memory_stop(false),
+			                  total_events(0) {}
+		};
+
+		UserActionManager(Timer& timer, bool store_tracks, double cutoff=0.0, G4String prefix = "", double acceptradius = nan(""), const OutputOptions &options = OutputOptions());
 		~UserActionManager();
 
+		// Switches the output file to SWMR writing mode: from here on the tables
+		// are flushed with the cadence set in OutputOptions and the file can be
+		// read while the simulation runs. No attributes can be written after this.
+		void startSWMR();
+
 		void writeAttribute(const G4String & name, const double value);
 		void writeAttribute(const G4String & name, const int value);
 		void writeAttribute(const G4String & name, const unsigned int value);
@@ -33,54 +101,84 @@ class UserActionManager
 
 		struct CommonVariables
 		{
-			struct hdf_fields_t
-			{
-				std::vector<HDFTableField> events, particles;
-				hdf_fields_t();
-			} hdf_fields;
-
 			TrackingLog tracklog;
 			Timer& timer;
 			double cutoff, acceptradius;
 
-			hid_t hdf_file;
-
-			HDFTable hdf_events;
-			struct event_t
+			// the output file (or the current part of it)
+			struct hdf_output_t
 			{
-				unsigned int & id;
-				unsigned int & first;
-				unsigned int & size;
-				int & pid;
-				double &E, &KE;
-				double & incidence;
-				unsigned int & discarded;
-
-				event_t(const HDFTable &table);
-			} event;
-
-			HDFTable hdf_particles;
-			struct particle_t
+				hid_t file;
+				HDFTable<event_t> events;
+				HDFTable<particle_t> particles;
+				ParticleIndex particle_index;
+
+				hdf_output_t(const G4String fname, bool latest_format);
+				~hdf_output_t();
+				void flush();
+			} * hdf;
+
+			// the output stream, if writing to a stream instead of HDF5
+			struct stream_output_t
 			{
-				unsigned int & eventid;
-				char (&name)[16];
-				int & pid;
-				double & m;
-				struct kinematics_t {
-					double &KE;
-					double &x, &y, &z;
-					double &px, &py, &pz;
+				StreamOutput out;
+				StreamTable<event_t> events;
+				StreamTable<particle_t> particles;
+
+				stream_output_t(const std::string &path);
+			} * stream;
+
+			// the tables of either output
+			TableWriter<event_t> * events;
+			TableWriter<particle_t> * particles;
+
+			// with histogram output, replaces the particles table
+			HistogramSet * histograms;
+
+			// written to every part of the HDF5 output, for its events
+			RunSummary summary;
+			// the index in the summary of every creator process seen
+			std::unordered_map<const G4VProcess*, size_t> creator_processes;
+			// null unless profiling
+			EventProfile * profile;
+			// null unless the memory is monitored or limited
+			MemoryMonitor * memory;
+			// null unless writing metrics
+			MetricsLog * metrics;
+			// null unless serving statistics
+			StatsServer * stats;
+			// the size of the closed parts of the HDF5 output
+			uint64_t closed_bytes;
 
-					kinematics_t(const HDFTable &table, const std::string &prefix);
-				} vtx, boundary;
+			size_t track_approved_secondaries;
+			TimerSection::start_t event_start;
 
-				particle_t(const HDFTable &table);
-			} particle;
+			// SWMR or stream flushing cadence
+			bool swmr;
+			size_t unflushed_events;
+			double last_flush;
 
-			size_t track_approved_secondaries;
+			// rolling output
+			const G4String prefix;
+			const OutputOptions options;
+			size_t part, part_first_event;
+			std::ofstream manifest;
 
-			CommonVariables(const G4String fname, Timer& timer_);
+			// attributes are repeated in every part of the output
+			std::vector< std::function<void(hid_t)> > attributes;
+
+			CommonVariables(const G4String prefix_, Timer& timer_, const OutputOptions &options_);
 			~CommonVariables();
+			void flush();
+			// writes the particle, or fills it into the histograms; returns
+			// whether it was written to the particles table
+			bool storeParticle(const particle_t &p);
+			void openPart(size_t first_event);
+			void closePart();
+			bool partFull() const;
+			void memoryLimitExceeded();
+			uint64_t outputBytes() const;
+			size_t creatorProcess(const G4Track * track);
 		};
 
 	private:
@@ -89,6 +187,8 @@ class UserActionManager
 		G4UserStackingAction * userStackingAction;
 		G4UserTrackingAction * userTrackingAction;
 		CommonVariables pUAI;
+
+		void addAttribute(const G4String &name, const std::string &text, const std::function<void(hid_t)> &writer);
 };
 
 #endif
@@ -1,7 +1,10 @@
 #include "DetectorConstruction.hh"
 #include "PrimaryGeneratorAction.hh"
 #include "UserActionManager.hh"
+#include "StreamOutput.hh"
 #include "Timer.hh"
+#include "MemoryMonitor.hh"
+#include "TrackingLog.hh"
 #include "configuration.hh"
 
 #include "globals.hh"
@@ -17,6 +20,7 @@
 #include <ctime>
 #include <fstream>
 #include <string>
+#include <memory>
 #include <boost/crc.hpp>
 
 // ---------------------------------------------------------------------
@@ -73,6 +77,24 @@ const char* argp_program_version = "fgamma";
 #define PC_VIS   1003
 #define PC_CUT   1004
 #define PC_SPACC 1005
+#define PC_SWMR  1006
+#define PC_FLEV  1007
+#define PC_FLTM  1008
+#define PC_ROLLN 1009
+#define PC_ROLLS 1010
+#define PC_OUT   1011
+#define PC_STRM  1012
+#define PC_HIST  1013
+#define PC_PROF  1014
+#define PC_TIMR  1015
+#define PC_MEM   1016
+#define PC_MEMTR 1017
+#define PC_MEMLM 1018
+#define PC_MEMST 1019
+#define PC_TRFL  1020
+#define PC_TRSEL 1021
+#define PC_METR  1022
+#define PC_STATS 1023
 
 // Program's arguments - an array of option specifiers
 // name, short name, arg. name, flags, doc, group
@@ -88,7 +110,56 @@ const argp_option argp_options[] = {
 	{"seed", PC_SEED, "SEED", 0,
 		"set the seed for the random generators; if this is not"
 		" specified, time(0) is used)", 0},
-	{"tracks", PC_TRCKS, 0, 0, "store tracks in tracks.txt", 0},
+	{"tracks", PC_TRCKS, 0, 0, "log the tracks, their steps and secondaries"
+		" to the binary file set by --tracksfile (see tools/tracklog)", 0},
+	{"tracksfile", PC_TRFL, "PATH", 0, "file or FIFO for --tracks (default:"
+		" PREFIX.tracks.bin, - for stdout)", 0},
+	{"trackselect", PC_TRSEL, "RULES", 0, "only log the events and tracks"
+		" selected by the comma-separated RULES: every=N - every Nth event,"
+		" event=ID - an event, ke=GEV - tracks of at least GEV GeV, pid=PID -"
+		" tracks of a species, generations=K - tracks of the first K"
+		" generations", 0},
+	{"output", PC_OUT, "MODE", 0, "hdf5 - write the events and particles to"
+		" PREFIX.h5 (default), stream - write them as binary records to the"
+		" file set by --streamfile, histograms - write the events and the"
+		" histograms defined in the --histograms file to PREFIX.h5", 0},
+	{"streamfile", PC_STRM, "PATH", 0, "file or FIFO for --output=stream"
+		" (default: - for stdout, in which case the log goes to stderr)", 0},
+	{"histograms", PC_HIST, "FILE", 0, "YAML file with the histogram"
+		" definitions for --output=histograms (default: histograms.yml)", 0},
+	{"swmr", PC_SWMR, 0, 0, "write the output file in SWMR mode, so that it"
+		" can be read while the simulation is running", 0},
+	{"flushevents", PC_FLEV, "N", 0, "with --swmr or --output=stream, flush the"
+		" output after every N events (default: 10, 0 - never)", 0},
+	{"flushtime", PC_FLTM, "SECONDS", 0, "with --swmr or --output=stream, flush"
+		" the output at least every SECONDS seconds (default: 60, 0 - never)", 0},
+	{"rollevents", PC_ROLLN, "N", 0, "split the output into parts"
+		" (PREFIX.NNNN.h5, listed in PREFIX.parts) of at most N events", 0},
+	{"rollsize", PC_ROLLS, "MB", 0, "split the output into parts of"
+		" roughly MB megabytes", 0},
+	{"profile", PC_PROF, 0, 0, "write the CPU time, tracks, steps and"
+		" secondaries of every event, also by species and layer, to the tables"
+		" profile and profile_detail", 0},
+	{"timers", PC_TIMR, "MODE", 0, "what is measured of the sections of fgamma"
+		" (events, user actions, output writing), printed at the end as"
+		" `% section COUNT WALL CPU NAME` lines: off, wall - the wall time"
+		" (default), cpu - the wall and the CPU time", 0},
+	{"memory", PC_MEM, 0, 0, "write the resident set size, the peak resident"
+		" set size and the stack sizes of every event to the table memory and"
+		" their maxima to the attributes of the output", 0},
+	{"memtracks", PC_MEMTR, "N", 0, "sample the resident set size every N"
+		" tracks besides at the end of every event (default: 0 - never)", 0},
+	{"memlimit", PC_MEMLM, "MB", 0, "print a warning when the resident set"
+		" size exceeds MB megabytes", 0},
+	{"memstop", PC_MEMST, 0, 0, "stop the run after the event in which the"
+		" --memlimit is exceeded, closing the output as usual", 0},
+	{"metrics", PC_METR, "FILE", 0, "write the progress of the run (the time,"
+		" tracks, steps and particles of every event, the rate, ETA and memory)"
+		" as JSON lines to FILE, a file or FIFO", 0},
+	{"stats", PC_STATS, "SOCKET|PORT", 0, "serve live statistics of the run"
+		" (events, tracks and steps per second, rows and bytes written, the"
+		" time of the current event, memory) in the Prometheus text format over"
+		" HTTP on the Unix-domain socket SOCKET or on the localhost PORT", 0},
 
 	{0, 0, 0, 0, "Options for tweaking the physics:", 2},
 	{"model", 'm', "MODELFILE", 0,
@@ -107,14 +178,32 @@ int p_seed = 0;
 G4String p_eventfile = "";
 G4String p_modelfile = "model.yml";
 bool p_tracks = false;
+G4String p_tracksfile = "";
+TrackingLog::selection_t p_trackselect;
 G4String p_prefix = "fgamma";
 bool p_vis  = false; // go to visual mode (i.e. open the GUI instead)
 int p_verbosity = 1;
 double p_cutoff = 0.0;
 bool p_acceptinner = true;
+bool p_swmr = false;
+size_t p_flushevents = 10;
+double p_flushtime = 60.0;
+size_t p_rollevents = 0;
+size_t p_rollsize = 0;
+G4String p_output = "hdf5";
+G4String p_streamfile = "-";
+G4String p_histograms = "histograms.yml";
+bool p_profile = false;
+TimerSection::mode_t p_timers = TimerSection::WALL;
+bool p_memory = false;
+size_t p_memtracks = 0;
+size_t p_memlimit = 0;
+bool p_memstop = false;
+G4String p_metrics = "";
+G4String p_stats = "";
 
 // Argument parser callback called by argp
-error_t argp_parser(int key, char *arg, struct argp_state*) {
+error_t argp_parser(int key, char *arg, struct argp_state *state) {
 	switch(key) {
 		case 'o':
 			p_prefix = arg;
@@ -137,12 +226,81 @@ error_t argp_parser(int key, char *arg, struct argp_state*) {
 		case PC_TRCKS:
 			p_tracks = true;
 			break;
+		case PC_TRFL:
+			p_tracksfile = arg;
+			break;
+		case PC_TRSEL:
+			try {
+				p_trackselect = TrackingLog::selection_t::parse(arg);
+			} catch(const std::invalid_argument &e) {
+				argp_error(state, "%s", e.what());
+			}
+			break;
 		case PC_CUT:
 			p_cutoff = std::atof(arg)*GeV;
 			break;
 		case PC_SPACC:
 			p_acceptinner = false;
 			break;
+		case PC_SWMR:
+			p_swmr = true;
+			break;
+		case PC_FLEV:
+			p_flushevents = std::atoi(arg);
+			break;
+		case PC_FLTM:
+			p_flushtime = std::atof(arg);
+			break;
+		case PC_ROLLN:
+			p_rollevents = std::atol(arg);
+			break;
+		case PC_ROLLS:
+			p_rollsize = std::atol(arg);
+			break;
+		case PC_OUT:
+			p_output = arg;
+			if(p_output != "hdf5" && p_output != "stream" && p_output != "histograms") {
+				argp_error(state, "unknown output mode `%s`", arg);
+			}
+			break;
+		case PC_STRM:
+			p_streamfile = arg;
+			break;
+		case PC_HIST:
+			p_histograms = arg;
+			break;
+		case PC_PROF:
+			p_profile = true;
+			break;
+		case PC_TIMR:
+			if(std::string(arg) == "off") {
+				p_timers = TimerSection::OFF;
+			} else if(std::string(arg) == "wall") {
+				p_timers = TimerSection::WALL;
+			} else if(std::string(arg) == "cpu") {
+				p_timers = TimerSection::CPU;
+			} else {
+				argp_error(state, "unknown timer mode `%s`", arg);
+			}
+			break;
+		case PC_MEM:
+			p_memory = true;
+			break;
+		case PC_MEMTR:
+			p_memtracks = std::atol(arg);
+			break;
+		case PC_MEMLM:
+			p_memlimit = std::atol(arg);
+			break;
+		case PC_MEMST:
+			p_memstop = true;
+			break;
+		case PC_METR:
+			p_metrics = arg;
+			break;
+		case PC_STATS:
+			p_stats = arg;
+			break;
 		default:
 			return ARGP_ERR_UNKNOWN;
 	}
@@ -165,6 +323,39 @@ int main(int argc, char * argv[]) {
 	int argp_index;
 	argp_parse(&argp_argp, argc, argv, 0, &argp_index, 0);
 
+	// histograms are written when the file is closed, which SWMR does not allow
+	if(p_swmr && p_output == "histograms") {
+		G4cerr << "ERROR: --swmr can not be used with --output=histograms" << G4endl;
+		exit(1);
+	}
+
+	if(p_profile && p_output == "stream") {
+		G4cerr << "ERROR: --profile can not be used with --output=stream" << G4endl;
+		exit(1);
+	}
+
+	if(p_memory && p_output == "stream") {
+		G4cerr << "ERROR: --memory can not be used with --output=stream" << G4endl;
+		exit(1);
+	}
+
+	if(p_tracks && p_tracksfile == "-" && p_output == "stream" && p_streamfile == "-") {
+		G4cerr << "ERROR: --tracksfile and --streamfile can not both be stdout" << G4endl;
+		exit(1);
+	}
+
+	if(p_memstop && p_memlimit == 0) {
+		G4cerr << "ERROR: --memstop requires --memlimit" << G4endl;
+		exit(1);
+	}
+
+	TimerSection::setMode(p_timers);
+
+	// keep stdout clean for the records
+	if((p_output == "stream" && p_streamfile == "-") || (p_tracks && p_tracksfile == "-")) {
+		StreamOutput::reserveStdout();
+	}
+
 	G4cout << "% fgamma" << G4endl;
 
 	// get, store and output the program start time
@@ -251,20 +442,50 @@ int main(int argc, char * argv[]) {
 	double acceptradius = p_acceptinner ? nan("") : userDetectorConstruction->getWorldRadius();
 	G4cout << "% acceptradius " << acceptradius/km << " km" << G4endl;
 
-	UserActionManager uam(timer, p_tracks, p_cutoff, p_prefix, acceptradius);
-	runManager->SetUserAction(uam.getUserEventAction());
-	runManager->SetUserAction(uam.getUserSteppingAction());
-	runManager->SetUserAction(uam.getUserTrackingAction());
+	UserActionManager::OutputOptions output_options;
+	if(p_output == "stream") {
+		output_options.stream = p_streamfile;
+	} else if(p_output == "histograms") {
+		G4cout << "% histograms " << p_histograms << G4endl;
+		output_options.histograms = p_histograms;
+	}
+	output_options.swmr = p_swmr;
+	output_options.flush_events = p_flushevents;
+	output_options.flush_time = p_flushtime;
+	output_options.roll_events = p_rollevents;
+	output_options.roll_bytes = p_rollsize*1024*1024;
+	output_options.tracks = p_tracksfile;
+	output_options.track_selection = p_trackselect;
+	output_options.profile = p_profile;
+	output_options.memory = p_memory;
+	output_options.memory_tracks = p_memtracks;
+	output_options.memory_limit = p_memlimit*1024*1024;
+	output_options.memory_stop = p_memstop;
+	output_options.metrics = p_metrics;
+	output_options.total_events = total_events;
+	output_options.stats = p_stats;
+	// the metrics log and the stats server can not be opened if e.g. the
+	// FIFO has no reader or the port is taken
+	std::unique_ptr<UserActionManager> uam;
+	try {
+		uam.reset(new UserActionManager(timer, p_tracks, p_cutoff, p_prefix, acceptradius, output_options));
+	} catch(const std::invalid_argument &e) {
+		G4cerr << "ERROR: " << e.what() << G4endl;
+		exit(1);
+	}
+	runManager->SetUserAction(uam->getUserEventAction());
+	runManager->SetUserAction(uam->getUserSteppingAction());
+	runManager->SetUserAction(uam->getUserTrackingAction());
 
-	uam.writeAttribute("timestamp", start_time);
-	uam.writeAttribute("gunradius", gunradius/km);
-	uam.writeAttribute("acceptradius", acceptradius/km);
-	uam.writeAttribute("model_file", p_modelfile);
-	uam.writeAttribute("model_crc", model_crc);
+	uam->writeAttribute("timestamp", start_time);
+	uam->writeAttribute("gunradius", gunradius/km);
+	uam->writeAttribute("acceptradius", acceptradius/km);
+	uam->writeAttribute("model_file", p_modelfile);
+	uam->writeAttribute("model_crc", model_crc);
 
 	// Only set the stacking action if we're outputting the tracks, since
 	// ClassifyNewTrack currently only writes to track stream currently
-	if(p_tracks) runManager->SetUserAction(uam.getUserStackingAction());
+	if(p_tracks) runManager->SetUserAction(uam->getUserStackingAction());
 
 	// print the table of materials
 	if(p_verbosity>1){G4cout << *(G4Material::GetMaterialTable()) << G4endl;}
@@ -273,11 +494,17 @@ int main(int argc, char * argv[]) {
 	p_seed = p_seed==0 ? abs(read_urandom<int>()) : p_seed;
 	G4cout << "% seed " << p_seed << G4endl;
 	CLHEP::HepRandom::setTheSeed(p_seed);
-	uam.writeAttribute("seed", p_seed);
+	uam->writeAttribute("seed", p_seed);
 
 	// initialize G4 kernel
 	runManager->Initialize();
 
+	// all attributes are written by now, so the file can be handed over to SWMR readers
+	if(p_swmr) {
+		G4cout << "% swmr " << p_flushevents << " " << p_flushtime << G4endl;
+		uam->startSWMR();
+	}
+
 	// start runs or go into visual mode
 	if(p_vis) {
 		#ifdef G4VIS_USE
@@ -298,6 +525,10 @@ int main(int argc, char * argv[]) {
 	// job termination
 	delete runManager;
 
+	TimerSection::print(G4cout);
+	if(p_memory || p_memlimit > 0) {
+		G4cout << "% peak_rss " << MemoryMonitor::peakRss() << G4endl;
+	}
 	G4cout << "% done " << timer.elapsed() << G4endl;
 
 	return 0;
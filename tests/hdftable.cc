@@ -9,49 +9,65 @@ using namespace std;
 
 const size_t NAME_STRLEN = 16;
 
-int main()
+struct row_t
+{
+	int idx;
+	char name[NAME_STRLEN];
+	double x, y;
+};
+
+template<> struct HDFTableSchema<row_t>
 {
-	vector<HDFTableField> fields;
-	fields.push_back(HDFTableField(H5T_NATIVE_INT, "idx"));
-	fields.push_back(HDFTableField(create_hdf5_string(NAME_STRLEN), "name"));
-	fields.push_back(HDFTableField(H5T_NATIVE_DOUBLE, "x"));
-	fields.push_back(HDFTableField(H5T_NATIVE_DOUBLE, "y"));
+	static constexpr const char * title = "Test table";
+	static constexpr HDFTableField fields[] = {
+		HDF_TABLE_FIELD(row_t, idx, "idx"),
+		HDF_TABLE_FIELD(row_t, name, "name"),
+		HDF_TABLE_FIELD(row_t, x, "x"),
+		HDF_TABLE_FIELD(row_t, y, "y")
+	};
+	static constexpr size_t nfields = sizeof(fields)/sizeof(*fields);
+};
+constexpr HDFTableField HDFTableSchema<row_t>::fields[];
 
+int main()
+{
 	hid_t file = H5Fcreate("tabletest.h5", H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
 	hid_t group = H5Gcreate(file, "subgroup", H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
 
 	{
-		HDFTable table(group, "table-name", fields, 1337);
-
-		int &idx = table.bind<int>("idx");
-		double &x = table.bind<double>("x");
-		double &y = table.bind<double>("y");
-		char (&name)[] = table.bind<char[]>("name");
-
-		string_to_cstr(string("  : qwerty;"), name, NAME_STRLEN);
+		HDFTable<row_t> table(group, "table-name", 1337);
 
 		for(int i=0; i<10000; i++) {
-			idx = 100000 + i;
-			x = 0.5*i;
-			y = 50*sqrt(i);
-			name[0] = 0x40 + i%50;
+			row_t &row = table.row();
+			row.idx = 100000 + i;
+			row.x = 0.5*i;
+			row.y = 50*sqrt(i);
+			string_to_cstr(string("  : qwerty;"), row.name, NAME_STRLEN);
+			row.name[0] = 0x40 + i%50;
 			table.write();
 		}
 		table.flush();
+		cout << "Wrote " << table.nrows() << " rows." << endl;
 	}
 
 	// an empty table too...
 	{
-		HDFTable table(group, "empty-table", fields, 1337);
+		HDFTable<row_t> table(group, "empty-table", 1337);
 		table.setAttribute(H5T_NATIVE_DOUBLE, "custom-attribute", 123.456);
 	}
 
-	// test bad bind
-	try {
-		HDFTable table(group, "bad-bind", fields, 1337);
-		table.bind<double>("nexists");
-	} catch(const std::out_of_range &e) {
-		cout << "Caught an exception: " << e.what() << endl;
+	// read the rows back
+	{
+		vector<row_t> rows(100);
+		hdf_read_rows(group, "table-name", 5000, rows.size(), rows.data());
+		for(size_t i=0; i<rows.size(); i++) {
+			int n = 5000 + i;
+			if(rows[i].idx != 100000+n || rows[i].x != 0.5*n || rows[i].name[0] != 0x40 + n%50) {
+				cout << "Bad row " << n << ": " << rows[i].idx << ", " << rows[i].name << ", " << rows[i].x << endl;
+				return 1;
+			}
+		}
+		cout << "Read back " << rows.size() << " rows." << endl;
 	}
 
 	H5Gclose(group);
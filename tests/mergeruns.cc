@@ -0,0 +1,353 @@
+#include "../src/OutputReader.hh"
+#include "../src/ParticleIndex.hh"
+#include "../src/RunSummary.hh"
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstring>
+#include <cstdlib>
+#include <stdexcept>
+#include <sys/wait.h>
+
+using namespace std;
+
+// Runs mergeruns in every mode on small runs and reads the merged files
+// back through OutputReader. The path of mergeruns is the first argument
+// (default: tools/mergeruns, as seen from the build directory); its output
+// goes to mergetest.log.
+
+// A run written by the test: its events have (id*7 + seed) % 5 particles,
+// whose fields tell the run (vtx.KE), the event (mass) and their order in
+// the event (pid, boundary.KE).
+struct input_t
+{
+	string path;
+	int seed;
+	hsize_t nevents;
+	// with the 32-bit IDs of older versions of fgamma
+	bool narrow;
+
+	hsize_t event_size(hsize_t id) const {return (id*7 + seed) % 5;}
+	hsize_t nparticles() const
+	{
+		hsize_t n = 0;
+		for(hsize_t id=0; id<nevents; id++) n += event_size(id);
+		return n;
+	}
+};
+
+int particle_pid(hsize_t id, hsize_t j) {return (id+j) % 3 == 0 ? 11 : 22;}
+double particle_KE(hsize_t id, hsize_t j) {return 0.001*((id*13 + j*101) % 997 + 1);}
+
+// The rows of older files, with 32-bit IDs.
+struct event32_t
+{
+	unsigned int id, first, size;
+	int pid;
+	double E, KE;
+	double incidence;
+	unsigned int discarded;
+};
+
+struct particle32_t
+{
+	unsigned int eventid;
+	int pid;
+	char name[16];
+	double m;
+	particle_t::kinematics_t vtx, boundary;
+};
+
+template<> struct HDFTableSchema<event32_t>
+{
+	static constexpr const char * title = "Events";
+	static constexpr HDFTableField fields[] = {
+		HDF_TABLE_FIELD(event32_t, id, "eventid"),
+		HDF_TABLE_FIELD(event32_t, first, "first"),
+		HDF_TABLE_FIELD(event32_t, size, "size"),
+		HDF_TABLE_FIELD(event32_t, pid, "pid"),
+		HDF_TABLE_FIELD(event32_t, E, "E"),
+		HDF_TABLE_FIELD(event32_t, KE, "KE"),
+		HDF_TABLE_FIELD(event32_t, incidence, "incidence"),
+		HDF_TABLE_FIELD(event32_t, discarded, "discarded")
+	};
+	static constexpr size_t nfields = sizeof(fields)/sizeof(*fields);
+};
+constexpr HDFTableField HDFTableSchema<event32_t>::fields[];
+
+template<> struct HDFTableSchema<particle32_t>
+{
+	static constexpr const char * title = "Particles in an event.";
+	static constexpr HDFTableField fields[] = {
+		HDF_TABLE_FIELD(particle32_t, eventid, "eventid"),
+		HDF_TABLE_FIELD(particle32_t, pid, "pid"),
+		HDF_TABLE_FIELD(particle32_t, name, "name"),
+		HDF_TABLE_FIELD(particle32_t, m, "mass"),
+		HDF_TABLE_FIELD(particle32_t, vtx.KE, "vtx.KE"),
+		HDF_TABLE_FIELD(particle32_t, vtx.x, "vtx.x"),
+		HDF_TABLE_FIELD(particle32_t, vtx.y, "vtx.y"),
+		HDF_TABLE_FIELD(particle32_t, vtx.z, "vtx.z"),
+		HDF_TABLE_FIELD(particle32_t, vtx.px, "vtx.px"),
+		HDF_TABLE_FIELD(particle32_t, vtx.py, "vtx.py"),
+		HDF_TABLE_FIELD(particle32_t, vtx.pz, "vtx.pz"),
+		HDF_TABLE_FIELD(particle32_t, boundary.KE, "boundary.KE"),
+		HDF_TABLE_FIELD(particle32_t, boundary.x, "boundary.x"),
+		HDF_TABLE_FIELD(particle32_t, boundary.y, "boundary.y"),
+		HDF_TABLE_FIELD(particle32_t, boundary.z, "boundary.z"),
+		HDF_TABLE_FIELD(particle32_t, boundary.px, "boundary.px"),
+		HDF_TABLE_FIELD(particle32_t, boundary.py, "boundary.py"),
+		HDF_TABLE_FIELD(particle32_t, boundary.pz, "boundary.pz")
+	};
+	static constexpr size_t nfields = sizeof(fields)/sizeof(*fields);
+};
+constexpr HDFTableField HDFTableSchema<particle32_t>::fields[];
+
+template<class Event, class Particle>
+void write_tables(hid_t file, const input_t &input)
+{
+	HDFTable<Event> events(file, "events", 100, true);
+	HDFTable<Particle> particles(file, "particles", 100, true);
+	ParticleIndex index(file);
+	for(hsize_t id=0; id<input.nevents; id++) {
+		Event &event = events.row();
+		memset(&event, 0, sizeof(event));
+		event.id = id;
+		event.first = particles.nrows();
+		event.size = input.event_size(id);
+		event.E = id;
+		events.write();
+
+		for(hsize_t j=0; j<input.event_size(id); j++) {
+			Particle &p = particles.row();
+			memset(&p, 0, sizeof(p));
+			p.eventid = id;
+			p.pid = particle_pid(id, j);
+			string_to_cstr(p.pid == 22 ? "gamma" : "e-", p.name, sizeof(p.name));
+			p.m = id;
+			p.vtx.KE = input.seed;
+			p.boundary.KE = particle_KE(id, j);
+			particle_t widened = particle_t();
+			widened.pid = p.pid;
+			widened.boundary.KE = p.boundary.KE;
+			index.add(widened);
+			particles.write();
+		}
+	}
+	events.flush();
+	particles.flush();
+	index.flush();
+}
+
+// Writes a run as fgamma does, with its attributes and summary.
+void write_input(const input_t &input)
+{
+	hid_t file = H5Fcreate(input.path.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+	if(input.narrow) {
+		write_tables<event32_t, particle32_t>(file, input);
+	} else {
+		write_tables<event_t, particle_t>(file, input);
+	}
+
+	const string model = "test.yml";
+	const hsize_t dims[] = {1};
+	hid_t type = create_hdf5_string(model.size());
+	hid_t sid = H5Screate_simple(1, dims, NULL);
+	hid_t aid = H5Acreate(file, "model_file", type, sid, H5P_DEFAULT, H5P_DEFAULT);
+	H5Awrite(aid, type, model.c_str());
+	H5Aclose(aid);
+	H5Sclose(sid);
+	H5Tclose(type);
+	write_hdf5_attribute(file, "model_crc", 1234u);
+	write_hdf5_attribute(file, "seed", input.seed);
+	write_hdf5_attribute(file, "cutoff", 0.1);
+	write_hdf5_attribute(file, "gunradius", 100.0);
+
+	RunSummary summary;
+	for(hsize_t id=0; id<input.nevents; id++) {
+		summary.event();
+	}
+	summary.write(file);
+	H5Fclose(file);
+}
+
+// Overwrites the first chunk of the particles of a run with bytes that do
+// not inflate, so that reading it fails.
+void corrupt_input(const input_t &input)
+{
+	hid_t file = H5Fopen(input.path.c_str(), H5F_ACC_RDWR, H5P_DEFAULT);
+	hid_t dsid = H5Dopen(file, "particles", H5P_DEFAULT);
+	const hsize_t offset[] = {0};
+	vector<char> junk(1000, '\x5a');
+	H5Dwrite_chunk(dsid, H5P_DEFAULT, 0, offset, junk.size(), junk.data());
+	H5Dclose(dsid);
+	H5Fclose(file);
+}
+
+string p_mergeruns = "tools/mergeruns";
+
+// Runs mergeruns with the arguments and returns its exit code.
+int mergeruns(const string &args)
+{
+	cout << "mergeruns " << args << endl;
+	const int status = system((p_mergeruns+" "+args+" >> mergetest.log 2>&1").c_str());
+	return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+// Reads a merged file back and checks that it holds the runs, in order,
+// and that all the events have their own particles. The summary has to
+// cover summarized runs.
+bool check(const string &path, const vector<const input_t*> &runs, size_t summarized)
+{
+	try {
+		OutputReader reader(path, 256);
+		const vector<run_t> rows = reader.runs();
+		if(rows.size() != runs.size()) {
+			cout << path << ": " << rows.size() << " runs instead of " << runs.size() << endl;
+			return false;
+		}
+		hsize_t nevents = 0, nparticles = 0;
+		for(size_t k=0; k<runs.size(); k++) {
+			const run_t &row = rows[k];
+			if(runs[k]->path != row.file_path || row.seed != runs[k]->seed
+			   || row.event_first != nevents || row.event_size != runs[k]->nevents
+			   || row.particle_first != nparticles || row.particle_size != runs[k]->nparticles()) {
+				cout << path << ": bad run " << k << ": " << row.file_path << ", seed " << row.seed
+				     << ", events " << row.event_first << "+" << row.event_size
+				     << ", particles " << row.particle_first << "+" << row.particle_size << endl;
+				return false;
+			}
+			nevents += row.event_size;
+			nparticles += row.particle_size;
+		}
+		if(reader.nevents() != nevents || reader.nparticles() != nparticles) {
+			cout << path << ": " << reader.nevents() << " events and " << reader.nparticles()
+			     << " particles instead of " << nevents << " and " << nparticles << endl;
+			return false;
+		}
+
+		size_t k = 0;
+		hsize_t row = 0, first = 0;
+		for(const event_t &event : reader.events()) {
+			while(row >= rows[k].event_first + rows[k].event_size) k++;
+			const input_t &input = *runs[k];
+			const hsize_t id = row - rows[k].event_first;
+			if(event.id != row || event.first != first || event.size != input.event_size(id) || event.E != id) {
+				cout << path << ": bad event " << row << ": id " << event.id << ", first " << event.first
+				     << ", size " << event.size << endl;
+				return false;
+			}
+			hsize_t j = 0;
+			for(const particle_t &p : reader.particles(event)) {
+				if(p.eventid != event.id || p.m != id || p.vtx.KE != input.seed
+				   || p.pid != particle_pid(id, j) || p.boundary.KE != particle_KE(id, j)) {
+					cout << path << ": bad particle " << j << " of event " << row << ": eventid "
+					     << p.eventid << ", run " << p.vtx.KE << ", event " << p.m << endl;
+					return false;
+				}
+				j++;
+			}
+			if(j != event.size) {
+				cout << path << ": " << j << " particles in event " << row << endl;
+				return false;
+			}
+			first += event.size;
+			row++;
+		}
+
+		RunSummary summary(0);
+		const bool has_summary = summary.read(reader.file());
+		if(summarized > 0 && (!has_summary || summary.totals().runs != summarized)) {
+			cout << path << ": the summary covers " << summary.totals().runs << " runs instead of " << summarized << endl;
+			return false;
+		}
+	} catch(const exception &e) {
+		cout << path << ": " << e.what() << endl;
+		return false;
+	}
+	return true;
+}
+
+#define EXPECT(condition) \
+	if(!(condition)) { \
+		cout << "Failed: " #condition << endl; \
+		return 1; \
+	}
+
+int main(int argc, char * argv[])
+{
+	if(argc > 1) {
+		p_mergeruns = argv[1];
+	}
+	remove("mergetest.log");
+
+	const input_t u1 = {"mergetest-u1.h5", 1, 1500, false};
+	const input_t u2 = {"mergetest-u2.h5", 2, 700, false};
+	const input_t u3 = {"mergetest-u3.h5", 3, 1200, false};
+	const input_t old = {"mergetest-old.h5", 4, 900, true};
+	for(const input_t * input : {&u1, &u2, &u3, &old}) {
+		write_input(*input);
+	}
+
+	// copy, virtual and sorted merges, and inputs with 32-bit IDs
+	EXPECT(mergeruns("-o mergetest-c.h5 mergetest-u1.h5 mergetest-u2.h5") == 0);
+	EXPECT(check("mergetest-c.h5", {&u1, &u2}, 2));
+	EXPECT(mergeruns("-j1 --buffer 1 --nocompress -o mergetest-c1.h5 mergetest-u1.h5 mergetest-u2.h5") == 0);
+	EXPECT(check("mergetest-c1.h5", {&u1, &u2}, 2));
+	EXPECT(mergeruns("--virtual -o mergetest-v.h5 mergetest-u1.h5 mergetest-u2.h5") == 0);
+	EXPECT(check("mergetest-v.h5", {&u1, &u2}, 2));
+	EXPECT(mergeruns("--sort -o mergetest-s.h5 mergetest-u1.h5 mergetest-u2.h5") == 0);
+	EXPECT(check("mergetest-s.h5", {&u1, &u2}, 2));
+	EXPECT(mergeruns("--sort --memory 1 -o mergetest-s1.h5 mergetest-u1.h5 mergetest-u2.h5") == 0);
+	EXPECT(check("mergetest-s1.h5", {&u1, &u2}, 2));
+	EXPECT(mergeruns("-o mergetest-w.h5 mergetest-old.h5 mergetest-u1.h5") == 0);
+	EXPECT(check("mergetest-w.h5", {&old, &u1}, 2));
+	EXPECT(mergeruns("--virtual -o mergetest-vw.h5 mergetest-old.h5 mergetest-u1.h5") == 4);
+
+	// appending skips the runs that are already in the output, also when
+	// they are given twice
+	EXPECT(mergeruns("-o mergetest-a.h5 mergetest-u1.h5") == 0);
+	EXPECT(mergeruns("--append -o mergetest-a.h5 mergetest-u1.h5 mergetest-u2.h5 mergetest-u2.h5") == 0);
+	EXPECT(check("mergetest-a.h5", {&u1, &u2}, 2));
+	EXPECT(mergeruns("--append -o mergetest-a.h5 mergetest-c.h5 mergetest-u3.h5") == 0);
+	EXPECT(check("mergetest-a.h5", {&u1, &u2, &u3}, 3));
+	EXPECT(mergeruns("--append -o mergetest-v.h5 mergetest-u3.h5") == 4);
+	EXPECT(mergeruns("--append -o mergetest-s.h5 mergetest-u3.h5") == 4);
+	EXPECT(check("mergetest-v.h5", {&u1, &u2}, 2));
+	EXPECT(check("mergetest-s.h5", {&u1, &u2}, 2));
+
+	// merges of merges keep the runs of the merged inputs
+	EXPECT(mergeruns("-o mergetest-cc.h5 mergetest-c.h5 mergetest-u3.h5") == 0);
+	EXPECT(check("mergetest-cc.h5", {&u1, &u2, &u3}, 3));
+	EXPECT(mergeruns("-o mergetest-cv.h5 mergetest-v.h5 mergetest-u3.h5") == 0);
+	EXPECT(check("mergetest-cv.h5", {&u1, &u2, &u3}, 3));
+	EXPECT(mergeruns("-o mergetest-cs.h5 mergetest-s.h5 mergetest-u3.h5") == 0);
+	EXPECT(check("mergetest-cs.h5", {&u1, &u2, &u3}, 3));
+	EXPECT(mergeruns("--sort -o mergetest-ss.h5 mergetest-u3.h5 mergetest-s.h5") == 0);
+	EXPECT(check("mergetest-ss.h5", {&u3, &u1, &u2}, 3));
+	EXPECT(mergeruns("--virtual -o mergetest-vc.h5 mergetest-c.h5 mergetest-u3.h5") == 0);
+	EXPECT(check("mergetest-vc.h5", {&u1, &u2, &u3}, 3));
+	EXPECT(mergeruns("--virtual -o mergetest-vv.h5 mergetest-u3.h5 mergetest-v.h5") == 0);
+	EXPECT(check("mergetest-vv.h5", {&u3, &u1, &u2}, 3));
+	EXPECT(mergeruns("--virtual -o mergetest-vs.h5 mergetest-s.h5") == 4);
+
+	// runs of a merged input that are already merged are skipped, without
+	// its summary, which also covers them
+	EXPECT(mergeruns("-o mergetest-d.h5 mergetest-u2.h5 mergetest-cc.h5") == 0);
+	EXPECT(check("mergetest-d.h5", {&u2, &u1, &u3}, 1));
+	EXPECT(mergeruns("--virtual -o mergetest-vd.h5 mergetest-u2.h5 mergetest-c.h5") == 0);
+	EXPECT(check("mergetest-vd.h5", {&u2, &u1}, 1));
+
+	// a merge that fails leaves the output as it was, and the runs it
+	// could not merge are merged by the next append
+	EXPECT(mergeruns("-o mergetest-f.h5 mergetest-u1.h5") == 0);
+	corrupt_input(u3);
+	EXPECT(mergeruns("--append -o mergetest-f.h5 mergetest-u2.h5 mergetest-u3.h5") == 3);
+	EXPECT(check("mergetest-f.h5", {&u1}, 1));
+	write_input(u3);
+	EXPECT(mergeruns("--append -o mergetest-f.h5 mergetest-u2.h5 mergetest-u3.h5") == 0);
+	EXPECT(check("mergetest-f.h5", {&u1, &u2, &u3}, 3));
+
+	cout << "All merges passed." << endl;
+	return 0;
+}
@@ -0,0 +1,148 @@
+#include "../src/OutputReader.hh"
+
+#include <iostream>
+#include <cstring>
+#include <stdexcept>
+
+using namespace std;
+
+const hsize_t NEVENTS = 100;
+// 0..9 particles per event
+const hsize_t NPARTICLES = NEVENTS/10*45;
+
+void write_test_column(hid_t file, const char * name, const vector<hsize_t> &values)
+{
+	const hsize_t dims[] = {values.size()};
+	hid_t sid = H5Screate_simple(1, dims, NULL);
+	hid_t dsid = H5Dcreate(file, name, H5T_NATIVE_HSIZE, sid, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+	H5Dwrite(dsid, H5T_NATIVE_HSIZE, H5S_ALL, H5S_ALL, H5P_DEFAULT, values.data());
+	H5Dclose(dsid);
+	H5Sclose(sid);
+}
+
+int main()
+{
+	// events with 0..9 particles each
+	hid_t file = H5Fcreate("readertest.h5", H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
+	{
+		HDFTable<event_t> events(file, "events", 17);
+		HDFTable<particle_t> particles(file, "particles", 23);
+		for(hsize_t i=0; i<NEVENTS; i++) {
+			event_t &event = events.row();
+			memset(&event, 0, sizeof(event));
+			event.id = i;
+			event.first = particles.nrows();
+			event.size = i%10;
+			event.E = i;
+			events.write();
+
+			for(hsize_t j=0; j<event.size; j++) {
+				particle_t &p = particles.row();
+				memset(&p, 0, sizeof(p));
+				p.eventid = i;
+				p.pid = j;
+				string_to_cstr("gamma", p.name, sizeof(p.name));
+				particles.write();
+			}
+		}
+		events.flush();
+		particles.flush();
+	}
+	write_hdf5_attribute(file, "seed", 1337);
+	H5Fclose(file);
+
+	// read them back in blocks that do not match the events
+	try {
+		OutputReader reader("readertest.h5", 7);
+		if(reader.nevents() != NEVENTS || reader.sorted()) {
+			cout << "Bad number of events: " << reader.nevents() << endl;
+			return 1;
+		}
+
+		hsize_t nevents = 0, nparticles = 0;
+		for(const event_t &event : reader.events()) {
+			if(event.id != nevents || event.E != nevents) {
+				cout << "Bad event " << nevents << ": " << event.id << ", " << event.E << endl;
+				return 1;
+			}
+			int pid = 0;
+			for(const particle_t &p : reader.particles(event)) {
+				if(p.eventid != event.id || p.pid != pid++ || strcmp(p.name, "gamma") != 0) {
+					cout << "Bad particle of event " << event.id << ": " << p.eventid << ", " << p.pid << endl;
+					return 1;
+				}
+				nparticles++;
+			}
+			nevents++;
+		}
+		if(nevents != NEVENTS || nparticles != reader.nparticles()) {
+			cout << "Bad counts: " << nevents << " events, " << nparticles << " particles" << endl;
+			return 1;
+		}
+		cout << "Read " << nevents << " events with " << nparticles << " particles." << endl;
+
+		// the run is made from the attributes, of which only the seed is set
+		vector<run_t> runs = reader.runs();
+		if(runs.size() != 1 || runs[0].event_size != NEVENTS || runs[0].particle_size != nparticles) {
+			cout << "Bad runs" << endl;
+			return 1;
+		}
+	} catch(const exception &e) {
+		cout << "Error: " << e.what() << endl;
+		return 1;
+	}
+
+	// the same particles sorted by descending pid, as mergeruns --sort
+	// writes them, are still read by event
+	file = H5Fopen("readertest.h5", H5F_ACC_RDWR, H5P_DEFAULT);
+	{
+		vector<particle_t> original(NPARTICLES), sorted;
+		hdf_read_rows(file, "particles", 0, NPARTICLES, original.data());
+		vector<hsize_t> row, by_event(NPARTICLES);
+		for(int pid=9; pid>=0; pid--) {
+			for(hsize_t i=0; i<NPARTICLES; i++) {
+				if(original[i].pid != pid) continue;
+				by_event[i] = sorted.size();
+				row.push_back(i);
+				sorted.push_back(original[i]);
+			}
+		}
+		H5Ldelete(file, "particles", H5P_DEFAULT);
+		HDFTable<particle_t> particles(file, "particles");
+		particles.append(sorted.data(), sorted.size());
+		write_test_column(file, "particles_row", row);
+		write_test_column(file, "particles_by_event", by_event);
+	}
+	H5Fclose(file);
+	try {
+		OutputReader reader("readertest.h5", 3);
+		hsize_t nparticles = 0;
+		for(const event_t &event : reader.events()) {
+			int pid = 0;
+			for(const particle_t &p : reader.particles(event)) {
+				if(p.eventid != event.id || p.pid != pid++) {
+					cout << "Bad sorted particle of event " << event.id << ": " << p.eventid << ", " << p.pid << endl;
+					return 1;
+				}
+				nparticles++;
+			}
+		}
+		if(!reader.sorted() || nparticles != NPARTICLES) {
+			cout << "Bad sorted count: " << nparticles << endl;
+			return 1;
+		}
+		cout << "Read " << nparticles << " sorted particles by event." << endl;
+	} catch(const exception &e) {
+		cout << "Error: " << e.what() << endl;
+		return 1;
+	}
+
+	// missing files and tables throw
+	try {
+		OutputReader reader("no-such-file.h5");
+		cout << "Opened a missing file" << endl;
+		return 1;
+	} catch(const runtime_error &) {}
+
+	return 0;
+}
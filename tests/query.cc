@@ -0,0 +1,157 @@
+#include "../src/Query.hh"
+
+#include <iostream>
+#include <sstream>
+#include <cmath>
+#include <cstdio>
+#include <stdexcept>
+
+using namespace std;
+
+// The rows the queries are evaluated over, as the columns of pid and
+// boundary.KE.
+const double PID[] = {22, 22, 11, -11, 0, 22};
+const double KE[] = {2, 20, 200, 0.5, 5000, 0};
+const size_t NROWS = sizeof(PID)/sizeof(*PID);
+
+// Evaluates the queries over the rows, in two blocks, as the threads of the
+// analyzer would.
+QueryPlan::state_t evaluate(const QueryPlan &plan)
+{
+	QueryPlan::state_t state = plan.state();
+	const size_t split = NROWS/2;
+	for(size_t start : {size_t(0), split}) {
+		const size_t n = start == 0 ? split : NROWS - split;
+		vector<const double*> columns;
+		for(const QueryPlan::column_t &column : plan.columns()) {
+			if(column.event || (column.field != "pid" && column.field != "boundary.KE")) {
+				throw runtime_error("unexpected column "+column.field);
+			}
+			columns.push_back((column.field == "pid" ? PID : KE) + start);
+		}
+		plan.evaluate(columns, n, state);
+	}
+	return state;
+}
+
+// The printed result of a single query.
+string result(const string &query)
+{
+	QueryPlan plan;
+	plan.add(query);
+	ostringstream out;
+	plan.print(out, evaluate(plan));
+	return out.str();
+}
+
+bool check(const string &query, const string &expected)
+{
+	const string printed = result(query);
+	if(printed != expected) {
+		cout << "Bad result of `" << query << "`: " << printed << " instead of " << expected << endl;
+		return false;
+	}
+	return true;
+}
+
+int main()
+{
+	try {
+		// precedence: * before +, comparisons before && before ||
+		if(!check("count where 1 + 2 * 3 == 7", "count where 1 + 2 * 3 == 7: 6\n")
+			|| !check("a: count where pid == 22 || pid == 11 && boundary.KE > 1000", "a: 3\n")
+			|| !check("a: count where (pid == 22 || pid == 11) && boundary.KE > 1000", "a: 0\n")
+			|| !check("a: sum(pid + 1 * 2)", "a: 78\n")
+			|| !check("a: sum((pid + 1) * 2)", "a: 144\n")) {
+			return 1;
+		}
+
+		// ! and != are told apart, ! binding looser than the comparisons and
+		// the arithmetic, but tighter than &&
+		if(!check("a: count where pid != 22", "a: 3\n")
+			|| !check("a: count where !(pid == 22)", "a: 3\n")
+			|| !check("a: count where !pid", "a: 1\n")
+			|| !check("a: count where !pid != 0", "a: 1\n")
+			|| !check("a: count where !pid - 22", "a: 3\n")
+			|| !check("a: count where !(pid != 22) && boundary.KE > 1", "a: 2\n")) {
+			return 1;
+		}
+
+		// unary and binary minus, which is left associative
+		if(!check("a: sum(-pid)", "a: -66\n")
+			|| !check("a: sum(pid - -1)", "a: 72\n")
+			|| !check("a: max(10 - 3 - 2 + 0 * pid)", "a: 5\n")
+			|| !check("a: count where -pid > 0", "a: 1\n")) {
+			return 1;
+		}
+
+		// the name is the text before the colon, trimmed, or the whole query
+		QueryPlan names;
+		names.add("  gammas : count where pid == 22");
+		names.add("count where pid == 11");
+		ostringstream out;
+		names.print(out, evaluate(names));
+		if(out.str() != "gammas: 3\ncount where pid == 11: 1\n") {
+			cout << "Bad names: " << out.str() << endl;
+			return 1;
+		}
+
+		// log binning: [1, 10), [10, 100), [100, 1000), the rest outside
+		if(!check("a: hist(boundary.KE, 3, 1, 1000, log)",
+			"a: 6 entries\n  [1, 10): 1\n  [10, 100): 1\n  [100, 1000): 1\n")) {
+			return 1;
+		}
+
+		// the mean of nothing is nan (rather than -nan)
+		if(!check("a: mean(boundary.KE) where pid == 13", "a: nan\n")
+			|| !check("a: mean(boundary.KE) where pid == 11", "a: 200\n")) {
+			return 1;
+		}
+
+		// bad queries throw
+		for(const char * bad : {"count where", "hist(pid, 0, 0, 1)", "hist(pid, 2, 0, 1, log)", "mean pid", "sum(pid) pid"}) {
+			try {
+				QueryPlan plan;
+				plan.add(bad);
+				cout << "Parsed a bad query: " << bad << endl;
+				return 1;
+			} catch(const QueryPlan::parse_error &) {}
+		}
+
+		// the results survive a save and load, e.g. through the pipe of a
+		// child process of the analyzer, and merge
+		QueryPlan plan;
+		plan.add("n: count where pid == 22");
+		plan.add("KE: sum(boundary.KE)");
+		plan.add("hist(boundary.KE, 4, 0, 100)");
+		const QueryPlan::state_t saved = evaluate(plan);
+		FILE * tmp = tmpfile();
+		if(tmp == nullptr || !plan.save(tmp, saved) || !plan.save(tmp, saved)) {
+			cout << "Unable to save the results" << endl;
+			return 1;
+		}
+		rewind(tmp);
+		QueryPlan::state_t loaded = plan.state(), other = plan.state();
+		if(!plan.load(tmp, loaded) || !plan.load(tmp, other) || plan.load(tmp, other)) {
+			cout << "Unable to load the results" << endl;
+			return 1;
+		}
+		fclose(tmp);
+		plan.merge(loaded, other);
+		ostringstream once, twice;
+		plan.print(once, saved);
+		plan.print(twice, loaded);
+		const string expected = "n: 6\nKE: 10445\nhist(boundary.KE, 4, 0, 100): 12 entries\n"
+			"  [0, 25): 8\n  [25, 50): 0\n  [50, 75): 0\n  [75, 100): 0\n";
+		if(twice.str() != expected) {
+			cout << "Bad merged results: " << twice.str() << " (from " << once.str() << ")" << endl;
+			return 1;
+		}
+	} catch(const exception &e) {
+		cout << "Error: " << e.what() << endl;
+		return 1;
+	}
+
+	cout << "All queries passed." << endl;
+	return 0;
+}
@@ -3,229 +3,724 @@
 #include <vector>
 #include <stdexcept>
 #include <algorithm>
+#include <cmath>
+#include <thread>
+#include <functional>
+#include <memory>
+#include <sstream>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <unistd.h>
+#include <dirent.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <hdf5.h>
 #include <hdf5_hl.h>
 
+#include "../src/OutputTables.hh"
+#include "../src/OutputReader.hh"
+#include "../src/ParticleIndex.hh"
+#include "../src/Query.hh"
+#include "../src/BlockReader.hh"
+#include "../src/DirectChunks.hh"
+
 using namespace std;
 
-const string datatype_class_string(const hid_t type)
-{
-	switch(H5Tget_class(type)) {
-		case H5T_INTEGER: return "H5T_INTEGER"; break;
-		case H5T_FLOAT: return "H5T_FLOAT"; break;
-		case H5T_STRING: return "H5T_STRING"; break;
-		case H5T_BITFIELD: return "H5T_BITFIELD"; break;
-		case H5T_OPAQUE: return "H5T_OPAQUE"; break;
-		case H5T_COMPOUND: return "H5T_COMPOUND"; break;
-		case H5T_REFERENCE: return "H5T_REFERENCE"; break;
-		case H5T_ENUM: return "H5T_ENUM"; break;
-		case H5T_VLEN: return "H5T_VLEN"; break;
-		case H5T_ARRAY: return "H5T_ARRAY"; break;
-		default: return "UNKNOWN"; break;
+// ---------------------------------------------------------------------
+// Scan engine
+// ---------------------------------------------------------------------
+// The particles are read in blocks by a BlockReader, ahead of several
+// worker threads. Only the fields the queries refer to are read; the
+// workers split them into columns, over which the plan of the queries is
+// evaluated. Event fields are joined to the particles through their
+// eventid, from columns of the events table loaded once before the scan.
+// Every thread has its own partial results, which are merged at the end.
+// All the HDF5 calls of a scan are made by the thread of the reader. If
+// the particles table allows it, the reader only copies the raw chunks of
+// the blocks (as DirectChunks), which the workers decompress, so that the
+// decompression is shared by the workers too.
+
+struct scan_t
+{
+	const QueryPlan &plan;
+	// the particle and event fields read, and for each column of the plan
+	// its index in one of them
+	vector<string> particle_fields, event_fields;
+	vector<size_t> column_index;
+	// the index of eventid in particle_fields, if events are joined
+	size_t eventid_index;
+	bool join;
+
+	scan_t(const QueryPlan &plan);
+};
+
+scan_t::scan_t(const QueryPlan &plan_)
+: plan(plan_), eventid_index(0), join(false)
+{
+	for(const QueryPlan::column_t &column : plan.columns()) {
+		vector<string> &fields = column.event ? event_fields : particle_fields;
+		size_t i = find(fields.begin(), fields.end(), column.field) - fields.begin();
+		if(i == fields.size()) {
+			fields.push_back(column.field);
+		}
+		column_index.push_back(i);
+		join = join || column.event;
 	}
+	if(join) {
+		eventid_index = find(particle_fields.begin(), particle_fields.end(), "eventid") - particle_fields.begin();
+		if(eventid_index == particle_fields.size()) {
+			particle_fields.push_back("eventid");
+		}
+	}
+
+	// throw on unknown fields before anything is read
+	ColumnReader<particle_t> particles(particle_fields);
+	ColumnReader<event_t> events(event_fields);
 }
 
-struct HDFTableInfo
-{
-	// abstract structure information
-	hsize_t nfields;
-	char ** field_names;
-	hid_t * field_types;
-	size_t * field_sizes;
-
-	// instance information
-	string name;
-	size_t * field_offsets;
-	size_t type_size;
-	hsize_t nrecords;
-
-	// methods
-	HDFTableInfo(hid_t group, string name);
-	~HDFTableInfo();
-	void printInfo();
-	size_t findField(const string & fieldname);
+// The event columns of a file that the queries refer to.
+struct event_columns_t
+{
+	// the events are in order of their IDs if rows is empty and looked up
+	// through it otherwise
+	vector< vector<double> > columns;
+	unordered_map<hsize_t, size_t> rows;
+	// in virtual merges, the tables hold the IDs of each run and the merged
+	// event IDs of the particles are in the dataset particles_eventid
+	bool merged_ids;
+
+	event_columns_t(hid_t fh, hsize_t nevents, const scan_t &scan);
+	double row(double eventid) const;
 };
 
-HDFTableInfo::HDFTableInfo(hid_t group, string name_)
-: name(name_)
+event_columns_t::event_columns_t(hid_t fh, hsize_t nevents, const scan_t &scan)
+: merged_ids(false)
 {
-	H5TBget_table_info(group, name.c_str(), &nfields, &nrecords);
+	if(!scan.join) return;
 
-	field_names = new char*[nfields];
-	for(size_t i=0; i<nfields; i++) {
-		field_names[i] = new char[32];
+	vector<string> fields(scan.event_fields);
+	const size_t id_index = find(fields.begin(), fields.end(), "eventid") - fields.begin();
+	if(id_index == fields.size()) {
+		fields.push_back("eventid");
+	}
+	ColumnReader<event_t> reader(fields);
+	columns.resize(fields.size());
+	reader.read(fh, "events", 0, nevents, columns);
+	for(vector<double> &column : columns) {
+		column.resize(nevents);
 	}
-	field_sizes = new size_t[nfields];
-	field_offsets = new size_t[nfields];
-	field_types = new hid_t[nfields];
 
-	hid_t dsid = H5Dopen(group, name.c_str(), H5P_DEFAULT);
-	hid_t dstype = H5Dget_type(dsid);
-	type_size = H5Tget_size(dstype);
-	for(size_t i=0; i<nfields; i++) {
-		field_names[i] = H5Tget_member_name(dstype, i);
-		field_offsets[i] = H5Tget_member_offset(dstype, i);
-		field_types[i] = H5Tget_member_type(dstype, i);
-		field_sizes[i] = H5Tget_size(field_types[i]);
+	// the events of fgamma and mergeruns files are stored in order of their IDs
+	merged_ids = H5Lexists(fh, "particles_eventid", H5P_DEFAULT) > 0;
+	const vector<double> &ids = columns[id_index];
+	for(hsize_t i=0; i<nevents && !merged_ids; i++) {
+		if(ids[i] != i) {
+			for(hsize_t k=0; k<nevents; k++) {
+				rows[static_cast<hsize_t>(ids[k])] = k;
+			}
+			break;
+		}
 	}
-	H5Dclose(dsid);
+	columns.resize(scan.event_fields.size());
 }
 
-HDFTableInfo::~HDFTableInfo()
+// Returns the row of the event, or -1 if the event is not in the table.
+double event_columns_t::row(double eventid) const
 {
-	for(size_t i=0; i<nfields; i++) {
-		delete[] field_names[i];
+	if(rows.empty()) {
+		return eventid < columns[0].size() ? eventid : -1;
 	}
-	delete[] field_names;
-	delete[] field_sizes;
-	delete[] field_offsets;
+	unordered_map<hsize_t, size_t>::const_iterator it = rows.find(static_cast<hsize_t>(eventid));
+	return it == rows.end() ? -1 : it->second;
 }
 
-size_t HDFTableInfo::findField(const string & fieldname)
+// Adds the queries to the plan, exiting on errors.
+scan_t compile_queries(QueryPlan &plan, const vector<string> &queries, const string &filter)
 {
-	for(size_t i=0; i<nfields; i++) {
-		if(fieldname == field_names[i]) {
-			return i;
+	try {
+		for(const string &query : queries) {
+			plan.add(query, filter);
 		}
+		return scan_t(plan);
+	} catch(const QueryPlan::parse_error &e) {
+		cerr << "Error: " << e.what() << endl;
+		exit(1);
 	}
-	throw out_of_range("Field `"+fieldname+"` not found!");
 }
 
-void HDFTableInfo::printInfo()
+// A block of particle rows: the first one, the number of rows and whether
+// its data are the raw chunks that contain the rows (set when it is read).
+struct scan_block_t
+{
+	hsize_t first, n;
+	bool raw;
+};
+typedef BlockReader<scan_block_t> scan_reader_t;
+
+// The header of a raw chunk in the data of a block, followed by its bytes
+// (padded to the alignment of the header).
+struct raw_chunk_t
+{
+	uint64_t size;
+	uint32_t filter_mask;
+};
+
+// The offset of the merged event IDs in the data of a block of n rows.
+size_t merged_ids_offset(const ColumnReader<particle_t> &reader, hsize_t n)
+{
+	return (n*reader.rowSize() + sizeof(hsize_t) - 1)/sizeof(hsize_t)*sizeof(hsize_t);
+}
+
+// Reads a block of particles (the fields of the scan and, in virtual
+// merges, the merged event IDs) on the thread of the block reader, as the
+// raw chunks of the rows if chunks is given. Virtual merges are never read
+// by chunks, as their particles are not chunked. Throws std::runtime_error
+// if the rows can not be read.
+void scan_read(hid_t fh, const ColumnReader<particle_t> &reader, bool merged_ids,
+	const DirectChunks * chunks, scan_reader_t::block_t &block)
 {
-	cout << "Table: " << name << endl;
-	cout << "  nfields: " << nfields << endl;
-	cout << "  nrecords: " << nrecords << endl;
-	cout << "  type_size: " << type_size << endl;
-	for(size_t i=0; i<nfields; i++) {
-		cout << "   - " << field_names[i] << " (" << datatype_class_string(field_types[i]) << ") <"
-		     << field_offsets[i] << ", " << field_sizes[i] << ">" << endl;
+	const hsize_t start = block.request.first, n = block.request.n;
+
+	block.request.raw = false;
+	if(chunks != nullptr) {
+		const hsize_t chunk_rows = chunks->chunkRows();
+		DirectChunks::raw_t raw;
+		block.data.clear();
+		bool stored = true;
+		for(hsize_t first = start/chunk_rows*chunk_rows; stored && first < start+n; first += chunk_rows) {
+			stored = chunks->read(first, raw);
+			const raw_chunk_t header = {raw.data.size(), raw.filter_mask};
+			const size_t offset = block.data.size();
+			block.data.resize(offset + sizeof(header) + (raw.data.size() + sizeof(header) - 1)/sizeof(header)*sizeof(header));
+			memcpy(block.data.data() + offset, &header, sizeof(header));
+			memcpy(block.data.data() + offset + sizeof(header), raw.data.data(), raw.data.size());
+		}
+		// e.g. a chunk of a live file that has not been written yet
+		block.request.raw = stored;
+		if(stored) return;
+	}
+
+	const size_t ids_offset = merged_ids_offset(reader, n);
+	block.data.resize(merged_ids ? ids_offset + n*sizeof(hsize_t) : n*reader.rowSize());
+	if(reader.fetch(fh, "particles", start, n, block.data.data()) < 0) {
+		throw runtime_error("unable to read the particles");
+	}
+	if(merged_ids && hdf_read_column(fh, "particles_eventid", start, n, reinterpret_cast<hsize_t*>(block.data.data() + ids_offset)) < 0) {
+		throw runtime_error("unable to read particles_eventid");
 	}
 }
 
-hid_t create_hdf5_string(size_t length)
+// Decompresses the raw chunks of a block and converts the rows of the
+// block into the columns of the particles.
+void scan_decode(const scan_reader_t::block_t &block, const DirectChunks &chunks, hsize_t nrecords,
+	const ColumnReader<particle_t> &reader, vector<particle_t> &buffer, vector< vector<double> > &particles)
 {
-	hid_t ret = H5Tcopy(H5T_C_S1);
-	H5Tset_size(ret, length);
-	return ret;
+	const hsize_t start = block.request.first, end = start + block.request.n;
+	const hsize_t chunk_rows = chunks.chunkRows();
+	buffer.resize(chunk_rows);
+	const char * data = block.data.data();
+	for(hsize_t first = start/chunk_rows*chunk_rows; first < end; first += chunk_rows) {
+		raw_chunk_t header;
+		memcpy(&header, data, sizeof(header));
+		chunks.decode(data + sizeof(header), header.size, header.filter_mask, buffer.data(), min(chunk_rows, nrecords - first));
+		data += sizeof(header) + (header.size + sizeof(header) - 1)/sizeof(header)*sizeof(header);
+
+		const hsize_t lo = max(first, start), hi = min(first + chunk_rows, end);
+		reader.convertRows(buffer.data() + (lo - first), hi - lo, particles, lo - start);
+	}
 }
 
-void string_to_cstr(const std::string &src, char dst[], size_t target_size)
+// Evaluates the queries over the blocks. A block that can not be read or
+// decoded is skipped, with the error set; the other blocks are still
+// taken, so that the workers never wait for a block that is not released.
+void scan_worker(scan_reader_t &blocks, const ColumnReader<particle_t> &reader, const DirectChunks * chunks,
+	hsize_t nrecords, const scan_t &scan, const event_columns_t &event_columns, QueryPlan::state_t &state,
+	string &error)
 {
-	src.copy(dst, target_size-1);
-	for(size_t i=src.size(); i<target_size; i++) {
-		dst[i] = '\0';
+	vector< vector<double> > particles(scan.particle_fields.size()), events(scan.event_fields.size());
+	vector<double> rows;
+	vector<const double*> inputs(scan.column_index.size());
+	vector<particle_t> chunk;
+
+	while(true) {
+		scan_reader_t::block_t * block;
+		try {
+			block = blocks.next();
+		} catch(const exception &e) {
+			error = e.what();
+			continue;
+		}
+		if(block == nullptr) return;
+
+		const hsize_t n = block->request.n;
+		if(block->request.raw) {
+			try {
+				scan_decode(*block, *chunks, nrecords, reader, chunk, particles);
+			} catch(const exception &e) {
+				error = e.what();
+				blocks.release(block);
+				continue;
+			}
+		} else {
+			reader.convert(block->data.data(), n, particles);
+		}
+		if(event_columns.merged_ids) {
+			const hsize_t * ids = reinterpret_cast<const hsize_t*>(block->data.data() + merged_ids_offset(reader, n));
+			vector<double> &eventid = particles[scan.eventid_index];
+			for(hsize_t j=0; j<n; j++) {
+				eventid[j] = ids[j];
+			}
+		}
+
+		if(scan.join) {
+			rows.resize(n);
+			const double * eventid = particles[scan.eventid_index].data();
+			for(hsize_t j=0; j<n; j++) {
+				rows[j] = event_columns.row(eventid[j]);
+			}
+			// particles of events missing from the table get NaN fields
+			for(size_t k=0; k<events.size(); k++) {
+				events[k].resize(max<size_t>(events[k].size(), n));
+				const double * column = event_columns.columns[k].data();
+				for(hsize_t j=0; j<n; j++) {
+					events[k][j] = rows[j] < 0 ? NAN : column[static_cast<size_t>(rows[j])];
+				}
+			}
+		}
+
+		for(size_t c=0; c<inputs.size(); c++) {
+			const bool event = scan.plan.columns()[c].event;
+			inputs[c] = (event ? events : particles)[scan.column_index[c]].data();
+		}
+		scan.plan.evaluate(inputs, n, state);
+		blocks.release(block);
 	}
 }
 
-template<typename T>
-T hdf_read_attribute(hid_t loc, const string & name, hid_t type)
+// ---------------------------------------------------------------------
+// Argument parser settings
+// ---------------------------------------------------------------------
+#include <argp.h>
+
+#define PC_PID  1001
+#define PC_EMIN 1002
+#define PC_EMAX 1003
+#define PC_BUF  1004
+#define PC_RSPL 1005
+#define PC_PROC 1006
+#define PC_PREF 1007
+
+const argp_option argp_options[] = {
+	{0, 0, 0, 0, "Queries:", 0},
+	{"query", 'q', "QUERY", 0, "evaluate QUERY over the selected particles, e.g."
+		" 'hist(event.incidence, 10, 0, 1.6) where pid == 22' (can be repeated;"
+		" default: counts N, Ngr and Nsp)", 0},
+	{0, 0, 0, 0, "Particle selection:", 0},
+	{"pid", PC_PID, "PID", 0, "only count particles with this PDG ID", 0},
+	{"emin", PC_EMIN, "E", 0, "only count particles with boundary.KE >= E (in GeVs)", 0},
+	{"emax", PC_EMAX, "E", 0, "only count particles with boundary.KE <= E (in GeVs)", 0},
+	{"rsplit", PC_RSPL, "KM", 0, "count particles closer than KM to the center"
+		" as ground (Ngr) and the rest as space (Nsp) particles (default: 6500)", 0},
+	{0, 0, 0, 0, "Scanning:", 0},
+	{"threads", 'j', "N", 0, "scan with N threads in total (default: the number of cores)", 0},
+	{"processes", PC_PROC, "N", 0, "analyze up to N files at the same time, in"
+		" separate processes (default: the number of files, at most -j)", 0},
+	{"buffer", PC_BUF, "MB", 0, "memory used for the read buffers of all the"
+		" threads (default: 256)", 0},
+	{"prefetch", PC_PREF, "N", 0, "read up to N blocks ahead (default: the"
+		" number of threads plus 2)", 0},
+	{0, 0, 0, 0, 0, 0}
+};
+
+int p_pid = 0;
+double p_emin = 0.0, p_emax = INFINITY;
+double p_rsplit = 6500.0;
+size_t p_threads = max(1u, thread::hardware_concurrency());
+size_t p_processes = 0;
+size_t p_prefetch = 0;
+size_t p_buffer = 256;
+vector<string> p_queries;
+
+error_t argp_parser(int key, char *arg, struct argp_state*) {
+	switch(key) {
+		case PC_PID:
+			p_pid = atoi(arg);
+			break;
+		case PC_EMIN:
+			p_emin = atof(arg);
+			break;
+		case PC_EMAX:
+			p_emax = atof(arg);
+			break;
+		case PC_RSPL:
+			p_rsplit = atof(arg);
+			break;
+		case 'q':
+			p_queries.push_back(arg);
+			break;
+		case 'j':
+			p_threads = max(1, atoi(arg));
+			break;
+		case PC_PREF:
+			p_prefetch = max(1, atoi(arg));
+			break;
+		case PC_PROC:
+			p_processes = max(1, atoi(arg));
+			break;
+		case PC_BUF:
+			p_buffer = max(1, atoi(arg));
+			break;
+		default:
+			return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+const argp argp_argp = {
+	argp_options, &argp_parser, "FILE|DIR...",
+	"Counts the (selected) particles in fgamma output files, or evaluates"
+	" queries over them in a single scan. The *.h5 files in a directory are"
+	" all analyzed.\v"
+	"A query is count, sum(X), mean(X), min(X), max(X) or"
+	" hist(X, BINS, MIN, MAX[, log]), optionally followed by `where FILTER' and"
+	" prefixed by `NAME:'. X and FILTER are expressions of the numeric particle"
+	" fields (pid, boundary.KE, vtx.x, ...), the fields of their event (event.incidence,"
+	" event.E, ...), R (the radius of the boundary point), numbers, + - * /,"
+	" comparisons, && || ! and abs(), sqrt() and log10().",
+	0, 0, 0
+};
+
+// ---------------------------------------------------------------------
+// Analysis of the input files
+// ---------------------------------------------------------------------
+// Each input file is scanned by several threads. Several files can be
+// analyzed at the same time by separate processes (HDF5 serializes the
+// reads of the threads of a process), which write their partial results
+// to a pipe, to be merged in the main process. Besides the results of the
+// queries, the runs of the inputs are collected: the rows of the runs
+// table of merged files, or a run made from the attributes of a file.
+
+// Analyzes a file, adding its results to state and its runs to runs.
+// Returns 0 on success and the exit code of the error otherwise.
+int analyze_file(const string &path, const scan_t &scan, size_t nthreads, bool print_info,
+	QueryPlan::state_t &state, vector<run_t> &runs)
 {
-	hid_t attr = H5Aopen(loc, name.c_str(), H5P_DEFAULT);
-	if(attr < 0) {
-		throw out_of_range("unable to open attribute ("+name+")");
+	unique_ptr<OutputReader> input;
+	try {
+		input.reset(new OutputReader(path));
+	} catch(const exception &e) {
+		cerr << "Error: " << path << ": " << e.what() << endl;
+		return 3;
 	}
+	const hid_t fh = input->file();
+	const hsize_t nparticles = input->nparticles();
+	if(print_info) {
+		cout << "--- Structural information ---" << endl;
+		input->eventsInfo().printInfo();
+		input->particlesInfo().printInfo();
+	}
+
+	const vector<run_t> file_runs = input->runs();
+	runs.insert(runs.end(), file_runs.begin(), file_runs.end());
 
-	T buf;
-	H5Aread(attr, type, &buf);
-	H5Aclose(attr);
-	return buf;
+	// Row ranges that may contain selected particles. If the file has an
+	// index, chunks that can not match the selection are skipped.
+	vector< pair<hsize_t, hsize_t> > ranges;
+	if(H5Lexists(fh, ParticleIndex::tablename, H5P_DEFAULT) > 0) {
+		hsize_t nfields, nchunks;
+		H5TBget_table_info(fh, ParticleIndex::tablename, &nfields, &nchunks);
+		vector<particle_chunk_t> chunks(nchunks);
+		hdf_read_rows(fh, ParticleIndex::tablename, 0, nchunks, chunks.data());
+
+		hsize_t nselected = 0;
+		for(const particle_chunk_t &chunk : chunks) {
+			if(!ParticleIndex::matches(chunk, p_pid, p_emin, p_emax)) continue;
+			nselected += chunk.size;
+			if(!ranges.empty() && ranges.back().first+ranges.back().second == chunk.first) {
+				ranges.back().second += chunk.size;
+			} else {
+				ranges.push_back(make_pair(chunk.first, chunk.size));
+			}
+		}
+		// rows written after the last index flush (e.g. in a live file) are not indexed
+		hsize_t nindexed = chunks.empty() ? 0 : chunks.back().first + chunks.back().size;
+		if(nindexed < nparticles) {
+			nselected += nparticles - nindexed;
+			ranges.push_back(make_pair(nindexed, nparticles - nindexed));
+		}
+		cout << "Index: reading " << nselected << " of " << nparticles << " records of " << path << "." << endl;
+	} else {
+		ranges.push_back(make_pair(0, nparticles));
+		cout << "Reading " << nparticles << " records of " << path << "." << endl;
+	}
+
+	const event_columns_t event_columns(fh, input->nevents(), scan);
+
+	// The chunks are read raw if there are fields to read at all
+	const ColumnReader<particle_t> reader(scan.particle_fields);
+	unique_ptr<DirectChunks> chunks;
+	if(reader.rowSize() > 0 && !event_columns.merged_ids) {
+		chunks.reset(DirectChunks::open<particle_t>(fh, "particles"));
+		if(!chunks->usable()) {
+			chunks.reset();
+		}
+	}
+
+	// Split the ranges into blocks so that the buffers of the reader and the
+	// columns and registers of the plan of every thread fit into the memory
+	// (raw chunks taking at most the size of their rows, plus a chunk)
+	const size_t nbuffers = p_prefetch > 0 ? p_prefetch : nthreads+2;
+	const size_t row_size = nbuffers*(chunks ? sizeof(particle_t) : reader.rowSize() + sizeof(hsize_t))
+		+ nthreads*sizeof(double)*(2*scan.plan.columns().size() + scan.plan.registers() + 2);
+	const hsize_t chunk_rows = chunks ? chunks->chunkRows() : 1;
+	const hsize_t block_rows = chunk_rows*max<size_t>(1, p_buffer*1024*1024/row_size/chunk_rows);
+	vector<scan_block_t> blocks;
+	for(const pair<hsize_t, hsize_t> &range : ranges) {
+		const hsize_t end = range.first + range.second;
+		for(hsize_t record=range.first; record<end; record+=block_rows) {
+			const scan_block_t block = {record, min(block_rows, end-record), false};
+			blocks.push_back(block);
+		}
+	}
+
+	// The blocks are read on the thread of the block reader while the
+	// worker threads evaluate the queries over the blocks read before
+	nthreads = max<size_t>(1, min(nthreads, blocks.size()));
+	vector<QueryPlan::state_t> states(nthreads, scan.plan.state());
+	vector<string> errors(nthreads);
+	{
+		const bool merged_ids = event_columns.merged_ids;
+		const DirectChunks * raw_chunks = chunks.get();
+		scan_reader_t block_reader(blocks, nbuffers,
+			[fh, &reader, merged_ids, raw_chunks](scan_reader_t::block_t &block, size_t) {
+				scan_read(fh, reader, merged_ids, raw_chunks, block);
+			}
+		);
+		vector<thread> workers;
+		for(size_t t=0; t<nthreads; t++) {
+			workers.push_back(thread(scan_worker,
+				ref(block_reader), cref(reader), raw_chunks, nparticles, cref(scan), cref(event_columns), ref(states[t]),
+				ref(errors[t])
+			));
+		}
+		for(thread &worker : workers) {
+			worker.join();
+		}
+	}
+	for(const string &error : errors) {
+		if(!error.empty()) {
+			cerr << "Error: " << path << ": " << error << endl;
+			return 3;
+		}
+	}
+	for(size_t t=0; t<nthreads; t++) {
+		scan.plan.merge(state, states[t]);
+	}
+
+	return 0;
 }
 
-string hdf_read_attribute_string(hid_t loc, const string & name)
+// A child process and the pipe of its results.
+struct child_t
 {
-	hid_t attr = H5Aopen(loc, name.c_str(), H5P_DEFAULT);
-	if(attr < 0) {
-		throw out_of_range("unable to open attribute ("+name+")");
+	pid_t pid;
+	int fd;
+};
+
+// Analyzes the files in a child process, which writes its results and runs
+// to its pipe.
+child_t fork_analysis(const vector<string> &files, const scan_t &scan, size_t nthreads)
+{
+	int fds[2];
+	if(pipe(fds) != 0 || fflush(stdout) != 0) {
+		cerr << "Error(" << errno << "): pipe() failed" << endl;
+		exit(2);
+	}
+	pid_t pid = fork();
+	if(pid < 0) {
+		cerr << "Error(" << errno << "): fork() failed" << endl;
+		exit(2);
+	}
+	if(pid > 0) {
+		close(fds[1]);
+		child_t child = {pid, fds[0]};
+		return child;
 	}
 
-	hid_t type = H5Aget_type(attr);
-	size_t type_size = H5Tget_size(type);
-	char * buf = new char[type_size+1];
-	H5Aread(attr, type, buf);
-	H5Tclose(type);
-	H5Aclose(attr);
-	buf[type_size] = 0;
-	string ret(buf);
-	delete[] buf;
-	return ret;
+	close(fds[0]);
+	QueryPlan::state_t state = scan.plan.state();
+	vector<run_t> runs;
+	for(const string &file : files) {
+		int ret = analyze_file(file, scan, nthreads, false, state, runs);
+		if(ret != 0) _exit(ret);
+	}
+
+	FILE * out = fdopen(fds[1], "w");
+	const size_t nruns = runs.size();
+	bool ok = scan.plan.save(out, state)
+		&& fwrite(&nruns, sizeof(nruns), 1, out) == 1
+		&& fwrite(runs.data(), sizeof(run_t), nruns, out) == nruns;
+	ok = fclose(out) == 0 && ok;
+	cout.flush();
+	_exit(ok ? 0 : 2);
+}
+
+// Reads the results of a child process and waits for it, exiting on errors.
+void join_analysis(const child_t &child, const scan_t &scan, QueryPlan::state_t &state, vector<run_t> &runs)
+{
+	FILE * in = fdopen(child.fd, "r");
+	QueryPlan::state_t results = scan.plan.state();
+	size_t nruns = 0;
+	bool ok = scan.plan.load(in, results) && fread(&nruns, sizeof(nruns), 1, in) == 1;
+	if(ok) {
+		size_t first = runs.size();
+		runs.resize(first+nruns);
+		ok = fread(runs.data()+first, sizeof(run_t), nruns, in) == nruns;
+	}
+	fclose(in);
+
+	int status;
+	waitpid(child.pid, &status, 0);
+	if(!ok || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+		exit(WIFEXITED(status) && WEXITSTATUS(status) != 0 ? WEXITSTATUS(status) : 2);
+	}
+	scan.plan.merge(state, results);
+}
+
+// Adds the files in a directory (*.h5, in order of their names) or the
+// file itself to files.
+void add_input(const string &path, vector<string> &files)
+{
+	struct stat statbuf;
+	if(stat(path.c_str(), &statbuf) != 0) {
+		cerr << "Error(" << errno << "): stat() failed on " << path << endl;
+		exit(2);
+	}
+	if(!S_ISDIR(statbuf.st_mode)) {
+		files.push_back(path);
+		return;
+	}
+
+	DIR * dir = opendir(path.c_str());
+	if(dir == NULL) {
+		cerr << "Error(" << errno << "): opendir() failed on " << path << endl;
+		exit(2);
+	}
+	vector<string> names;
+	for(struct dirent * entry; (entry = readdir(dir)) != NULL; ) {
+		const string name = entry->d_name;
+		if(name.size() > 3 && name.compare(name.size()-3, 3, ".h5") == 0) {
+			names.push_back(path+"/"+name);
+		}
+	}
+	closedir(dir);
+	sort(names.begin(), names.end());
+	files.insert(files.end(), names.begin(), names.end());
 }
 
 int main(int argc, char * argv[])
 {
+	int argp_index;
+	argp_parse(&argp_argp, argc, argv, 0, &argp_index, 0);
+
 	// Check that all the input files exists
-	if(argc != 2) {
+	if(argc-argp_index < 1) {
 		cerr << "Error: bad number of arguments." << endl;
 		exit(1);
 	}
-	for(int i=1; i<argc; i++) {
-		struct stat statbuf;
-		if(stat(argv[i], &statbuf) != 0) {
-			cerr << "Error(" << errno << "): stat() failed on " << argv[i] << endl;
-			exit(2);
-		}
+	vector<string> files;
+	for(int i=argp_index; i<argc; i++) {
+		add_input(argv[i], files);
+	}
+	if(files.empty()) {
+		cerr << "Error: no input files." << endl;
+		exit(1);
 	}
 
-	// Read structural information from the first file
-	hid_t fh = H5Fopen(argv[1], H5F_ACC_RDONLY, H5P_DEFAULT);
-	HDFTableInfo events_info(fh, "events");
-	HDFTableInfo particles_info(fh, "particles");
-	cout << "--- Structural information ---" << endl;
-	events_info.printInfo();
-	particles_info.printInfo();
-
-	// field offsets
-	size_t eventid_offset = particles_info.field_offsets[events_info.findField("eventid")];
-	//size_t first_offset = events_info.field_offsets[events_info.findField("first")];
-	//size_t size_offset = events_info.field_offsets[events_info.findField("size")];
-	size_t x_offset = particles_info.field_offsets[particles_info.findField("boundary.x")];
-	size_t y_offset = particles_info.field_offsets[particles_info.findField("boundary.y")];
-	size_t z_offset = particles_info.field_offsets[particles_info.findField("boundary.z")];
-
-	// 1 MB buffer
-	const size_t BUFFER_SIZE = 1024*1024*1024;
-	unsigned char * data = new unsigned char[BUFFER_SIZE];
-	hsize_t maxrecords = max<size_t>(1, BUFFER_SIZE/particles_info.type_size);
+	// The selection options are a filter applied to all the queries
+	ostringstream filter;
+	filter.precision(17);
+	filter << "boundary.KE >= " << p_emin;
+	if(!std::isinf(p_emax)) filter << " && boundary.KE <= " << p_emax;
+	if(p_pid != 0) filter << " && pid == " << p_pid;
 
-	hsize_t N=0, Ngr=0, Nsp=0;
+	QueryPlan plan;
+	if(p_queries.empty()) {
+		ostringstream rsplit;
+		rsplit.precision(17);
+		rsplit << p_rsplit;
+		p_queries.push_back("N: count");
+		p_queries.push_back("Ngr: count where R < "+rsplit.str());
+		p_queries.push_back("Nsp: count where R >= "+rsplit.str());
+	}
+	const scan_t scan = compile_queries(plan, p_queries, filter.str());
 
-	for(hsize_t record=0, data_offset=-maxrecords; record<particles_info.nrecords; record++) {
-		if(data_offset+maxrecords == record) {
-			cout << "Loading records: " << record << " (" << 100*double(record)/particles_info.nrecords << "%)" << endl;
-			H5TBread_records(fh, "particles", record, min(maxrecords, particles_info.nrecords-record),
-				particles_info.type_size, particles_info.field_offsets, particles_info.field_sizes,
-				data
-			);
-			data_offset = record;
+	// Map: the files are analyzed in the main process or, spread over the
+	// processes in turn, in child processes. Reduce: the results are merged
+	// in the order of the files, so they do not depend on the processes.
+	const size_t nprocesses = min(files.size(), p_processes > 0 ? p_processes : p_threads);
+	QueryPlan::state_t state = plan.state();
+	vector<run_t> runs;
+	if(nprocesses <= 1) {
+		for(size_t i=0; i<files.size(); i++) {
+			int ret = analyze_file(files[i], scan, p_threads, i == 0, state, runs);
+			if(ret != 0) exit(ret);
 		}
-		size_t offset = (record - data_offset) * particles_info.type_size;
-
-		unsigned int & eventid = *(unsigned int*)(data + offset + eventid_offset);
-		//unsigned int & first = *(unsigned int*)(data + offset + first_offset);
-		//unsigned int & size = *(unsigned int*)(data + offset + size_offset);
-		double & x = *(double*)(data + offset + x_offset);
-		double & y = *(double*)(data + offset + y_offset);
-		double & z = *(double*)(data + offset + z_offset);
-
-		double R = sqrt(x*x + y*y + z*z);
+	} else {
+		const size_t nthreads = max<size_t>(1, p_threads/nprocesses);
+		p_buffer = max<size_t>(1, p_buffer/nprocesses);
+		cout << "Analyzing " << files.size() << " files with " << nprocesses << " processes of "
+		     << nthreads << " threads." << endl;
+		deque<child_t> children;
+		for(size_t i=0; i<files.size(); i++) {
+			if(children.size() == nprocesses) {
+				join_analysis(children.front(), scan, state, runs);
+				children.pop_front();
+			}
+			children.push_back(fork_analysis(vector<string>(1, files[i]), scan, nthreads));
+		}
+		for(; !children.empty(); children.pop_front()) {
+			join_analysis(children.front(), scan, state, runs);
+		}
+	}
 
-		//cout << offset << ": " << eventid << " <" << x << ", " << y << ", " << z << "> R=" << R << endl;
-		N++;
-		if(R < 6500) Ngr++;
-		else Nsp++;
+	// Runs
+	hsize_t nevents = 0, nparticles = 0;
+	map<double, size_t> cutoffs;
+	size_t unknown_cutoffs = 0;
+	for(const run_t &run : runs) {
+		nevents += run.event_size;
+		nparticles += run.particle_size;
+		if(std::isnan(run.cutoff)) {
+			unknown_cutoffs++;
+		} else {
+			cutoffs[run.cutoff]++;
+		}
+	}
+	cout << endl;
+	cout << "=== RUNS ===" << endl;
+	cout << "files: " << files.size() << endl;
+	cout << "runs: " << runs.size() << endl;
+	cout << "events: " << nevents << endl;
+	cout << "particles: " << nparticles << endl;
+	cout << "cutoffs:";
+	for(const pair<const double, size_t> &cutoff : cutoffs) {
+		cout << " " << cutoff.first << " (" << cutoff.second << (cutoff.second == 1 ? " run)" : " runs)");
 	}
+	if(unknown_cutoffs > 0) {
+		cout << " unknown (" << unknown_cutoffs << (unknown_cutoffs == 1 ? " run)" : " runs)");
+	}
+	cout << endl;
 
 	// Totals
 	cout << endl;
 	cout << "=== TOTALS ===" << endl;
-	cout << "N: " << N << endl;
-	cout << "Ngr: " << Ngr << endl;
-	cout << "Nsp: " << Nsp << endl;
-
-	// Clean up
-	delete[] data;
-	H5Fclose(fh);
+	cout.precision(12);
+	plan.print(cout, state);
 
 	return 0;
 }
@@ -3,325 +3,1352 @@
 #include <vector>
 #include <stdexcept>
 #include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <climits>
+#include <cstring>
+#include <cstdlib>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <queue>
+#include <unistd.h>
 #include <sys/stat.h>
 #include <hdf5.h>
 #include <hdf5_hl.h>
 
+#include "../src/OutputTables.hh"
+#include "../src/OutputReader.hh"
+#include "../src/ParticleIndex.hh"
+#include "../src/BlockReader.hh"
+#include "../src/RunSummary.hh"
+#include "../src/DirectChunks.hh"
+
 using namespace std;
 
-struct HDFTableInfo
+// Fills a row of the runs table from the attributes of an input file.
+void input_run_attributes(hid_t fh, run_t &run)
+{
+	try {
+		read_run_attributes(fh, run);
+	} catch(out_of_range &e) {
+		cerr << "Error getting attributes: " << e.what() << endl;
+		string_to_cstr("<MERGE ERROR>", run.model_file, sizeof(run_t::model_file));
+		run.model_crc = 0;
+		run.seed = 0;
+		run.cutoff = nan("");
+		run.gunradius = nan("");
+	}
+}
+
+// Runs are considered the same if they have the same file path (as given
+// on the command line of the merge that added them), seed, model and
+// numbers of rows.
+bool same_run(const run_t &a, const run_t &b)
 {
-	// abstract structure information
-	hsize_t nfields;
-	char ** field_names;
-	hid_t * field_types;
-	size_t * field_sizes;
-
-	// instance information
-	string name;
-	size_t * field_offsets;
-	size_t type_size;
-	hsize_t nrecords;
-
-	// methods
-	HDFTableInfo(hid_t group, string name);
-	~HDFTableInfo();
-	void printInfo();
-	size_t findField(const string & fieldname);
+	return strncmp(a.file_path, b.file_path, sizeof(run_t::file_path)) == 0
+		&& a.seed == b.seed && a.model_crc == b.model_crc
+		&& a.event_size == b.event_size && a.particle_size == b.particle_size;
+}
+
+// Rows of an input that are merged: the rows of one or more of its runs,
+// and where they go in the merged tables.
+struct part_t
+{
+	size_t input;
+	hsize_t event_first, event_size;
+	hsize_t particle_first, particle_size;
+	hsize_t event_offset, particle_offset;
 };
 
-HDFTableInfo::HDFTableInfo(hid_t group, string name_)
-: name(name_)
+// The runs of an input: the rows of its runs table if it is a merged file,
+// or a run made from its attributes.
+vector<run_t> input_runs(const string &input, OutputReader &reader)
 {
-	H5TBget_table_info(group, name.c_str(), &nfields, &nrecords);
+	if(H5Lexists(reader.file(), "runs", H5P_DEFAULT) > 0) {
+		vector<run_t> runs = reader.runs();
+		for(const run_t &run : runs) {
+			if(run.event_first + run.event_size > reader.nevents()
+			|| run.particle_first + run.particle_size > reader.nparticles()) {
+				throw runtime_error("its runs table does not match its events and particles");
+			}
+		}
+		return runs;
+	}
+
+	run_t run;
+	run.event_first = 0;
+	run.event_size = reader.nevents();
+	run.particle_first = 0;
+	run.particle_size = reader.nparticles();
+	string_to_cstr(input, run.file_path, sizeof(run_t::file_path));
+	input_run_attributes(reader.file(), run);
+	return vector<run_t>(1, run);
+}
 
-	field_names = new char*[nfields];
-	for(size_t i=0; i<nfields; i++) {
-		field_names[i] = new char[32];
+// Finds the runs of the inputs (those of the runs tables of merged inputs)
+// that are not in known_runs, and returns the inputs that have any. The
+// new runs are added to known_runs and to new_runs, with their row ranges
+// in the merged tables starting at the given offsets, and their rows to
+// parts. The summaries of the inputs whose runs are all new are added to
+// summary; unsummarized counts the other new runs.
+vector<string> scan_inputs(const vector<string> &inputs, vector<run_t> &known_runs,
+	hsize_t event_offset, hsize_t particle_offset, vector<part_t> &parts, vector<run_t> &new_runs,
+	RunSummary &summary, size_t &unsummarized)
+{
+	vector<string> accepted;
+	for(const string &input : inputs) {
+		vector<run_t> runs;
+		RunSummary run_summary;
+		bool has_summary;
+		try {
+			OutputReader reader(input);
+			runs = input_runs(input, reader);
+			has_summary = run_summary.read(reader.file());
+		} catch(const exception &e) {
+			cerr << "Error: " << input << ": " << e.what() << endl;
+			exit(2);
+		}
+
+		vector<bool> known(runs.size(), false);
+		size_t nknown = 0;
+		for(size_t i=0; i<runs.size(); i++) {
+			for(const run_t &known_run : known_runs) {
+				known[i] = known[i] || same_run(runs[i], known_run);
+			}
+			nknown += known[i];
+		}
+		if(nknown == runs.size()) {
+			cout << "Skipping: " << input << " (already merged)" << endl;
+			continue;
+		}
+
+		for(size_t i=0; i<runs.size(); i++) {
+			run_t run = runs[i];
+			if(known[i]) {
+				cout << "Skipping: " << input << ": " << run.file_path << " (already merged)" << endl;
+				continue;
+			}
+			// consecutive runs make one part
+			part_t * last = parts.empty() ? nullptr : &parts.back();
+			if(last != nullptr && last->input == accepted.size()
+			&& last->event_first + last->event_size == run.event_first
+			&& last->particle_first + last->particle_size == run.particle_first) {
+				last->event_size += run.event_size;
+				last->particle_size += run.particle_size;
+			} else {
+				const part_t part = {accepted.size(), run.event_first, run.event_size,
+					run.particle_first, run.particle_size, event_offset, particle_offset};
+				parts.push_back(part);
+			}
+			run.event_first = event_offset;
+			run.particle_first = particle_offset;
+			known_runs.push_back(run);
+			new_runs.push_back(run);
+			event_offset += run.event_size;
+			particle_offset += run.particle_size;
+		}
+
+		// the summary of an input covers all its runs
+		if(has_summary && nknown == 0) {
+			summary.merge(run_summary);
+		} else {
+			unsummarized += runs.size() - nknown;
+		}
+		accepted.push_back(input);
 	}
-	field_sizes = new size_t[nfields];
-	field_offsets = new size_t[nfields];
-	field_types = new hid_t[nfields];
+	return accepted;
+}
+
+// ---------------------------------------------------------------------
+// Virtual merging
+// ---------------------------------------------------------------------
+// Instead of copying the rows, the events and particles of the output are
+// HDF5 virtual datasets that map onto the tables in the input files, which
+// therefore have to be kept. The rows are read as they are in the inputs,
+// so the event IDs and the first particles of the events are relative to
+// each run; the merged values are stored in the datasets events_eventid,
+// events_first and particles_eventid.
 
-	hid_t dsid = H5Dopen(group, name.c_str(), H5P_DEFAULT);
+// The datatype of the dataset `name` in a file.
+hid_t table_type(const string &path, const string &name)
+{
+	hid_t fh = H5Fopen(path.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+	hid_t dsid = H5Dopen(fh, name.c_str(), H5P_DEFAULT);
+	hid_t type = H5Dget_type(dsid);
+	H5Dclose(dsid);
+	H5Fclose(fh);
+	return type;
+}
+
+bool same_table_type(hid_t fh, const string &name, hid_t type)
+{
+	hid_t dsid = H5Dopen(fh, name.c_str(), H5P_DEFAULT);
 	hid_t dstype = H5Dget_type(dsid);
-	type_size = H5Tget_size(dstype);
-	for(size_t i=0; i<nfields; i++) {
-		field_names[i] = H5Tget_member_name(dstype, i);
-		field_offsets[i] = H5Tget_member_offset(dstype, i);
-		field_types[i] = H5Tget_member_type(dstype, i);
-		field_sizes[i] = H5Tget_size(field_types[i]);
-	}
+	bool same = H5Tequal(dstype, type) > 0;
+	H5Tclose(dstype);
 	H5Dclose(dsid);
+	return same;
 }
 
-HDFTableInfo::~HDFTableInfo()
+// Whether the events and particles of all the inputs have the same layouts,
+// which their virtual datasets need. Checked before the output is written.
+bool same_layouts(const vector<string> &inputs)
 {
-	for(size_t i=0; i<nfields; i++) {
-		delete[] field_names[i];
+	hid_t events_type = table_type(inputs[0], "events");
+	hid_t particles_type = table_type(inputs[0], "particles");
+	bool same = true;
+	for(size_t i=1; same && i<inputs.size(); i++) {
+		hid_t fh = H5Fopen(inputs[i].c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+		same = same_table_type(fh, "events", events_type) && same_table_type(fh, "particles", particles_type);
+		H5Fclose(fh);
+		if(!same) {
+			// e.g. older files with 32-bit IDs, which a copy merge widens
+			cerr << "Error: " << inputs[i] << " has different table layouts than the other inputs." << endl;
+		}
 	}
-	delete[] field_names;
-	delete[] field_sizes;
-	delete[] field_offsets;
+	H5Tclose(events_type);
+	H5Tclose(particles_type);
+	return same;
 }
 
-size_t HDFTableInfo::findField(const string & fieldname)
+// Whether the inputs that are sorted merges can be merged: they are copied
+// in the original order of their particles, through particles_by_event
+// (which older versions of mergeruns did not write), and can not be mapped
+// by a virtual merge. Checked before the output is written.
+bool sorted_inputs_mergeable(const vector<string> &inputs, bool virtual_merge)
 {
-	for(size_t i=0; i<nfields; i++) {
-		if(fieldname == field_names[i]) {
-			return i;
+	for(const string &input : inputs) {
+		hid_t fh = H5Fopen(input.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+		const bool sorted = H5Lexists(fh, "particles_row", H5P_DEFAULT) > 0;
+		const bool by_event = H5Lexists(fh, "particles_by_event", H5P_DEFAULT) > 0;
+		H5Fclose(fh);
+		if(sorted && virtual_merge) {
+			cerr << "Error: " << input << " is a sorted merge, which a virtual merge can not map." << endl;
+			return false;
+		}
+		if(sorted && !by_event) {
+			cerr << "Error: " << input << " is a sorted merge without particles_by_event"
+			     << " (of an older version of mergeruns)." << endl;
+			return false;
 		}
 	}
-	throw out_of_range("Field `"+fieldname+"` not found!");
+	return true;
 }
 
-void HDFTableInfo::printInfo()
+// Creates a virtual dataset concatenating the rows of the parts in the
+// datasets `name` of the inputs, with the datatype of the dataset in the
+// first input.
+void create_virtual_table(hid_t fout, const string &name, const vector<string> &paths, const vector<part_t> &parts, bool particles)
 {
-	cout << "Table: " << name << endl;
-	cout << "  nfields: " << nfields << endl;
-	cout << "  nrecords: " << nrecords << endl;
-	cout << "  type_size: " << type_size << endl;
-	for(size_t i=0; i<nfields; i++) {
-		cout << "   - " << field_names[i] << " <" << field_offsets[i] << ", " << field_sizes[i] << ">" << endl;
+	hid_t type = table_type(paths[0], name);
+
+	hsize_t dims[] = {0};
+	for(const part_t &part : parts) {
+		dims[0] += particles ? part.particle_size : part.event_size;
 	}
+	hid_t vspace = H5Screate_simple(1, dims, NULL);
+	hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+	H5Pset_layout(dcpl, H5D_VIRTUAL);
+	for(const part_t &part : parts) {
+		const hsize_t first = particles ? part.particle_first : part.event_first;
+		const hsize_t size = particles ? part.particle_size : part.event_size;
+		const hsize_t offset = particles ? part.particle_offset : part.event_offset;
+		if(size == 0) continue;
+		const hsize_t source_dims[] = {first + size};
+		hid_t srcspace = H5Screate_simple(1, source_dims, NULL);
+		H5Sselect_hyperslab(srcspace, H5S_SELECT_SET, &first, NULL, &size, NULL);
+		H5Sselect_hyperslab(vspace, H5S_SELECT_SET, &offset, NULL, &size, NULL);
+		H5Pset_virtual(dcpl, vspace, paths[part.input].c_str(), name.c_str(), srcspace);
+		H5Sclose(srcspace);
+	}
+	H5Sselect_all(vspace);
+
+	hid_t dsid = H5Dcreate(fout, name.c_str(), type, vspace, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+	if(dsid < 0) {
+		throw runtime_error("unable to create the virtual dataset "+name);
+	}
+	H5Dclose(dsid);
+	H5Pclose(dcpl);
+	H5Sclose(vspace);
+	H5Tclose(type);
 }
 
-hid_t create_hdf5_string(size_t length)
+// A one-dimensional dataset of n values of type T.
+template<typename T>
+hid_t create_column(hid_t fout, const string &name, hsize_t n)
 {
-	hid_t ret = H5Tcopy(H5T_C_S1);
-	H5Tset_size(ret, length);
-	return ret;
+	const hsize_t dims[] = {n};
+	hid_t sid = H5Screate_simple(1, dims, NULL);
+	hid_t type = H5Type<T>::create();
+	hid_t dsid = H5Dcreate(fout, name.c_str(), type, sid, H5P_DEFAULT, H5P_DEFAULT, H5P_DEFAULT);
+	H5Tclose(type);
+	H5Sclose(sid);
+	return dsid;
 }
 
-void string_to_cstr(const std::string &src, char dst[], size_t target_size)
+template<typename T>
+void write_column(hid_t dsid, hsize_t offset, const vector<T> &values, hsize_t n)
 {
-	src.copy(dst, target_size-1);
-	for(size_t i=src.size(); i<target_size; i++) {
-		dst[i] = '\0';
+	hid_t fspace = H5Dget_space(dsid);
+	H5Sselect_hyperslab(fspace, H5S_SELECT_SET, &offset, NULL, &n, NULL);
+	hid_t mspace = H5Screate_simple(1, &n, NULL);
+	H5Dwrite(dsid, H5T<T>::hid, mspace, fspace, H5P_DEFAULT, values.data());
+	H5Sclose(mspace);
+	H5Sclose(fspace);
+}
+
+int merge_virtual(hid_t fout, const vector<string> &inputs, const vector<part_t> &parts, size_t buffer_size)
+{
+	typedef decltype(event_t::id) eventid_t;
+	typedef decltype(event_t::first) first_t;
+
+	vector<string> paths;
+	bool indexed = true;
+	for(const string &input : inputs) {
+		char path[PATH_MAX];
+		if(realpath(input.c_str(), path) == nullptr) {
+			cerr << "Error: realpath() failed on " << input << endl;
+			return 2;
+		}
+		paths.push_back(path);
+
+		hid_t fh = H5Fopen(input.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+		indexed = indexed && H5Lexists(fh, ParticleIndex::tablename, H5P_DEFAULT) > 0;
+		H5Fclose(fh);
+	}
+
+	hsize_t nevents = 0, nparticles = 0;
+	for(const part_t &part : parts) {
+		nevents += part.event_size;
+		nparticles += part.particle_size;
+	}
+	cout << "Mapping " << nevents << " events and " << nparticles << " particles." << endl;
+	create_virtual_table(fout, "events", paths, parts, false);
+	create_virtual_table(fout, "particles", paths, parts, true);
+
+	// the offset-corrected ID columns and the particle index
+	hid_t events_eventid = create_column<eventid_t>(fout, "events_eventid", nevents);
+	hid_t events_first = create_column<first_t>(fout, "events_first", nevents);
+	hid_t particles_eventid = create_column<eventid_t>(fout, "particles_eventid", nparticles);
+	HDFTable<particle_chunk_t> * particle_index = nullptr;
+	if(indexed) {
+		particle_index = new HDFTable<particle_chunk_t>(fout, ParticleIndex::tablename);
+	} else {
+		cout << "Not all inputs have a particle index, so the output will not have one." << endl;
+	}
+
+	vector<event_t> event_buffer(max<size_t>(1, buffer_size/sizeof(event_t)));
+	vector<eventid_t> ids(max<size_t>(1, buffer_size/sizeof(eventid_t)));
+	vector<first_t> firsts(ids.size());
+	for(const part_t &part : parts) {
+		const string &input = inputs[part.input];
+		cout << "Reading IDs: " << input << endl;
+		hid_t fh = H5Fopen(input.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+		// the IDs of an input that is a virtual merge itself are in its
+		// ID columns
+		const bool merged_ids = H5Lexists(fh, "particles_eventid", H5P_DEFAULT) > 0;
+		// the IDs are shifted from the rows of the part in the input to
+		// those in the output (modulo 2^64)
+		const hsize_t event_delta = part.event_offset - part.event_first;
+		const hsize_t particle_delta = part.particle_offset - part.particle_first;
+
+		for(hsize_t record=0, delta; record < part.event_size; record+=delta) {
+			delta = min<hsize_t>(part.event_size-record, min(event_buffer.size(), ids.size()));
+			if(merged_ids) {
+				hdf_read_column(fh, "events_eventid", part.event_first+record, delta, ids.data());
+				hdf_read_column(fh, "events_first", part.event_first+record, delta, firsts.data());
+			} else {
+				hdf_read_rows(fh, "events", part.event_first+record, delta, event_buffer.data());
+				for(hsize_t j=0; j<delta; j++) {
+					ids[j] = event_buffer[j].id;
+					firsts[j] = event_buffer[j].first;
+				}
+			}
+			for(hsize_t j=0; j<delta; j++) {
+				ids[j] += event_delta;
+				firsts[j] += particle_delta;
+			}
+			write_column(events_eventid, part.event_offset+record, ids, delta);
+			write_column(events_first, part.event_offset+record, firsts, delta);
+		}
+
+		const size_t id_offset[] = {0};
+		const size_t id_size[] = {sizeof(eventid_t)};
+		for(hsize_t record=0, delta; record < part.particle_size; record+=delta) {
+			delta = min<hsize_t>(part.particle_size-record, ids.size());
+			if(merged_ids) {
+				hdf_read_column(fh, "particles_eventid", part.particle_first+record, delta, ids.data());
+			} else {
+				H5TBread_fields_name(fh, "particles", "eventid", part.particle_first+record, delta,
+					sizeof(eventid_t), id_offset, id_size, ids.data());
+			}
+			for(hsize_t j=0; j<delta; j++) {
+				ids[j] += event_delta;
+			}
+			write_column(particles_eventid, part.particle_offset+record, ids, delta);
+		}
+
+		// the chunks of the index that overlap the part, clipped to it
+		if(particle_index != nullptr) {
+			hsize_t nfields, nchunks;
+			H5TBget_table_info(fh, ParticleIndex::tablename, &nfields, &nchunks);
+			vector<particle_chunk_t> chunks(nchunks);
+			hdf_read_rows(fh, ParticleIndex::tablename, 0, nchunks, chunks.data());
+			const hsize_t part_end = part.particle_first + part.particle_size;
+			vector<particle_chunk_t> clipped;
+			for(particle_chunk_t chunk : chunks) {
+				const hsize_t first = max(chunk.first, part.particle_first);
+				const hsize_t end = min(chunk.first + chunk.size, part_end);
+				if(first >= end) continue;
+				chunk.first = first + particle_delta;
+				chunk.size = end - first;
+				clipped.push_back(chunk);
+			}
+			if(!clipped.empty()) {
+				particle_index->append(clipped.data(), clipped.size());
+			}
+		}
+
+		H5Fclose(fh);
 	}
+
+	delete particle_index;
+	H5Dclose(events_eventid);
+	H5Dclose(events_first);
+	H5Dclose(particles_eventid);
+	return 0;
 }
 
-struct Run {
-	hsize_t event_first, event_size;
-	hsize_t particle_first, particle_size;
-	char file_path[64];
-	double cutoff, gunradius;
-	int seed;
-	char model_file[32];
-	unsigned int model_crc;
-
-	static const hsize_t nfields = 10;
-	static const char * names[nfields];
-	static const size_t offsets[nfields];
-	static const size_t sizes[nfields];
-	static const hid_t types[nfields];
-};
-const char * Run::names[] = {
-	"event_first", "event_size",
-	"particle_first", "particle_size",
-	"file_path",
-	"cutoff", "gunradius", "seed",
-	"model_file", "model_crc"
-};
-const size_t Run::offsets[] = {
-	HOFFSET(Run, event_first), HOFFSET(Run, event_size),
-	HOFFSET(Run, particle_first), HOFFSET(Run, particle_size),
-	HOFFSET(Run, file_path),
-	HOFFSET(Run, cutoff), HOFFSET(Run, gunradius), HOFFSET(Run, seed),
-	HOFFSET(Run, model_file), HOFFSET(Run, model_crc)
+// HDF5 might not be built thread-safe, so all the HDF5 calls of the
+// threads of a copy merge are serialized with hdf5_mutex. They are only
+// the I/O of the tables, though: their chunks are read and written as
+// DirectChunks, which are (de)compressed outside of the lock.
+mutex hdf5_mutex;
+
+// ---------------------------------------------------------------------
+// Sorted merging
+// ---------------------------------------------------------------------
+// With --sort, the particles are sorted by their PID and boundary.KE bin,
+// so that the particles of a species and energy range are in consecutive
+// chunks, which the particle index can then select without touching the
+// rest of the table. Particles of the same key keep their original order.
+//
+// This is an external sort: runs of particles that fit into the memory
+// budget are sorted and spilled into temporary files, which are merged
+// when the particles are written. The events keep referring to the
+// original (unsorted) order of the particles: the `particles_row`
+// dataset holds the original row of every sorted particle, its inverse
+// `particles_by_event` the sorted row of every particle in the original
+// order (so the first and size of an event are its range), and their
+// `eventid` columns refer back to the events.
+class ParticleSorter
+{
+	struct record_t
+	{
+		int pid;
+		long bin;
+		hsize_t row;
+		particle_t particle;
+
+		bool operator<(const record_t &r) const
+		{
+			if(pid != r.pid) return pid < r.pid;
+			if(bin != r.bin) return bin < r.bin;
+			return row < r.row;
+		}
+	};
+
+	struct spill_t
+	{
+		FILE * file;
+		hsize_t size, read;
+		vector<record_t> buffer;
+		size_t position;
+	};
+
+	const size_t memory, max_run;
+	const double bins_per_decade;
+	const string tmpdir;
+	vector<record_t> run;
+	vector<spill_t> spills;
+	hsize_t nrows;
+
+	public:
+		ParticleSorter(size_t memory_, double bins_per_decade_, const string &tmpdir_)
+		: memory(memory_), max_run(max<size_t>(1, memory/sizeof(record_t))),
+		  bins_per_decade(bins_per_decade_), tmpdir(tmpdir_), nrows(0)
+		{}
+
+		~ParticleSorter()
+		{
+			for(spill_t &spill : spills) {
+				if(spill.file != nullptr) fclose(spill.file);
+			}
+		}
+
+		void add(const particle_t &p)
+		{
+			record_t r;
+			r.pid = p.pid;
+			r.bin = p.boundary.KE > 0 ? static_cast<long>(floor(log10(p.boundary.KE)*bins_per_decade)) : LONG_MIN;
+			r.row = nrows++;
+			r.particle = p;
+			// grow the run up to exactly max_run records
+			if(run.size() == run.capacity()) {
+				run.reserve(min(max_run, max<size_t>(1024, 2*run.capacity())));
+			}
+			run.push_back(r);
+			if(run.size() == max_run) {
+				spill();
+			}
+		}
+
+		void write(ChunkWriter<particle_t> &particles, ParticleIndex * particle_index, hid_t fout, size_t buffer_size);
+
+	private:
+		void spill();
+		bool next(spill_t &spill);
+		void invert(hid_t fout, hsize_t n, size_t buffer_size);
 };
-const size_t Run::sizes[] = {
-	sizeof(Run::event_first), sizeof(Run::event_size),
-	sizeof(Run::particle_first), sizeof(Run::particle_size),
-	sizeof(Run::file_path),
-	sizeof(Run::cutoff), sizeof(Run::gunradius), sizeof(Run::seed),
-	sizeof(Run::model_file), sizeof(Run::model_crc)
+
+// Sorts the current run and writes it into an (unlinked) temporary file.
+void ParticleSorter::spill()
+{
+	sort(run.begin(), run.end());
+
+	string path = tmpdir+"/mergeruns.XXXXXX";
+	vector<char> cpath(path.begin(), path.end());
+	cpath.push_back(0);
+	int fd = mkstemp(cpath.data());
+	if(fd < 0) {
+		throw runtime_error("unable to create a temporary file in "+tmpdir);
+	}
+	unlink(cpath.data());
+
+	spill_t spill;
+	spill.file = fdopen(fd, "w+b");
+	spill.size = run.size();
+	spill.read = 0;
+	spill.position = 0;
+	if(fwrite(run.data(), sizeof(record_t), run.size(), spill.file) != run.size()) {
+		throw runtime_error("unable to write a temporary file in "+tmpdir);
+	}
+	rewind(spill.file);
+	spills.push_back(spill);
+	cout << " > sorted and spilled " << run.size() << " particles." << endl;
+	run.clear();
+}
+
+// Advances to the next record of a spill, refilling its buffer if needed.
+// Returns false when the spill is exhausted.
+bool ParticleSorter::next(spill_t &spill)
+{
+	if(++spill.position < spill.buffer.size()) {
+		return true;
+	}
+	size_t n = min<hsize_t>(spill.buffer.capacity(), spill.size-spill.read);
+	if(n == 0) {
+		return false;
+	}
+	spill.buffer.resize(n);
+	if(fread(spill.buffer.data(), sizeof(record_t), n, spill.file) != n) {
+		throw runtime_error("unable to read a temporary file");
+	}
+	spill.read += n;
+	spill.position = 0;
+	return true;
+}
+
+// Merges the spills into the particles table and the particles_row dataset.
+void ParticleSorter::write(ChunkWriter<particle_t> &particles, ParticleIndex * particle_index, hid_t fout, size_t buffer_size)
+{
+	// if everything fit into memory, the run is merged as an in-memory spill
+	if(spills.empty()) {
+		sort(run.begin(), run.end());
+		spill_t spill;
+		spill.file = nullptr;
+		spill.size = spill.read = run.size();
+		spill.position = 0;
+		spill.buffer.swap(run);
+		spills.push_back(spill);
+	} else if(!run.empty()) {
+		spill();
+	}
+	run.clear();
+	run.shrink_to_fit();
+
+	// the memory budget is shared by the read buffers of the spills
+	const size_t spill_buffer = max<size_t>(1, memory/sizeof(record_t)/max<size_t>(1, spills.size()));
+	typedef pair<const record_t*, size_t> head_t;
+	auto greater = [](const head_t &a, const head_t &b) {return *b.first < *a.first;};
+	priority_queue<head_t, vector<head_t>, decltype(greater)> heads(greater);
+	for(size_t i=0; i<spills.size(); i++) {
+		bool nonempty;
+		if(spills[i].file == nullptr) {
+			spills[i].position = 0;
+			nonempty = !spills[i].buffer.empty();
+		} else {
+			spills[i].buffer.reserve(spill_buffer);
+			spills[i].position = 0;
+			nonempty = next(spills[i]);
+		}
+		if(nonempty) {
+			heads.push(head_t(&spills[i].buffer[spills[i].position], i));
+		}
+	}
+
+	hid_t rows_dsid;
+	{
+		lock_guard<mutex> lock(hdf5_mutex);
+		const hsize_t dims[] = {0}, maxdims[] = {H5S_UNLIMITED}, chunk[] = {64*1024};
+		hid_t sid = H5Screate_simple(1, dims, maxdims);
+		hid_t dcpl = H5Pcreate(H5P_DATASET_CREATE);
+		H5Pset_chunk(dcpl, 1, chunk);
+		rows_dsid = H5Dcreate(fout, "particles_row", H5T_NATIVE_HSIZE, sid, H5P_DEFAULT, dcpl, H5P_DEFAULT);
+		H5Pclose(dcpl);
+		H5Sclose(sid);
+	}
+
+	vector<particle_t> block;
+	vector<hsize_t> rows;
+	block.reserve(max<size_t>(1, buffer_size/sizeof(particle_t)));
+	rows.reserve(block.capacity());
+	hsize_t written = 0;
+	while(!heads.empty() || !block.empty()) {
+		if(!heads.empty()) {
+			head_t head = heads.top();
+			heads.pop();
+			block.push_back(head.first->particle);
+			rows.push_back(head.first->row);
+			spill_t &spill = spills[head.second];
+			if(next(spill)) {
+				heads.push(head_t(&spill.buffer[spill.position], head.second));
+			}
+		}
+
+		if(block.size() == block.capacity() || (heads.empty() && !block.empty())) {
+			particles.append(block.data(), block.size());
+
+			lock_guard<mutex> lock(hdf5_mutex);
+			if(particle_index != nullptr) {
+				for(const particle_t &particle : block) {
+					particle_index->add(particle);
+				}
+			}
+			const hsize_t extent[] = {written+rows.size()};
+			hsize_t n = rows.size();
+			H5Dset_extent(rows_dsid, extent);
+			hid_t fspace = H5Dget_space(rows_dsid);
+			H5Sselect_hyperslab(fspace, H5S_SELECT_SET, &written, NULL, &n, NULL);
+			hid_t mspace = H5Screate_simple(1, &n, NULL);
+			H5Dwrite(rows_dsid, H5T_NATIVE_HSIZE, mspace, fspace, H5P_DEFAULT, rows.data());
+			H5Sclose(mspace);
+			H5Sclose(fspace);
+
+			written += n;
+			cout << " > wrote " << written << " sorted particles." << endl;
+			block.clear();
+			rows.clear();
+		}
+	}
+	{
+		lock_guard<mutex> lock(hdf5_mutex);
+		H5Dclose(rows_dsid);
+	}
+
+	for(spill_t &spill : spills) {
+		vector<record_t>().swap(spill.buffer);
+	}
+	invert(fout, written, buffer_size);
+}
+
+// Writes particles_by_event, the inverse of particles_row, in windows of
+// original rows that fit into the memory budget, with a pass over
+// particles_row for each (a single one, unless the inverse alone takes
+// more than the budget).
+void ParticleSorter::invert(hid_t fout, hsize_t n, size_t buffer_size)
+{
+	const hsize_t window = max<hsize_t>(1, memory/sizeof(hsize_t));
+	vector<hsize_t> inverse(min(window, n));
+	vector<hsize_t> rows(max<size_t>(1, buffer_size/sizeof(hsize_t)));
+	hid_t dsid;
+	{
+		lock_guard<mutex> lock(hdf5_mutex);
+		dsid = create_column<hsize_t>(fout, "particles_by_event", n);
+	}
+	for(hsize_t lo=0; lo<n; lo+=window) {
+		const hsize_t hi = min(n, lo+window);
+		for(hsize_t first=0, count; first<n; first+=count) {
+			count = min<hsize_t>(rows.size(), n-first);
+			{
+				lock_guard<mutex> lock(hdf5_mutex);
+				if(hdf_read_column(fout, "particles_row", first, count, rows.data()) < 0) {
+					throw runtime_error("unable to read particles_row");
+				}
+			}
+			for(hsize_t j=0; j<count; j++) {
+				if(rows[j] >= lo && rows[j] < hi) {
+					inverse[rows[j]-lo] = first+j;
+				}
+			}
+		}
+		lock_guard<mutex> lock(hdf5_mutex);
+		write_column(dsid, lo, inverse, hi-lo);
+	}
+	cout << " > wrote the rows of the particles by event." << endl;
+	lock_guard<mutex> lock(hdf5_mutex);
+	H5Dclose(dsid);
+}
+
+// ---------------------------------------------------------------------
+// Copy merging
+// ---------------------------------------------------------------------
+// The inputs are read in blocks, ahead of the main thread, by the reader
+// threads of a BlockReader, which also decompress the chunks and shift the
+// IDs from the rows of the parts in the inputs to those in the output. The
+// main thread appends the blocks in the order of the parts to ChunkWriters, whose threads compress the
+// chunks of the output. Only the raw I/O of either is serialized.
+
+// A block of events or particles of a part, starting at the row `start`
+// of its input.
+struct block_request_t
+{
+	size_t part;
+	bool particles;
+	hsize_t start, size;
 };
-const hid_t Run::types[] = {
-	H5T_NATIVE_HSIZE, H5T_NATIVE_HSIZE,
-	H5T_NATIVE_HSIZE, H5T_NATIVE_HSIZE,
-	create_hdf5_string(sizeof(Run::file_path)),
-	H5T_NATIVE_DOUBLE, H5T_NATIVE_DOUBLE, H5T_NATIVE_INT,
-	create_hdf5_string(sizeof(Run::model_file)), H5T_NATIVE_UINT
+
+typedef BlockReader<block_request_t> merge_reader_t;
+
+// Reads the blocks of the inputs, keeping an input open per reader thread.
+// The blocks start at chunk boundaries, so that the chunks of tables that
+// allow it can be read as DirectChunks; the rest is read through HDF5.
+// Errors are thrown as std::runtime_error, which the BlockReader hands to
+// the writer.
+class MergeReader
+{
+	// the input open by a reader thread
+	struct open_t
+	{
+		size_t input;
+		hid_t file;
+		DirectChunks * events, * particles;
+		vector<DirectChunks::raw_t> raw;
+		// whether the input is a virtual merge, whose rows hold the IDs of
+		// its runs and whose merged IDs are in separate columns
+		bool merged_ids;
+		vector<hsize_t> ids, firsts;
+		// whether the input is a sorted merge, whose particles are read in
+		// their original order
+		bool sorted;
+		vector<hsize_t> order;
+		vector<particle_t> sorted_rows;
+	};
+
+	const vector<string> &inputs;
+	const vector<part_t> &parts;
+	vector<open_t> open;
+
+	public:
+		MergeReader(const vector<string> &inputs_, const vector<part_t> &parts_, size_t nreaders)
+		: inputs(inputs_), parts(parts_), open(nreaders)
+		{
+			for(open_t &in : open) {
+				in.input = inputs.size();
+				in.file = -1;
+				in.events = in.particles = nullptr;
+				in.merged_ids = in.sorted = false;
+			}
+		}
+
+		~MergeReader()
+		{
+			for(open_t &in : open) {
+				close(in);
+			}
+		}
+
+		void read(merge_reader_t::block_t &block, size_t reader)
+		{
+			const block_request_t &request = block.request;
+			const part_t &part = parts[request.part];
+			const string &input = inputs[part.input];
+			open_t &in = open[reader];
+			const size_t row_size = request.particles ? sizeof(particle_t) : sizeof(event_t);
+			block.data.resize(request.size*row_size);
+
+			bool direct;
+			size_t nchunks = 0;
+			hsize_t chunk_rows = 0;
+			DirectChunks * chunks;
+			{
+				lock_guard<mutex> lock(hdf5_mutex);
+				if(in.input != part.input) {
+					close(in);
+					in.input = part.input;
+					in.file = H5Fopen(input.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+					if(in.file < 0) {
+						throw runtime_error(input+": unable to open the file");
+					}
+					in.events = DirectChunks::open<event_t>(in.file, "events");
+					in.particles = DirectChunks::open<particle_t>(in.file, "particles");
+					in.merged_ids = H5Lexists(in.file, "particles_eventid", H5P_DEFAULT) > 0;
+					in.sorted = H5Lexists(in.file, "particles_row", H5P_DEFAULT) > 0;
+				}
+
+				chunks = request.particles ? in.particles : in.events;
+				direct = !in.merged_ids && !(in.sorted && request.particles)
+					&& chunks->usable() && request.start % chunks->chunkRows() == 0;
+				if(direct) {
+					chunk_rows = chunks->chunkRows();
+					nchunks = (request.size + chunk_rows - 1)/chunk_rows;
+					if(in.raw.size() < nchunks) {
+						in.raw.resize(nchunks);
+					}
+				}
+				for(size_t k=0; direct && k<nchunks; k++) {
+					direct = chunks->read(request.start + k*chunk_rows, in.raw[k]);
+				}
+
+				// the padding of the rows is written to the output as it is, so
+				// the buffer is cleared rather than left with the previous block
+				if(!direct && in.sorted && request.particles) {
+					read_by_event(in, request, block);
+				} else if(!direct) {
+					memset(block.data.data(), 0, block.data.size());
+					const herr_t ret = request.particles
+						? hdf_read_rows(in.file, "particles", request.start, request.size, reinterpret_cast<particle_t*>(block.data.data()))
+						: hdf_read_rows(in.file, "events", request.start, request.size, reinterpret_cast<event_t*>(block.data.data()));
+					if(ret < 0) {
+						throw runtime_error(input+": unable to read the "+(request.particles ? "particles" : "events"));
+					}
+				}
+				if(in.merged_ids) {
+					read_merged_ids(in, request, block);
+				}
+			}
+
+			for(size_t k=0; k<nchunks && direct; k++) {
+				try {
+					chunks->decode(in.raw[k], block.data.data() + k*chunk_rows*row_size, min<hsize_t>(chunk_rows, request.size - k*chunk_rows));
+				} catch(const exception &e) {
+					throw runtime_error(input+": "+e.what());
+				}
+			}
+
+			// modulo 2^64, as the rows of the part may come after those of
+			// the output
+			const hsize_t event_delta = part.event_offset - part.event_first;
+			const hsize_t particle_delta = part.particle_offset - part.particle_first;
+			if(request.particles) {
+				particle_t * particles = reinterpret_cast<particle_t*>(block.data.data());
+				for(hsize_t j=0; j<request.size; j++) {
+					particles[j].eventid += event_delta;
+				}
+			} else {
+				event_t * events = reinterpret_cast<event_t*>(block.data.data());
+				for(hsize_t j=0; j<request.size; j++) {
+					events[j].first += particle_delta;
+					events[j].id += event_delta;
+				}
+			}
+		}
+
+	private:
+		// replaces the IDs of the runs in a block of a virtual merge by the
+		// merged ones, as OutputReader does (under hdf5_mutex)
+		void read_merged_ids(open_t &in, const block_request_t &request, merge_reader_t::block_t &block)
+		{
+			in.ids.resize(request.size);
+			in.firsts.resize(request.size);
+			herr_t ret;
+			if(request.particles) {
+				ret = hdf_read_column(in.file, "particles_eventid", request.start, request.size, in.ids.data());
+				particle_t * particles = reinterpret_cast<particle_t*>(block.data.data());
+				for(hsize_t j=0; j<request.size; j++) {
+					particles[j].eventid = in.ids[j];
+				}
+			} else {
+				ret = min(hdf_read_column(in.file, "events_eventid", request.start, request.size, in.ids.data()),
+					hdf_read_column(in.file, "events_first", request.start, request.size, in.firsts.data()));
+				event_t * events = reinterpret_cast<event_t*>(block.data.data());
+				for(hsize_t j=0; j<request.size; j++) {
+					events[j].id = in.ids[j];
+					events[j].first = in.firsts[j];
+				}
+			}
+			if(ret < 0) {
+				throw runtime_error(inputs[in.input]+": unable to read the merged IDs");
+			}
+		}
+
+		// reads the particles of a block of a sorted merge in their original
+		// order, from the rows that its particles_by_event gives for them;
+		// the rows are read in ascending order, so that every chunk is
+		// decompressed once (under hdf5_mutex)
+		void read_by_event(open_t &in, const block_request_t &request, merge_reader_t::block_t &block)
+		{
+			in.ids.resize(request.size);
+			in.firsts.resize(request.size);
+			in.order.resize(request.size);
+			in.sorted_rows.resize(request.size);
+			if(hdf_read_column(in.file, "particles_by_event", request.start, request.size, in.ids.data()) < 0) {
+				throw runtime_error(inputs[in.input]+": unable to read particles_by_event");
+			}
+			iota(in.order.begin(), in.order.end(), hsize_t(0));
+			const vector<hsize_t> &rows = in.ids;
+			sort(in.order.begin(), in.order.end(), [&rows](hsize_t a, hsize_t b) {return rows[a] < rows[b];});
+			for(hsize_t j=0; j<request.size; j++) {
+				in.firsts[j] = rows[in.order[j]];
+			}
+			memset(in.sorted_rows.data(), 0, request.size*sizeof(particle_t));
+			if(hdf_read_rows_at(in.file, "particles", in.firsts.data(), request.size, in.sorted_rows.data()) < 0) {
+				throw runtime_error(inputs[in.input]+": unable to read the particles");
+			}
+			particle_t * particles = reinterpret_cast<particle_t*>(block.data.data());
+			for(hsize_t j=0; j<request.size; j++) {
+				particles[in.order[j]] = in.sorted_rows[j];
+			}
+		}
+
+		void close(open_t &in)
+		{
+			delete in.events;
+			delete in.particles;
+			in.events = in.particles = nullptr;
+			if(in.file >= 0) H5Fclose(in.file);
+			in.file = -1;
+		}
 };
 
-template<typename T>
-T hdf_read_attribute(hid_t loc, const string & name, hid_t type)
+// Adds the requests for the rows [first, first+size) of a part, in blocks
+// of block rows that end at multiples of block in the input, so that they
+// start at chunk boundaries (but the first).
+void add_requests(vector<block_request_t> &requests, size_t part, bool particles, hsize_t first, hsize_t size, hsize_t block)
+{
+	const hsize_t end = first + size;
+	for(hsize_t record=first, next; record < end; record=next) {
+		next = min(end, (record/block + 1)*block);
+		const block_request_t request = {part, particles, record, next - record};
+		requests.push_back(request);
+	}
+}
+
+// The rows of the parts are appended to the events and particles tables of
+// fout, at the offsets of the parts. With a sorter, the particles are
+// passed to it and written once all the inputs have been read. The inputs
+// are read in blocks of about buffer_size bytes (whole chunks), up to
+// nbuffers blocks ahead, with nthreads threads, and as many compress the
+// particles. The particles of sorted inputs are read in blocks of
+// sorted_buffer_size bytes, as every block reads from all the bins of the
+// input. Returns non-zero if the output can not be written.
+int merge_copy(hid_t fout, ParticleIndex * particle_index, ParticleSorter * sorter,
+	const vector<string> &inputs, const vector<part_t> &parts,
+	size_t buffer_size, size_t sorted_buffer_size, size_t nbuffers, size_t nthreads)
 {
-	hid_t attr = H5Aopen(loc, name.c_str(), H5P_DEFAULT);
-	if(attr < 0) {
-		throw out_of_range("unable to open attribute ("+name+")");
+	const hsize_t event_block = HDF_CHUNK_SIZE*max<size_t>(1, buffer_size/sizeof(event_t)/HDF_CHUNK_SIZE);
+	const hsize_t particle_block = HDF_CHUNK_SIZE*max<size_t>(1, buffer_size/sizeof(particle_t)/HDF_CHUNK_SIZE);
+	const hsize_t sorted_block = HDF_CHUNK_SIZE*max<size_t>(1, max(buffer_size, sorted_buffer_size)/sizeof(particle_t)/HDF_CHUNK_SIZE);
+	vector<bool> sorted;
+	for(const string &input : inputs) {
+		hid_t fh = H5Fopen(input.c_str(), H5F_ACC_RDONLY, H5P_DEFAULT);
+		sorted.push_back(H5Lexists(fh, "particles_row", H5P_DEFAULT) > 0);
+		H5Fclose(fh);
+	}
+	vector<block_request_t> requests;
+	for(size_t i=0; i<parts.size(); i++) {
+		const part_t &part = parts[i];
+		add_requests(requests, i, false, part.event_first, part.event_size, event_block);
+		add_requests(requests, i, true, part.particle_first, part.particle_size,
+			sorted[part.input] ? sorted_block : particle_block);
 	}
 
-	T buf;
-	H5Aread(attr, type, &buf);
-	H5Aclose(attr);
-	return buf;
+	ChunkWriter<event_t> events(fout, "events", hdf5_mutex, 1);
+	ChunkWriter<particle_t> particles(fout, "particles", hdf5_mutex, nthreads);
+	MergeReader merge_reader(inputs, parts, nthreads);
+	try {
+		merge_reader_t reader(requests, nbuffers,
+			[&merge_reader](merge_reader_t::block_t &block, size_t index) {merge_reader.read(block, index);},
+			nthreads
+		);
+
+		size_t input = inputs.size();
+		for(merge_reader_t::block_t * block; (block = reader.next()) != nullptr; reader.release(block)) {
+			const block_request_t &request = block->request;
+			if(parts[request.part].input != input) {
+				input = parts[request.part].input;
+				cout << "Writing: " << inputs[input] << endl;
+			}
+
+			if(!request.particles) {
+				cout << " > copying " << request.size << " events." << endl;
+				events.append(reinterpret_cast<const event_t*>(block->data.data()), request.size);
+				continue;
+			}
+
+			const particle_t * block_particles = reinterpret_cast<const particle_t*>(block->data.data());
+			if(sorter != nullptr) {
+				for(hsize_t j=0; j<request.size; j++) {
+					sorter->add(block_particles[j]);
+				}
+			} else {
+				cout << " > copying " << request.size << " particles." << endl;
+				if(particle_index != nullptr) {
+					lock_guard<mutex> lock(hdf5_mutex);
+					for(hsize_t j=0; j<request.size; j++) {
+						particle_index->add(block_particles[j]);
+					}
+				}
+				particles.append(block_particles, request.size);
+			}
+		}
+
+		if(sorter != nullptr) {
+			cout << "--- Writing sorted particles ---" << endl;
+			sorter->write(particles, particle_index, fout, buffer_size);
+		}
+		events.finish();
+		particles.finish();
+		if(particle_index != nullptr) {
+			particle_index->flush();
+		}
+	} catch(const exception &e) {
+		cerr << "Error: " << e.what() << endl;
+		return 3;
+	}
+	return 0;
 }
 
-string hdf_read_attribute_string(hid_t loc, const string & name)
+// ---------------------------------------------------------------------
+// Appending
+// ---------------------------------------------------------------------
+// Only the tables of an unsorted copy merge can be extended: the events
+// and particles of a virtual merge are mapped from its inputs, and its
+// merged IDs (particles_eventid) would not cover the appended rows; the
+// appended particles of a sorted merge would be out of order and not be in
+// its permutations. Returns why fout can not be appended to, or an empty
+// string if it can.
+string append_refusal(hid_t fout)
 {
-	hid_t attr = H5Aopen(loc, name.c_str(), H5P_DEFAULT);
-	if(attr < 0) {
-		throw out_of_range("unable to open attribute ("+name+")");
+	for(const char * name : {"events", "particles"}) {
+		// a missing table is reported when it is opened
+		if(H5Lexists(fout, name, H5P_DEFAULT) <= 0) continue;
+		hid_t dsid = H5Dopen(fout, name, H5P_DEFAULT);
+		hid_t dcpl = H5Dget_create_plist(dsid);
+		const bool is_virtual = H5Pget_layout(dcpl) == H5D_VIRTUAL;
+		H5Pclose(dcpl);
+		H5Dclose(dsid);
+		if(is_virtual) {
+			return string("its ")+name+" are a virtual dataset (a virtual merge)";
+		}
 	}
+	if(H5Lexists(fout, "particles_eventid", H5P_DEFAULT) > 0) {
+		return "it has merged event IDs (particles_eventid)";
+	}
+	if(H5Lexists(fout, "particles_row", H5P_DEFAULT) > 0 || H5Aexists(fout, "particles_sort_bins") > 0) {
+		return "its particles are sorted (--sort)";
+	}
+	return "";
+}
 
-	hid_t type = H5Aget_type(attr);
-	size_t type_size = H5Tget_size(type);
-	char * buf = new char[type_size+1];
-	H5Aread(attr, type, buf);
-	H5Tclose(type);
-	H5Aclose(attr);
-	buf[type_size] = 0;
-	string ret(buf);
-	delete[] buf;
-	return ret;
+// The number of rows of the table `name` of fout (0 if there is none).
+hsize_t table_rows(hid_t fout, const char * name)
+{
+	hsize_t nfields, nrows = 0;
+	if(H5Lexists(fout, name, H5P_DEFAULT) > 0) {
+		H5TBget_table_info(fout, name, &nfields, &nrows);
+	}
+	return nrows;
 }
 
+// Drops the rows of the table `name` of fout beyond the first nrows, which
+// a failed merge appended. Returns false if they can not be dropped.
+bool truncate_table(hid_t fout, const char * name, hsize_t nrows)
+{
+	if(H5Lexists(fout, name, H5P_DEFAULT) <= 0) return true;
+	hid_t dsid = H5Dopen(fout, name, H5P_DEFAULT);
+	if(dsid < 0) return false;
+	const herr_t ret = H5Dset_extent(dsid, &nrows);
+	H5Dclose(dsid);
+	return ret >= 0;
+}
+
+// ---------------------------------------------------------------------
+// Argument parser settings
+// ---------------------------------------------------------------------
+#include <argp.h>
+
+#define PC_VIRT 1001
+#define PC_BUF  1002
+#define PC_NOZ  1003
+#define PC_APND 1004
+#define PC_SORT 1005
+#define PC_MEM  1006
+#define PC_TMP  1007
+#define PC_PREF 1008
+
+const argp_option argp_options[] = {
+	{"output", 'o', "FILE", 0, "write the merged file to FILE (default: outfile.h5)", 0},
+	{"virtual", PC_VIRT, 0, 0, "do not copy the events and particles, but map"
+		" them from the input files with HDF5 virtual datasets (the inputs have"
+		" to be kept)", 0},
+	{"threads", 'j', "N", 0, "read and compress with N threads each (default:"
+		" the number of cores)", 0},
+	{"buffer", PC_BUF, "MB", 0, "read the inputs in blocks of MB megabytes"
+		" (default: 1)", 0},
+	{"prefetch", PC_PREF, "N", 0, "read up to N blocks ahead of the writer"
+		" (default: 4 per thread)", 0},
+	{"nocompress", PC_NOZ, 0, 0, "do not compress the merged tables", 0},
+	{"append", PC_APND, 0, 0, "if the output file exists, append the runs"
+		" that are not in it yet instead of overwriting it", 0},
+	{"sort", PC_SORT, "BINS", OPTION_ARG_OPTIONAL, "sort the particles by PID"
+		" and boundary.KE, in BINS bins per decade (default: 10)", 0},
+	{"memory", PC_MEM, "MB", 0, "memory used for sorting, beyond which the"
+		" particles are spilled into temporary files, and for reading inputs"
+		" that are sorted merges (default: 1024)", 0},
+	{"tmpdir", PC_TMP, "DIR", 0, "directory of the temporary files (default:"
+		" $TMPDIR or /tmp)", 0},
+	{0, 0, 0, 0, 0, 0}
+};
+
+string p_output = "outfile.h5";
+bool p_virtual = false;
+size_t p_threads = max(1u, thread::hardware_concurrency());
+size_t p_buffer = 1;
+size_t p_prefetch = 0;
+bool p_compress = true;
+bool p_append = false;
+double p_sort = 0.0;
+size_t p_memory = 1024;
+string p_tmpdir = getenv("TMPDIR") ? getenv("TMPDIR") : "/tmp";
+
+error_t argp_parser(int key, char *arg, struct argp_state *state) {
+	switch(key) {
+		case 'o':
+			p_output = arg;
+			break;
+		case PC_VIRT:
+			p_virtual = true;
+			break;
+		case 'j':
+			p_threads = max(1, atoi(arg));
+			break;
+		case PC_BUF:
+			p_buffer = max(1, atoi(arg));
+			break;
+		case PC_PREF:
+			p_prefetch = max(1, atoi(arg));
+			break;
+		case PC_NOZ:
+			p_compress = false;
+			break;
+		case PC_APND:
+			p_append = true;
+			break;
+		case PC_SORT:
+			p_sort = arg ? atof(arg) : 10.0;
+			if(!(p_sort > 0)) {
+				argp_error(state, "the number of bins must be positive");
+			}
+			break;
+		case PC_MEM:
+			p_memory = max(1, atoi(arg));
+			break;
+		case PC_TMP:
+			p_tmpdir = arg;
+			break;
+		default:
+			return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+const argp argp_argp = {
+	argp_options, &argp_parser, "FILE...",
+	"Merges fgamma output files into one file.",
+	0, 0, 0
+};
+
 int main(int argc, char * argv[])
 {
+	int argp_index;
+	argp_parse(&argp_argp, argc, argv, 0, &argp_index, 0);
+
 	// Check that all the input files exists
-	if(argc <= 1) {
+	if(argc <= argp_index) {
 		cerr << "Error: no input files given." << endl;
 		exit(1);
 	}
-	for(int i=1; i<argc; i++) {
+	for(int i=argp_index; i<argc; i++) {
 		struct stat statbuf;
 		if(stat(argv[i], &statbuf) != 0) {
 			cerr << "Error(" << errno << "): stat() failed on " << argv[i] << endl;
 			exit(2);
 		}
 	}
+	const vector<string> inputs(argv+argp_index, argv+argc);
 
 	// Read structural information from the first file
-	hid_t fh_first = H5Fopen(argv[1], H5F_ACC_RDONLY, H5P_DEFAULT);
-	HDFTableInfo events_info(fh_first, "events");
-	HDFTableInfo particles_info(fh_first, "particles");
-	cout << "--- Structural information ---" << endl;
-	events_info.printInfo();
-	particles_info.printInfo();
-	H5Fclose(fh_first);
-
-	// Create the output file and tables within
-	hid_t fout = H5Fcreate("outfile.h5", H5F_ACC_TRUNC, H5P_DEFAULT, H5P_DEFAULT);
-	{
-		// create the runs table
-		H5TBmake_table("Runs", fout, "runs", Run::nfields,
-			0, sizeof(Run), Run::names, Run::offsets, Run::types,
-			1000, 0, H5P_DEFAULT, 0
-		);
+	try {
+		OutputReader first(inputs[0]);
+		cout << "--- Structural information ---" << endl;
+		first.eventsInfo().printInfo();
+		first.particlesInfo().printInfo();
+	} catch(const exception &e) {
+		cerr << "Error: " << inputs[0] << ": " << e.what() << endl;
+		exit(2);
 	}
-	H5TBmake_table("Particles", fout, "particles", particles_info.nfields,
-		0, particles_info.type_size, (const char**)particles_info.field_names,
-		particles_info.field_offsets, particles_info.field_types,
-		1000, 0, H5P_DEFAULT, 0
-	);
-	H5TBmake_table("Events", fout, "events", events_info.nfields,
-		0, events_info.type_size, (const char**)events_info.field_names,
-		events_info.field_offsets, events_info.field_types,
-		1000, 0, H5P_DEFAULT, 0
-	);
-
-	// Loop over input files and combine them to an output file
-	cout << "--- Merging files ---" << endl;
-	hsize_t particle_offset = 0, event_offset = 0;
-	// 1 MB buffer
-	const size_t BUFFER_SIZE = 1024*1024;
-	unsigned char * data = new unsigned char[BUFFER_SIZE];
-
-	for(int i=1; i<argc; i++) {
-		cout << "Reading: " << argv[i] << endl;
-		hid_t fh = H5Fopen(argv[i], H5F_ACC_RDONLY, H5P_DEFAULT);
-		HDFTableInfo this_events_info(fh, "events");
-		HDFTableInfo this_particles_info(fh, "particles");
-
-		// add the run attributes
-		Run run;
-		run.event_first = event_offset;
-		run.event_size = this_events_info.nrecords;
-		run.particle_first = particle_offset;
-		run.particle_size = this_particles_info.nrecords;
-		string_to_cstr(argv[i], run.file_path, sizeof(Run::file_path));
+
+	struct stat statbuf;
+	const bool append = p_append && stat(p_output.c_str(), &statbuf) == 0;
+	if(append && p_virtual) {
+		cerr << "Error: can not append to a virtual merge." << endl;
+		exit(1);
+	}
+	if((p_virtual && !same_layouts(inputs)) || !sorted_inputs_mergeable(inputs, p_virtual)) {
+		exit(4);
+	}
+	if(p_sort > 0 && (p_virtual || append)) {
+		cerr << "Error: --sort can not be used with --virtual or --append." << endl;
+		exit(1);
+	}
+
+	hid_t fout;
+	if(append) {
+		fout = H5Fopen(p_output.c_str(), H5F_ACC_RDWR, H5P_DEFAULT);
+	} else {
+		// Virtual datasets need the 1.10 file format
+		hid_t fapl = H5Pcreate(H5P_FILE_ACCESS);
+		if(p_virtual) {
+			H5Pset_libver_bounds(fapl, H5F_LIBVER_V110, H5F_LIBVER_LATEST);
+		}
+		fout = H5Fcreate(p_output.c_str(), H5F_ACC_TRUNC, H5P_DEFAULT, fapl);
+		H5Pclose(fapl);
+	}
+	if(fout < 0) {
+		cerr << "Error: unable to open " << p_output << endl;
+		exit(3);
+	}
+
+	// The runs already in the output, if appending
+	HDFTable<run_t> * runs;
+	HDFTable<event_t> * events = nullptr;
+	HDFTable<particle_t> * particles = nullptr;
+	ParticleIndex * particle_index = nullptr;
+	vector<run_t> known_runs;
+	if(append) {
+		const string refusal = append_refusal(fout);
+		if(!refusal.empty()) {
+			cerr << "Error: can not append to " << p_output << ": " << refusal << "." << endl;
+			exit(4);
+		}
 		try {
-			string_to_cstr(hdf_read_attribute_string(fh, "model_file"), run.model_file, sizeof(Run::model_file));
-			run.model_crc = hdf_read_attribute<unsigned int>(fh, "model_crc", H5T_NATIVE_UINT);
-			run.seed = hdf_read_attribute<int>(fh, "seed", H5T_NATIVE_INT);
-			run.cutoff = hdf_read_attribute<double>(fh, "cutoff", H5T_NATIVE_DOUBLE);
-			run.gunradius = hdf_read_attribute<double>(fh, "gunradius", H5T_NATIVE_DOUBLE);
-		} catch(out_of_range &e) {
-			cerr << "Error getting attributes: " << e.what() << endl;
-			string_to_cstr("<MERGE ERROR>", run.model_file, sizeof(Run::model_file));
-			run.model_crc = 0;
-			run.seed = 0;
-			run.cutoff = nan("");
-			run.gunradius = nan("");
-		}
-		H5TBappend_records(fout, "runs", 1, sizeof(Run), Run::offsets, Run::sizes, &run);
+			runs = new HDFTable<run_t>(fout, "runs", hdf_table_open);
+			events = new HDFTable<event_t>(fout, "events", hdf_table_open);
+			particles = new HDFTable<particle_t>(fout, "particles", hdf_table_open);
+		} catch(exception &e) {
+			// e.g. a file merged with 32-bit IDs
+			cerr << "Error: can not append to " << p_output << ": " << e.what() << endl;
+			exit(4);
+		}
+		known_runs.resize(runs->nrows());
+		hdf_read_rows(fout, "runs", 0, known_runs.size(), known_runs.data());
+		if(H5Lexists(fout, ParticleIndex::tablename, H5P_DEFAULT) > 0) {
+			particle_index = new ParticleIndex(fout, hdf_table_open, particles->nrows());
+		}
+		cout << "--- Appending to " << p_output << " (" << known_runs.size() << " runs, "
+		     << events->nrows() << " events, " << particles->nrows() << " particles) ---" << endl;
+	} else {
+		runs = new HDFTable<run_t>(fout, "runs");
+		if(!p_virtual) {
+			particles = new HDFTable<particle_t>(fout, "particles", 1, p_compress);
+			events = new HDFTable<event_t>(fout, "events", 1, p_compress);
+			particle_index = new ParticleIndex(fout);
+		}
+	}
 
-		{
-			// Copy events to the new file
-			size_t first_idx = this_events_info.findField("first");
-			const size_t first_offset = this_events_info.field_offsets[first_idx];
-			size_t eventid_idx = this_particles_info.findField("eventid");
-			const size_t eventid_offset = this_particles_info.field_offsets[eventid_idx];
-			const size_t type_size = this_events_info.type_size;
-			hsize_t buffered_records = BUFFER_SIZE/type_size;
-			for(hsize_t record=0, delta; record < this_events_info.nrecords; record+=delta) {
-				delta = min(this_events_info.nrecords-record, buffered_records);
-				cout << " > copying " << delta << " records." << endl;
-				H5TBread_records(fh, "events", record, delta, this_events_info.type_size,
-					this_events_info.field_offsets, this_events_info.field_sizes,
-					data
-				);
-				// update the event IDs
-				for(hsize_t j=0; j<delta; j++) {
-					unsigned int & first = *((unsigned int*)(data + j*type_size + first_offset));
-					first += particle_offset;
+	// The summaries of the runs add up, their `runs` counting the runs
+	// they cover
+	RunSummary summary(0);
+	size_t unsummarized = 0;
+	if(append && !summary.read(fout)) {
+		unsummarized += known_runs.size();
+	}
 
-					unsigned int & eventid = *((unsigned int*)(data + j*type_size + eventid_offset));
-					eventid += event_offset;
-				}
-				// write the buffer
-				H5TBappend_records(fout, "events", delta, this_events_info.type_size,
-					this_events_info.field_offsets, this_events_info.field_sizes,
-					data
-				);
+	// The tables throw if they can not be written to, e.g. on a full disk.
+	// The runs and the summary are written once the rows of the runs are,
+	// and the rows of a failed merge are dropped, so that the output is as
+	// it was and the runs can be appended again.
+	const hsize_t events_rows = table_rows(fout, "events");
+	const hsize_t particles_rows = table_rows(fout, "particles");
+	const hsize_t index_rows = table_rows(fout, ParticleIndex::tablename);
+	int ret = 0;
+	try {
+		vector<part_t> parts;
+		vector<run_t> new_runs;
+		const vector<string> merged = scan_inputs(inputs, known_runs,
+			events ? events->nrows() : 0, particles ? particles->nrows() : 0,
+			parts, new_runs, summary, unsummarized
+		);
+
+		if(merged.empty()) {
+			cout << "Nothing to merge." << endl;
+		} else if(p_virtual) {
+			cout << "--- Mapping files ---" << endl;
+			ret = merge_virtual(fout, merged, parts, p_buffer*1024*1024);
+		} else {
+			cout << "--- Merging files ---" << endl;
+			ParticleSorter * sorter = nullptr;
+			if(p_sort > 0) {
+				sorter = new ParticleSorter(p_memory*1024*1024, p_sort, p_tmpdir);
+				write_hdf5_attribute(fout, "particles_sort_bins", p_sort);
 			}
+			const size_t nbuffers = p_prefetch > 0 ? p_prefetch : 4*p_threads;
+			ret = merge_copy(fout, particle_index, sorter, merged, parts,
+				p_buffer*1024*1024, p_memory*1024*1024/nbuffers, nbuffers, p_threads
+			);
+			delete sorter;
 		}
-		{
-			// Copy particles to the new file
-			size_t eventid_idx = this_particles_info.findField("eventid");
-			const size_t eventid_offset = this_particles_info.field_offsets[eventid_idx];
-			const size_t type_size = this_particles_info.type_size;
-			hsize_t buffered_records = BUFFER_SIZE/type_size;
-			for(hsize_t record=0, delta; record < this_particles_info.nrecords; record+=delta) {
-				delta = min(this_particles_info.nrecords-record, buffered_records);
-				cout << " > copying " << delta << " records." << endl;
-				H5TBread_records(fh, "particles", record, delta, this_particles_info.type_size,
-					this_particles_info.field_offsets, this_particles_info.field_sizes,
-					data
-				);
-				// update the event IDs
-				for(hsize_t j=0; j<delta; j++) {
-					unsigned int & eventid = *((unsigned int*)(data + j*type_size + eventid_offset));
-					eventid += event_offset;
-				}
-				// write the buffer
-				H5TBappend_records(fout, "particles", delta, this_particles_info.type_size,
-					this_particles_info.field_offsets, this_particles_info.field_sizes,
-					data
-				);
+
+		if(ret == 0) {
+			for(const run_t &run : new_runs) {
+				runs->row() = run;
+				runs->write();
+			}
+			runs->flush();
+			if(H5Lexists(fout, RunSummary::groupname, H5P_DEFAULT) > 0) {
+				H5Ldelete(fout, RunSummary::groupname, H5P_DEFAULT);
+			}
+			summary.write(fout);
+			if(unsummarized > 0) {
+				cout << "Warning: " << unsummarized << " runs have no summary, which"
+				     << " therefore covers " << summary.totals().runs << " runs only." << endl;
 			}
 		}
-
-		event_offset += this_events_info.nrecords;
-		particle_offset += this_particles_info.nrecords;
-
-		H5Fclose(fh);
+	} catch(const exception &e) {
+		cerr << "Error: " << p_output << ": " << e.what() << endl;
+		ret = 3;
 	}
-	delete[] data;
 
-	H5Fclose(fout);
-
-	return 0;
+	delete particle_index;
+	delete particles;
+	delete events;
+	delete runs;
+	if(ret != 0 && !p_virtual) {
+		const bool truncated = truncate_table(fout, "events", events_rows)
+			&& truncate_table(fout, "particles", particles_rows)
+			&& truncate_table(fout, ParticleIndex::tablename, index_rows);
+		if(!truncated) {
+			cerr << "Error: unable to drop the rows of the failed merge from " << p_output << endl;
+		}
+	}
+	// HDF5 would crash at exit on a file that it could not close
+	if(H5Fclose(fout) < 0) {
+		cerr << "Error: unable to close " << p_output << endl;
+		cout.flush();
+		_exit(3);
+	}
+	return ret;
 }
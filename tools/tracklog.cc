@@ -0,0 +1,307 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <sstream>
+
+#include "../src/OutputTables.hh"
+
+using namespace std;
+
+// ---------------------------------------------------------------------
+// Argument parser settings
+// ---------------------------------------------------------------------
+#include <argp.h>
+
+const argp_option argp_options[] = {
+	{"csv", 'c', "TABLE", 0, "print the records of TABLE (tracks, steps,"
+		" secondaries or, of an --output=stream file, events, particles) as CSV"
+		" instead of the text view of the track log", 0},
+	{"info", 'i', 0, 0, "print the header of the stream", 0},
+	{0, 0, 0, 0, 0, 0}
+};
+
+string p_csv = "";
+bool p_info = false;
+
+error_t argp_parser(int key, char *arg, struct argp_state*) {
+	switch(key) {
+		case 'c':
+			p_csv = arg;
+			break;
+		case 'i':
+			p_info = true;
+			break;
+		default:
+			return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+const argp argp_argp = {
+	argp_options, &argp_parser, "FILE",
+	"Prints a track log written by fgamma --tracks (or any record stream,"
+	" see StreamOutput) as text or CSV. FILE can be - for stdin, e.g. to read"
+	" a compressed log.",
+	0, 0, 0
+};
+
+// ---------------------------------------------------------------------
+// The header of the stream
+// ---------------------------------------------------------------------
+struct field_t
+{
+	string name, type;
+	size_t offset, size;
+};
+
+struct table_t
+{
+	string name;
+	size_t size;
+	vector<field_t> fields;
+};
+
+// Reads the header up to the `end` line; throws if it is not a stream.
+map<uint32_t, table_t> read_header(FILE * in, vector<string> &lines)
+{
+	map<uint32_t, table_t> tables;
+	table_t * table = nullptr;
+	char buf[1024];
+	while(fgets(buf, sizeof(buf), in) != nullptr) {
+		string line(buf, strcspn(buf, "\n"));
+		if(line == "end") {
+			return tables;
+		}
+		lines.push_back(line);
+
+		istringstream ss(line);
+		string key;
+		ss >> key;
+		if(lines.size() == 1 && key != "fgamma-stream") {
+			throw runtime_error("not an fgamma record stream");
+		} else if(key == "byteorder") {
+			string order;
+			ss >> order;
+			const bool little = (H5Tget_order(H5T_NATIVE_INT) == H5T_ORDER_LE);
+			if((order == "little") != little) {
+				throw runtime_error("the stream has a different byte order");
+			}
+		} else if(key == "table") {
+			uint32_t tag;
+			size_t nfields;
+			ss >> tag;
+			table = &tables[tag];
+			ss >> table->name >> table->size >> nfields;
+		} else if(key == "field") {
+			if(table == nullptr) {
+				throw runtime_error("field before a table");
+			}
+			field_t field;
+			ss >> field.name >> field.offset >> field.size >> field.type;
+			table->fields.push_back(field);
+		}
+	}
+	throw runtime_error("the header is incomplete");
+}
+
+// Checks that a table of the stream has the layout of Row.
+template<class Row>
+bool same_layout(const table_t &table)
+{
+	typedef HDFTableSchema<Row> schema;
+	if(table.size != sizeof(Row) || table.fields.size() != schema::nfields) {
+		return false;
+	}
+	for(size_t i=0; i<schema::nfields; i++) {
+		const field_t &field = table.fields[i];
+		if(field.name != schema::fields[i].name || field.offset != schema::fields[i].offset || field.size != schema::fields[i].size) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// ---------------------------------------------------------------------
+// Printing the records
+// ---------------------------------------------------------------------
+void print_csv_header(const table_t &table)
+{
+	for(size_t i=0; i<table.fields.size(); i++) {
+		cout << (i > 0 ? "," : "") << table.fields[i].name;
+	}
+	cout << "\n";
+}
+
+void print_csv(const table_t &table, const char * record)
+{
+	for(size_t i=0; i<table.fields.size(); i++) {
+		const field_t &f = table.fields[i];
+		const char * value = record + f.offset;
+		if(i > 0) cout << ",";
+		if(f.type == "string") {
+			cout << string(value, strnlen(value, f.size));
+		} else if(f.type == "float") {
+			if(f.size == sizeof(float)) {
+				float v; memcpy(&v, value, sizeof(v)); cout << v;
+			} else {
+				double v; memcpy(&v, value, sizeof(v)); cout << v;
+			}
+		} else if(f.type == "int" || f.type == "uint") {
+			int64_t v = 0;
+			uint64_t u = 0;
+			switch(f.size) {
+				case 1: {int8_t x; memcpy(&x, value, 1); v = x; u = uint8_t(x);} break;
+				case 2: {int16_t x; memcpy(&x, value, 2); v = x; u = uint16_t(x);} break;
+				case 4: {int32_t x; memcpy(&x, value, 4); v = x; u = uint32_t(x);} break;
+				case 8: {memcpy(&v, value, 8); u = uint64_t(v);} break;
+			}
+			if(f.type == "int") cout << v; else cout << u;
+		} else {
+			cout << "?";
+		}
+	}
+	cout << "\n";
+}
+
+// The text view, as the track log was written before it became binary.
+class TextView
+{
+	uint32_t tracks, steps, secondaries;
+	bool first;
+	hsize_t eventid;
+
+	public:
+		explicit TextView(const map<uint32_t, table_t> &tables)
+		: tracks(0), steps(0), secondaries(0), first(true), eventid(0)
+		{
+			for(const pair<const uint32_t, table_t> &entry : tables) {
+				const table_t &table = entry.second;
+				if(table.name == "tracks" && same_layout<tracklog_track_t>(table)) {
+					tracks = entry.first;
+				} else if(table.name == "steps" && same_layout<tracklog_step_t>(table)) {
+					steps = entry.first;
+				} else if(table.name == "secondaries" && same_layout<tracklog_secondary_t>(table)) {
+					secondaries = entry.first;
+				}
+			}
+			if(tracks == 0 || steps == 0 || secondaries == 0) {
+				throw runtime_error("not a track log of this version (use --csv)");
+			}
+		}
+
+		void print(uint32_t tag, const char * record)
+		{
+			if(tag == tracks) {
+				tracklog_track_t t;
+				memcpy(&t, record, sizeof(t));
+				event(t.eventid);
+				if(!t.end) {
+					cout << "PreTrack [" << t.trackid << "]\n";
+				} else {
+					cout << "PostTrack[" << t.trackid << "]" << (t.boundary ? " [BOUNDARY]" : "") << "\n";
+				}
+			} else if(tag == steps) {
+				tracklog_step_t s;
+				memcpy(&s, record, sizeof(s));
+				event(s.eventid);
+				cout << " |-- Step(" << s.trackid << ") " << s.step << " secs=" << s.secondaries << "\n";
+			} else if(tag == secondaries) {
+				tracklog_secondary_t s;
+				memcpy(&s, record, sizeof(s));
+				event(s.eventid);
+				if(s.classified) {
+					cout << "CLASSIFY: " << s.parentid << "," << s.trackid;
+				} else {
+					cout << " |    - " << s.trackid;
+				}
+				cout << "," << s.pid << "," << s.name << "," << s.KE << "," << s.r << "," << s.process
+				     << (s.removed ? " [REMOVED]" : "") << "\n";
+			}
+		}
+
+	private:
+		// starts the records of an event, e.g. with the primaries put on
+		// the stack before its first track
+		void event(hsize_t id)
+		{
+			if(first || id != eventid) {
+				cout << "% event " << id << "\n";
+				first = false;
+				eventid = id;
+			}
+		}
+};
+
+int main(int argc, char * argv[])
+{
+	int argp_index;
+	argp_parse(&argp_argp, argc, argv, 0, &argp_index, 0);
+
+	if(argc-argp_index != 1) {
+		cerr << "Error: bad number of arguments." << endl;
+		exit(1);
+	}
+	const string path = argv[argp_index];
+	FILE * in = (path == "-") ? stdin : fopen(path.c_str(), "rb");
+	if(in == nullptr) {
+		cerr << "Error: unable to open " << path << endl;
+		exit(2);
+	}
+	setvbuf(in, nullptr, _IOFBF, 1024*1024);
+
+	try {
+		vector<string> header;
+		map<uint32_t, table_t> tables = read_header(in, header);
+		if(p_info) {
+			for(const string &line : header) {
+				cout << line << "\n";
+			}
+			return 0;
+		}
+
+		uint32_t csv = 0;
+		TextView * text = nullptr;
+		if(!p_csv.empty()) {
+			for(const pair<const uint32_t, table_t> &entry : tables) {
+				if(entry.second.name == p_csv) csv = entry.first;
+			}
+			if(csv == 0) {
+				throw runtime_error("no table "+p_csv);
+			}
+			print_csv_header(tables[csv]);
+		} else {
+			text = new TextView(tables);
+		}
+
+		vector<char> record;
+		uint32_t tag;
+		while(fread(&tag, sizeof(tag), 1, in) == 1) {
+			// markers carry the number of events so far
+			const size_t size = (tag == 0) ? sizeof(uint64_t) : tables.count(tag) ? tables[tag].size : 0;
+			if(size == 0) {
+				throw runtime_error("bad record tag "+to_string(tag));
+			}
+			record.resize(size);
+			if(fread(record.data(), size, 1, in) != 1) {
+				throw runtime_error("truncated record");
+			}
+			if(tag == 0) continue;
+			if(text != nullptr) {
+				text->print(tag, record.data());
+			} else if(tag == csv) {
+				print_csv(tables[csv], record.data());
+			}
+		}
+		delete text;
+	} catch(const exception &e) {
+		cout.flush();
+		cerr << "Error: " << path << ": " << e.what() << endl;
+		exit(3);
+	}
+	return 0;
+}
@@ -0,0 +1,197 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <hdf5.h>
+
+using namespace std;
+
+// ---------------------------------------------------------------------
+// Argument parser settings
+// ---------------------------------------------------------------------
+#include <argp.h>
+
+const argp_option argp_options[] = {
+	{"interval", 'i', "SECONDS", 0, "time between polls (default: 10)", 0},
+	{"count", 'n', "N", 0, "exit after N polls (default: 0 - never)", 0},
+	{0, 0, 0, 0, 0, 0}
+};
+
+unsigned int p_interval = 10;
+unsigned int p_count = 0;
+
+error_t argp_parser(int key, char *arg, struct argp_state*) {
+	switch(key) {
+		case 'i':
+			p_interval = atoi(arg);
+			break;
+		case 'n':
+			p_count = atoi(arg);
+			break;
+		default:
+			return ARGP_ERR_UNKNOWN;
+	}
+	return 0;
+}
+
+const argp argp_argp = {
+	argp_options, &argp_parser, "FILE",
+	"Follows the progress of an fgamma run writing FILE in SWMR mode (--swmr)."
+	" FILE can be the PREFIX.parts manifest of a run split into parts"
+	" (--rollevents, --rollsize), whose parts are followed as they are written.",
+	0, 0, 0
+};
+
+// ---------------------------------------------------------------------
+// The files being watched
+// ---------------------------------------------------------------------
+// A file open for SWMR reading, with its events and (if it has them) its
+// particles.
+struct watched_t
+{
+	hid_t file, events, particles;
+
+	watched_t() : file(-1), events(-1), particles(-1) {}
+};
+
+// Opens a file being written in SWMR mode; returns false if it can not
+// (yet) be opened, reporting why if quiet is not set.
+bool open_watched(const string &path, watched_t &w, bool quiet)
+{
+	H5E_BEGIN_TRY {
+		w.file = H5Fopen(path.c_str(), H5F_ACC_RDONLY | H5F_ACC_SWMR_READ, H5P_DEFAULT);
+	} H5E_END_TRY;
+	if(w.file < 0) {
+		if(!quiet) cerr << "Error: unable to open " << path << " (not written with --swmr?)" << endl;
+		return false;
+	}
+	if(H5Lexists(w.file, "events", H5P_DEFAULT) > 0) {
+		w.events = H5Dopen(w.file, "events", H5P_DEFAULT);
+	}
+	if(w.events < 0) {
+		if(!quiet) cerr << "Error: " << path << " has no events" << endl;
+		H5Fclose(w.file);
+		w.file = -1;
+		return false;
+	}
+	// which a file may not have
+	if(H5Lexists(w.file, "particles", H5P_DEFAULT) > 0) {
+		w.particles = H5Dopen(w.file, "particles", H5P_DEFAULT);
+	}
+	return true;
+}
+
+void close_watched(watched_t &w)
+{
+	if(w.particles >= 0) H5Dclose(w.particles);
+	if(w.events >= 0) H5Dclose(w.events);
+	if(w.file >= 0) H5Fclose(w.file);
+	w = watched_t();
+}
+
+hsize_t dataset_size(hid_t dataset)
+{
+	if(dataset < 0) return 0;
+	H5Drefresh(dataset);
+	hid_t space = H5Dget_space(dataset);
+	hsize_t dims[1];
+	H5Sget_simple_extent_dims(space, dims, NULL);
+	H5Sclose(space);
+	return dims[0];
+}
+
+// The finished parts listed in a manifest (`file first_event events
+// particles` per line) and their total numbers of rows.
+size_t read_manifest(const string &path, hsize_t &nevents, hsize_t &nparticles)
+{
+	ifstream manifest(path);
+	size_t nparts = 0;
+	nevents = nparticles = 0;
+	string line;
+	while(getline(manifest, line)) {
+		if(line.empty() || line[0] == '#') continue;
+		istringstream ss(line);
+		string file;
+		hsize_t first_event, events, particles;
+		// the last line may be partly written
+		if(!(ss >> file >> first_event >> events >> particles)) break;
+		nparts++;
+		nevents += events;
+		nparticles += particles;
+	}
+	return nparts;
+}
+
+// PREFIX.NNNN.h5, as written by fgamma
+string part_path(const string &prefix, size_t part)
+{
+	char name[32];
+	snprintf(name, sizeof(name), ".%04zu.h5", part);
+	return prefix+name;
+}
+
+int main(int argc, char * argv[])
+{
+	int argp_index;
+	argp_parse(&argp_argp, argc, argv, 0, &argp_index, 0);
+
+	if(argc-argp_index != 1) {
+		cerr << "Error: bad number of arguments." << endl;
+		exit(1);
+	}
+	const string path = argv[argp_index];
+	struct stat statbuf;
+	if(stat(path.c_str(), &statbuf) != 0) {
+		cerr << "Error(" << errno << "): stat() failed on " << path << endl;
+		exit(2);
+	}
+
+	// with a manifest, the part being written is the one after those listed
+	// in it, which may not have been created yet
+	const string suffix = ".parts";
+	const bool parts = path.size() > suffix.size() && path.compare(path.size()-suffix.size(), suffix.size(), suffix) == 0;
+	const string prefix = parts ? path.substr(0, path.size()-suffix.size()) : "";
+	watched_t current;
+	size_t current_part = 0;
+	if(!parts && !open_watched(path, current, false)) {
+		exit(3);
+	}
+
+	hsize_t last_events = 0, last_particles = 0;
+	for(unsigned int poll=1; ; poll++) {
+		hsize_t nevents = 0, nparticles = 0;
+		if(parts) {
+			const size_t nparts = read_manifest(path, nevents, nparticles);
+			if(current.file >= 0 && current_part != nparts) {
+				close_watched(current);
+			}
+			if(current.file < 0) {
+				current_part = nparts;
+				open_watched(part_path(prefix, current_part), current, true);
+			}
+		}
+		nevents += dataset_size(current.events);
+		nparticles += dataset_size(current.particles);
+
+		cout << "% watch " << time(nullptr)
+		     << "    events " << nevents << " (+" << (nevents-last_events) << ")"
+		     << "    particles " << nparticles << " (+" << (nparticles-last_particles) << ")";
+		if(parts) {
+			cout << "    part " << current_part;
+		}
+		cout << endl;
+		last_events = nevents;
+		last_particles = nparticles;
+
+		if(p_count > 0 && poll >= p_count) break;
+		sleep(p_interval);
+	}
+
+	close_watched(current);
+	return 0;
+}